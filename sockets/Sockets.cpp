@@ -27,6 +27,7 @@
 #include <cerrno>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR -1
 #define closesocket(s) ::close(s)
@@ -123,6 +124,11 @@ TCPSocketWrapper::TCPSocketWrapper(
 }
 
 void TCPSocketWrapper::listen(int port, int backlog)
+{
+    listen("", port, backlog);
+}
+
+void TCPSocketWrapper::listen(const string &address, int port, int backlog)
 {
     if (sockstate_ != CLOSED)
     {
@@ -143,6 +149,16 @@ void TCPSocketWrapper::listen(int port, int backlog)
     local.sin_port = htons((u_short)port);
     local.sin_addr.s_addr = htonl(INADDR_ANY);
 
+    if (!address.empty())
+    {
+        local.sin_addr.s_addr = inet_addr(address.c_str());
+        if (local.sin_addr.s_addr == INADDR_NONE)
+        {
+            closesocket(sock_);
+            throw SocketLogicException("invalid listen address");
+        }
+    }
+
     if (::bind(sock_, (sockaddr*)&local, sizeof(local)) == SOCKET_ERROR)
     {
         closesocket(sock_);
@@ -233,6 +249,21 @@ void TCPSocketWrapper::connect(const string &address, int port)
     sockstate_ = CONNECTED;
 }
 
+void TCPSocketWrapper::nodelay(bool on)
+{
+    if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
+    {
+        throw SocketLogicException("socket not connected");
+    }
+
+    int flag = on ? 1 : 0;
+    if (::setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY,
+        (const char*)&flag, sizeof(flag)) == SOCKET_ERROR)
+    {
+        throw SocketRunTimeException("setsockopt failed");
+    }
+}
+
 string TCPSocketWrapper::address() const
 {
     if (sockstate_ != CONNECTED && sockstate_ != ACCEPTED)
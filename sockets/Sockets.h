@@ -148,6 +148,9 @@ public:
 
     // binds and listens on a given port number
     void listen(int port, int backlog = 100);
+
+    // binds and listens on a given local address and port number
+    void listen(std::string const &address, int port, int backlog = 100);
     
     // accepts the new connection
     // it requires the earlier call to listen
@@ -160,6 +163,9 @@ public:
 
     // general methods
 
+    // disables (or re-enables) Nagle's algorithm on a connected socket
+    void nodelay(bool on = true);
+
     // get the network address and port number of the socket
     std::string address() const;
     int port() const;
@@ -0,0 +1,51 @@
+/* adapt.hpp -- codec adaptation definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _ADAPT_HPP_
+#define _ADAPT_HPP_
+
+//=============================================================================
+// CodecAdapter decides which of a list of codecs a call should be using,
+// from its loss and round trip. Level 0 is the first codec, for a good
+// link, and each level after it is for a worse one. A call goes one level
+// down after down_samples bad samples in a row and one level up after
+// up_samples good ones, and stays where it is for hold_ms after a switch,
+// so that a link on the edge does not renegotiate all the time. A switch
+// is only asked for: the level moves when SetLevel says the call got
+// there, and a switch that did not happen is asked for again after the
+// hold.
+
+class CodecAdapter
+{
+	public:
+		CodecAdapter(unsigned levels, float loss_high, float loss_low, unsigned rtt_high_ms,
+					 unsigned down_samples, unsigned up_samples, unsigned long hold_ms);
+
+		// a sample: percent of packets lost since the last one, the worse
+		// direction, and the round trip (0 for unknown). Returns the level
+		// to switch to, Level() to stay.
+		unsigned Update(float loss, unsigned rtt_ms, unsigned long now_ms);
+
+		// the level the call is on, as negotiated
+		void SetLevel(unsigned level) { if (level < levels_) level_ = level; }
+		unsigned Level() const { return level_; }
+
+	private:
+		unsigned levels_;
+		float loss_high_;		// at or above is bad
+		float loss_low_;		// at or under, with the round trip under rtt_high_, is good
+		unsigned rtt_high_;
+		unsigned down_samples_;
+		unsigned up_samples_;
+		unsigned long hold_ms_;
+
+		unsigned level_;
+		unsigned bad_;			// samples in a row
+		unsigned good_;
+		bool switched_;
+		unsigned long switched_at_;
+};
+
+#endif //_ADAPT_HPP_
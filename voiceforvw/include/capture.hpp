@@ -0,0 +1,98 @@
+/* capture.hpp -- capture path definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _CAPTURE_HPP_
+#define _CAPTURE_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+//=============================================================================
+// The background level under a microphone, as mean absolute sample. It
+// drops at once, rises quickly through what is not voice and only very
+// slowly through voice, so that a steady talker is not taken for noise but
+// a louder room is after a while. The VAD and the noise suppressor both
+// follow it.
+
+class NoiseFloor
+{
+	public:
+		NoiseFloor() : level_(-1) {}
+
+		// the background to hold a frame against: before the first frame
+		// is counted, that frame's own level
+		int Prime(int level) { if (level_ < 0) level_ = level; return level_; }
+
+		void Update(int level, bool voice);
+
+		int Level() const { return level_; }
+
+	private:
+		int level_;			// -1 until the first frame
+};
+
+//=============================================================================
+// Energy based voice activity detector. It follows the background noise
+// level and takes a frame for voice when it is well above it. The mode
+// is how aggressive it is about calling a frame silence, from 1 (keeps
+// everything that might be speech) to 3 (keeps only clear speech, cuts
+// word endings sooner).
+
+#define VAD_MODE_OFF	0
+#define VAD_MODE_MAX	3
+
+class VoiceDetector
+{
+	public:
+		VoiceDetector(int mode);
+
+		// count samples, every stride-th is looked at
+		bool IsVoice(const pj_int16_t *samples, unsigned count, unsigned stride);
+
+	private:
+		int mode_;
+		NoiseFloor noise_;
+		unsigned hangover_;	// frames still taken for voice after the last one
+};
+
+//=============================================================================
+// CapturePort gates the microphone on its way to one call: the bridge puts
+// the microphone into it and gets it back only while there is voice. In
+// silence the call gets no frame at all, so the stream neither encodes
+// nor sends RTP until the voice comes back.
+
+class CapturePort
+{
+	public:
+		CapturePort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame, int mode);
+		~CapturePort();
+
+		pjmedia_port* port() { return &port_; }
+
+		// frames seen and frames passed on, for the logs and benchmarks
+		unsigned long Frames() const { return frames_; }
+		unsigned long VoiceFrames() const { return voice_frames_; }
+
+	private:
+		static pj_status_t put_frame_(pjmedia_port*, const pjmedia_frame*);
+		static pj_status_t get_frame_(pjmedia_port*, pjmedia_frame*);
+
+	private:
+		pjmedia_port port_;
+
+		unsigned channel_count_;
+		VoiceDetector detector_;
+
+		pj_int16_t *frame_;		// the last frame, while it is voice
+		bool has_frame_;
+
+		volatile unsigned long frames_;
+		volatile unsigned long voice_frames_;
+
+	private:
+		CapturePort (const CapturePort&);
+		void operator= (const CapturePort&);
+};
+
+#endif //_CAPTURE_HPP_
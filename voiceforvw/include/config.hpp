@@ -8,6 +8,30 @@
 
 #include "tinyxml/tinyxml.h"
 
+//=============================================================================
+// A media profile: the pjsua_media_config settings that trade latency for
+// CPU, picked by name with MediaProfile
+
+struct MediaProfile
+{
+	const char *name;
+	unsigned clock_rate;		// Hz of the conference bridge and sound device
+	unsigned frame_ptime;		// msec of audio in each frame of the bridge
+	unsigned ptime;				// msec of audio in each RTP packet, 0 for the codec's own
+	unsigned snd_rec_latency;	// msec of sound device buffering
+	unsigned snd_play_latency;
+	int jb_init;				// msec of jitter buffer prefetch, -1 for pjmedia's default
+	int jb_min_pre;
+	int jb_max_pre;
+	int jb_max;					// msec the jitter buffer holds at most, -1 for the default
+	unsigned ec_tail_len;		// msec of echo cancellation, 0 turns it off
+	unsigned thread_cnt;		// media worker threads
+	unsigned quality;			// 1-10, resampling and codec quality against CPU
+};
+
+// NULL for an unknown name
+const MediaProfile* find_media_profile(const string& name);
+
 //=============================================================================
 // Server class
 
@@ -22,15 +46,71 @@ class Config
 			  LogFilter(""),
 			  VoiceServerURI(""),
 			  Realm("asterisk"),
-			  Codec("PCMU"),
 			  DisableOtherCodecs(false),
-			  Version(120)
-		{};
+			  Version(120),
+			  EnableMetrics(false),
+			  MetricsPort(44130),
+			  SIPBackend("pjsua"),
+			  FakeRegisterDelay(20),
+			  FakeRingDelay(20),
+			  FakeAnswerDelay(50),
+			  SpatialAudio(false),
+			  SpatialMinDistance(10.0f),
+			  SpatialMaxDistance(60.0f),
+			  SpatialCulling(true),
+			  SpatialQuietLevel(32),
+			  SIMDMixer(false),
+			  SpeakingOnLevel(21),
+			  SpeakingOffLevel(14),
+			  ParticipantEnergyDelta(0.05f),
+			  ParticipantHeartbeat(2000),
+			  VADMode(0),
+			  MediaProfile("balanced"),
+			  MaxCalls(4),
+			  MediaMux(false),
+			  MediaMuxPort(4000),
+			  MediaMuxBatch(32),
+			  SIPPort(5060),
+			  SIPPortRange(10),
+			  RTPPort(4000),
+			  RTPPortRange(200),
+			  PortStride(10),
+			  Instance(0),
+			  SIPTransport("udp"),
+			  SIPKeepAlive(30),
+			  SIPTLSCAFile(""),
+			  SIPTLSNoVerify(false),
+			  QualityInterval(5000),
+			  QualityEvents(false),
+			  AdaptLossHigh(5.0f),
+			  AdaptLossLow(1.0f),
+			  AdaptRttHigh(400),
+			  AdaptDownSamples(2),
+			  AdaptUpSamples(6),
+			  AdaptHoldTime(30000),
+			  DeviceRefreshInterval(5000),
+			  SplitSoundDevice(false),
+			  SoundDevice("device"),
+			  SoundCaptureFile(""),
+			  SoundRenderFile(""),
+			  CaptureHighPass(false),
+			  CaptureNoiseSuppression(false),
+			  CaptureAGC(false)
+		{
+			Codecs.push_back("PCMU");
+		};
 
         ~Config ();
 
 		void LoadConfig(string configFilePath);
 
+		// moves the ports and the log of instance n of several on one
+		// host out of the way of the others
+		void SetInstance(int n);
+
+		// what two of count instances would share a port on, "" if nothing
+		string CheckInstances(int count) const;
+
     public:
 		string ConfigFilePath;
 		string LogFilePath;
@@ -39,9 +119,58 @@ class Config
 		int Port;					// Port to receive communication through
 		string VoiceServerURI;		// Voice server URI to get user's SIP URI from
 		string Realm;				// Authentication realm
-		string Codec;				// Preferred codec
-		bool DisableOtherCodecs;	// true disables all codecs other than the preferred one
+		vector<string> Codecs;		// Preferred codecs, most preferred first
+		bool DisableOtherCodecs;	// true disables all codecs other than the preferred ones
 		int Version;
+		bool EnableMetrics;			// true enables the latency metrics endpoint
+		int MetricsPort;			// loopback port serving Prometheus text
+		string SIPBackend;			// "pjsua", or "fake" for load testing without SIP
+		int FakeRegisterDelay;		// fake backend: msec from REGISTER to its reply
+		int FakeRingDelay;			// fake backend: msec from INVITE/BYE to the first reply
+		int FakeAnswerDelay;		// fake backend: msec from ringing to answered
+		bool SpatialAudio;			// true pans and attenuates calls by Set3DPosition
+		float SpatialMinDistance;	// meters heard at full volume
+		float SpatialMaxDistance;	// meters beyond which a source is silent
+		bool SpatialCulling;		// true leaves silent sources out of the mix
+		int SpatialQuietLevel;		// mean absolute sample under which a frame is not mixed
+		bool SIMDMixer;				// true mixes calls with MixerPort instead of the bridge
+		int SpeakingOnLevel;		// mic level (0-255) at which speaking starts
+		int SpeakingOffLevel;		// mic level under which speaking stops, after a while
+		float ParticipantEnergyDelta;	// Energy change (0-1) worth a ParticipantPropertiesEvent
+		int ParticipantHeartbeat;	// msec after which an unchanged participant is sent again
+		int VADMode;				// 0 sends the mic all the time, 1-3 cut silence more and more
+		string MediaProfile;		// low-latency, balanced or low-cpu
+		int MaxCalls;				// calls at once, channels and private calls together
+		bool MediaMux;				// true carries all calls' RTP over one batched socket pair
+		int MediaMuxPort;			// MediaMux RTP port, RTCP on the next; 0 for any
+		int MediaMuxBatch;			// packets per recvmmsg/sendmmsg, 1 for none
+		int SIPPort;				// first UDP port tried for SIP; 0 for any
+		int SIPPortRange;			// ports tried from SIPPort before taking any
+		int RTPPort;				// first port of the per-call RTP transports
+		int RTPPortRange;			// RTP and MediaMux ports kept apart per instance
+		int PortStride;				// viewer and metrics ports kept apart per instance
+		int Instance;				// this process's number when started by --instances, 0 alone
+		string SIPTransport;		// udp, tcp or tls for registrations and calls
+		int SIPKeepAlive;			// seconds between keep-alives on idle SIP connections, 0 for none
+		string SIPTLSCAFile;		// CAs the server's TLS certificate is checked against
+		bool SIPTLSNoVerify;		// true allows tls without SIPTLSCAFile, the server unchecked
+		int QualityInterval;		// msec between two samples of a call's RTCP statistics, 0 for none
+		bool QualityEvents;			// true sends them to the viewer as SessionMediaQualityEvent
+		vector<string> AdaptiveCodecs;	// codecs calls switch between, for the best link first; none for no switching
+		float AdaptLossHigh;		// percent lost at which a sample is bad
+		float AdaptLossLow;			// percent lost under which a sample is good
+		int AdaptRttHigh;			// msec of round trip at which a sample is bad, 0 to ignore it
+		int AdaptDownSamples;		// bad samples in a row before a call moves down the list
+		int AdaptUpSamples;			// good samples in a row before it moves back up
+		int AdaptHoldTime;			// msec a call stays on a codec it switched to at least
+		int DeviceRefreshInterval;	// msec between two enumerations of the sound devices, 0 for on request only
+		bool SplitSoundDevice;		// true opens mic and speaker apart, to switch one alone; no echo canceller
+		string SoundDevice;			// "device", or "null" or "file" for a host without a sound card
+		string SoundCaptureFile;	// WAV the microphone reads, looped, with SoundDevice file; "" for silence
+		string SoundRenderFile;		// WAV the speaker is written to, with SoundDevice file; "" for none
+		bool CaptureHighPass;		// true filters rumble and DC out of the microphone
+		bool CaptureNoiseSuppression;	// true turns the microphone's background down
+		bool CaptureAGC;			// true brings the microphone's speech to one level
 
 	public:
 		string get_value (const string& name);
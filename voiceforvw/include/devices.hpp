@@ -0,0 +1,79 @@
+/* devices.hpp -- audio device cache definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _DEVICES_HPP_
+#define _DEVICES_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+#include <vector>
+#include <map>
+#include <boost/thread.hpp>
+
+//=============================================================================
+// The sound devices as last enumerated, by a worker thread of their own so
+// that neither startup nor Aux.Get*Devices waits on the sound driver.
+
+struct AudioDevice
+{
+	AudioDevice() : index(-1), capture(false), render(false) {}
+
+	int index;			// pjmedia_aud_dev_index
+	string name;
+	string driver;
+	bool capture;		// has inputs in a format pjsua can use
+	bool render;		// has outputs in one
+
+	bool operator== (const AudioDevice& d) const {
+		return index == d.index && name == d.name && driver == d.driver
+			&& capture == d.capture && render == d.render;
+	}
+};
+
+class AudioDeviceCache
+{
+	public:
+		AudioDeviceCache();
+
+		// the worker: enumerates now, then every DeviceRefreshInterval msec
+		// and whenever Refresh is called
+		void operator()();
+
+		// asks the worker for a new enumeration and returns at once
+		void Refresh();
+
+		// as of the last enumeration. Until the first one is done these wait
+		// for it, a little.
+		vector<AudioDevice> Devices();
+		string CaptureDevicesXml();
+		string RenderDevicesXml();
+
+		// the pjmedia index of the device with that name, -1 if there is none
+		int Find(const string& name);
+
+		// held by whoever initializes or shuts down the sound subsystem,
+		// pjsua included, which the worker must not race
+		static boost::mutex& SubsysMutex();
+
+	private:
+		bool enumerate_(vector<AudioDevice>&);
+		void store_(const vector<AudioDevice>&);
+		void wait_ready_(boost::mutex::scoped_lock&);
+
+	private:
+		boost::mutex mutex_;
+		boost::condition_variable cond_;
+		bool ready_;
+		bool requested_;
+
+		vector<AudioDevice> devices_;
+		map<string, int> index_;		// name -> pjmedia index
+		string captureXml_;
+		string renderXml_;
+
+		pj_thread_desc desc_;
+};
+
+#endif //_DEVICES_HPP_
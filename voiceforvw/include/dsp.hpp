@@ -0,0 +1,128 @@
+/* dsp.hpp -- capture processing definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _DSP_HPP_
+#define _DSP_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+#include "capture.hpp"
+
+//=============================================================================
+// Frame kernels. Like the mixing kernels the SIMD versions (AVX2, SSE2 or
+// NEON, whichever the build targets) are bit exact with the scalar ones.
+// Gains are Q12, as the mixer's.
+
+// mean absolute sample, -32768 counted as 32767
+unsigned dsp_level(const pj_int16_t *in, unsigned count);
+unsigned dsp_level_scalar(const pj_int16_t *in, unsigned count);
+
+// samples[i] = (samples[i] * gain) >> 12, saturated to 16 bit
+void dsp_gain(pj_int16_t *samples, unsigned count, pj_int16_t gain);
+void dsp_gain_scalar(pj_int16_t *samples, unsigned count, pj_int16_t gain);
+
+// the instruction set the kernels were built for
+const char* dsp_kernels();
+
+//=============================================================================
+// Capture stages, each working on a mono frame in place
+
+// first order high-pass, for rumble and DC from cheap microphones. Each
+// sample depends on the one before, so this one is not vectorized.
+class HighPassFilter
+{
+	public:
+		HighPassFilter(unsigned clock_rate, unsigned cutoff_hz);
+
+		void Process(pj_int16_t *samples, unsigned count);
+
+	private:
+		pj_int32_t r_;		// pole, Q15
+		pj_int32_t x1_;		// last input
+		pj_int32_t y1_;		// last output, with 8 more bits
+};
+
+// a downward expander: frames near the background level are turned down,
+// so that fans and hiss between words are not sent at full level. It
+// follows the background with the VAD's NoiseFloor.
+class NoiseSuppressor
+{
+	public:
+		NoiseSuppressor();
+
+		void Process(pj_int16_t *samples, unsigned count);
+
+	private:
+		NoiseFloor noise_;
+		pj_int16_t gain_;	// Q12, as last applied
+};
+
+// automatic gain control: speech is brought to a target level, slowly up
+// and quickly down, never more than 8 times. Quiet frames leave the gain
+// where it is, so the background is not pumped up between words.
+class GainControl
+{
+	public:
+		GainControl();
+
+		void Process(pj_int16_t *samples, unsigned count);
+
+	private:
+		pj_int32_t gain_;	// Q12
+};
+
+// the stages in order: high-pass, noise suppression, gain control
+class CapturePipeline
+{
+	public:
+		CapturePipeline(unsigned clock_rate, bool high_pass, bool noise, bool agc);
+
+		void Process(pj_int16_t *samples, unsigned count);
+
+	private:
+		bool high_pass_;
+		bool noise_;
+		bool agc_;
+
+		HighPassFilter filter_;
+		NoiseSuppressor suppressor_;
+		GainControl control_;
+};
+
+//=============================================================================
+// DspPort runs the microphone through a CapturePipeline once for all the
+// calls: the bridge puts the microphone into it, and the calls, their VAD
+// gates and their meters take it from there instead of from the sound
+// device's slot.
+
+class DspPort
+{
+	public:
+		DspPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame,
+				bool high_pass, bool noise, bool agc);
+		~DspPort();
+
+		pjmedia_port* port() { return &port_; }
+
+	private:
+		static pj_status_t put_frame_(pjmedia_port*, const pjmedia_frame*);
+		static pj_status_t get_frame_(pjmedia_port*, pjmedia_frame*);
+
+	private:
+		pjmedia_port port_;
+
+		unsigned channel_count_;
+		CapturePipeline pipeline_;
+
+		pj_int16_t *mono_;		// channel 0 of the frame being processed
+		pj_int16_t *frame_;		// the last frame, processed
+		bool has_frame_;
+
+	private:
+		DspPort (const DspPort&);
+		void operator= (const DspPort&);
+};
+
+#endif //_DSP_HPP_
@@ -19,6 +19,9 @@
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 
+#include <metrics.hpp>
+#include <devices.hpp>
+
 using namespace boost::statechart;
 
 //=============================================================================
@@ -47,6 +50,7 @@ enum EventType
     EventType_DialDisconnected,
     EventType_Position,
 	EventType_SessionRemove,
+	EventType_Participant,
 };
 
 struct Event
@@ -58,6 +62,10 @@ struct Event
 	ResponseBase *result;
 	EventType type;
 	string event_name;
+
+	// latency metrics, left as not_a_date_time when not taken
+	MetricTime received_at;
+	MetricTime enqueued_at;
 };
 
 struct ConnectorEvent : public Event
@@ -217,6 +225,15 @@ struct SessionRemoveEvent : public SessionEvent, event <SessionRemoveEvent> {
 	};
 };
 
+// Session.SetParticipantVolumeForMe and Session.SetParticipantMuteForMe,
+// told apart by the request's type
+struct ParticipantEvent : public SessionEvent, event <ParticipantEvent> {
+	ParticipantEvent() {
+		type = EventType_Participant;
+		event_name = string("ParticipantEvent");
+	};
+};
+
 //=============================================================================
 // BlockingQueue class
 class BlockingQueue
@@ -227,6 +244,7 @@ class BlockingQueue
         
 		void enqueue(void *data);
 		void* dequeue();
+		void* dequeue(unsigned int timeout_ms);	// NULL on timeout
 
     private:
 		typedef boost::mutex::scoped_lock _lock;
@@ -245,8 +263,8 @@ class EventManager
 		void operator()();
 		pj_thread_desc desc;
 
-		string CaptureDevices;
-		string RenderDevices;
+		// enumerated by a thread of its own, started with the manager
+		AudioDeviceCache Devices;
 		string CurrentCaptureDevice;
 		string CurrentRenderDevice;
 
@@ -255,6 +273,9 @@ class EventManager
 		void processConnector(ConnectorEvent*);
 		void processAccount(AccountEvent*);
 		void processSession(SessionEvent*);
+
+		void record_metrics_(const Event*, const MetricTime& dequeued,
+			const MetricTime& reacted, const MetricTime& formatted, const MetricTime& sent);
 };
 
 
@@ -27,12 +27,14 @@ using namespace std;
 #include <parameters.hpp>
 #include <parsing.hpp>
 #include <sip.hpp>
+#include <metrics.hpp>
 #include <event.hpp>
 #include <state.hpp>
 #include <server.hpp>
 
 extern Config *g_config;
 extern Logger *g_logger;
+extern Metrics *g_metrics;
 
 // global reference to server instance 
 // created in main.cpp
@@ -52,6 +54,16 @@ extern EventManager g_eventManager;
 #define VFVW_PJ_VOLUME_MAX		3
 #define VFVW_PJ_VOLUME_RANGE	(VFVW_PJ_VOLUME_MAX - VFVW_PJ_VOLUME_MIN)
 
+// Session.SetParticipantVolumeForMe: 0 to 100, 50 as sent
+#define VFVW_SL_PARTICIPANT_VOLUME_MAX		100
+#define VFVW_SL_PARTICIPANT_VOLUME_UNITY	50
+
+// meters
+#define VFVW_SPATIAL_CULL_HYSTERESIS	2.0f
+
+// msec between two looks at the sessions' meters
+#define VFVW_METER_POLL_INTERVAL	50
+
 //=============================================================================
 static string get_line_ (istream& in) {
     string line;
@@ -0,0 +1,229 @@
+/* mediamux.hpp -- shared media transport definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _MEDIAMUX_HPP_
+#define _MEDIAMUX_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+#ifdef WIN32
+#include <winsock2.h>
+typedef SOCKET mux_socket_t;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+typedef int mux_socket_t;
+#endif
+
+#include <boost/thread.hpp>
+#include <cstring>
+#include <map>
+#include <vector>
+
+// packets sent within this long of each other go out in one sendmmsg; the
+// conference bridge encodes every call in one go, so they are close
+#define MEDIAMUX_COALESCE_USEC	1000
+
+// packets per recvmmsg/sendmmsg at most
+#define MEDIAMUX_BATCH_MAX		64
+
+// packets waiting to be sent at most, any more are dropped
+#define MEDIAMUX_QUEUE_MAX		1024
+
+#define MEDIAMUX_PACKET_MAX		1500
+
+// for this long after it is attached a call follows its SSRC to another
+// address, as pjmedia's UDP transport does in its probation; after it,
+// only to another port of the same address
+#define MEDIAMUX_PROBATION_MSEC	5000
+
+//=============================================================================
+// One call's end of a MediaMux. The mux calls OnRtp/OnRtcp from its receive
+// thread with the packets from the call's remote address or, once one came
+// from there, with its SSRC from the same host or during the probation.
+
+class MuxChannel
+{
+	public:
+		MuxChannel() : has_ssrc_(false), ssrc_(0)
+		{
+			memset(&rtp_remote_, 0, sizeof(rtp_remote_));
+			memset(&rtcp_remote_, 0, sizeof(rtcp_remote_));
+		}
+		virtual ~MuxChannel() {}
+
+		virtual void OnRtp(void *pkt, pj_ssize_t size) = 0;
+		virtual void OnRtcp(void *pkt, pj_ssize_t size) = 0;
+
+	private:
+		friend class MediaMux;
+
+		// MediaMux's mutex
+		sockaddr_in rtp_remote_;
+		sockaddr_in rtcp_remote_;
+		bool has_ssrc_;
+		pj_uint32_t ssrc_;		// the remote's, in network order
+		boost::posix_time::ptime probation_end_;
+};
+
+// what the batching saved: packets against the system calls they took
+struct MediaMuxStats
+{
+	MediaMuxStats() : rx_packets(0), rx_calls(0), tx_packets(0), tx_calls(0), unknown(0), refused(0), dropped(0) {}
+
+	unsigned long rx_packets;
+	unsigned long rx_calls;
+	unsigned long tx_packets;
+	unsigned long tx_calls;
+	unsigned long unknown;		// received from no call's address or SSRC
+	unsigned long refused;		// from a call's SSRC at an address it may not move to
+	unsigned long dropped;		// not sent, the queue was full
+};
+
+//=============================================================================
+// MediaMux carries the RTP and RTCP of many calls over one pair of UDP
+// sockets, port and port + 1. A receive thread takes up to batch packets
+// per recvmmsg and hands each to its call by remote address, falling back
+// to the SSRC so that a remote behind a NAT that moves still finds its
+// call. Sends are queued and a send thread puts them out with sendmmsg,
+// up to batch at a time. Without recvmmsg/sendmmsg (other than Linux)
+// it does one recvfrom/sendto per packet, like pjmedia's UDP transport.
+
+class MediaMux
+{
+	public:
+		// batch is clamped to 1..MEDIAMUX_BATCH_MAX
+		MediaMux(unsigned batch);
+		~MediaMux();
+
+		// binds to addr's port, any if 0, and starts the threads
+		pj_status_t Open(const sockaddr_in& addr);
+		void Close();
+
+		pj_uint16_t RtpPort() const { return rtp_port_; }
+		pj_uint16_t RtcpPort() const { return rtcp_port_; }
+		pj_sock_t RtpSocket() const { return (pj_sock_t)rtp_sock_; }
+		pj_sock_t RtcpSocket() const { return (pj_sock_t)rtcp_sock_; }
+
+		// PJ_EEXISTS if another channel has either remote address: the
+		// two could not be told apart until their SSRCs are known
+		pj_status_t Attach(MuxChannel*, const sockaddr_in& rtp_remote, const sockaddr_in& rtcp_remote);
+
+		// no OnRtp/OnRtcp is running or will be for the channel once this
+		// returns, unless it is called from one
+		void Detach(MuxChannel*);
+
+		pj_status_t Send(MuxChannel*, bool rtcp, const void *pkt, pj_size_t size);
+		pj_status_t SendTo(const sockaddr_in& to, bool rtcp, const void *pkt, pj_size_t size);
+
+		MediaMuxStats Stats();
+
+	private:
+		struct Packet
+		{
+			bool rtcp;
+			sockaddr_in to;
+			pj_size_t size;
+			char data[MEDIAMUX_PACKET_MAX];
+		};
+
+		typedef std::map<pj_uint64_t, MuxChannel*> AddressMap;
+		typedef std::map<pj_uint32_t, MuxChannel*> SsrcMap;
+
+		static pj_uint64_t key_(const sockaddr_in&);
+
+		void receive_();
+		void send_();
+		unsigned receive_batch_(mux_socket_t sock, bool rtcp);
+		void dispatch_(bool rtcp, const sockaddr_in& from, char *pkt, pj_ssize_t size);
+		void send_batch_(std::vector<Packet*>& packets);
+
+	private:
+		unsigned batch_;
+
+		mux_socket_t rtp_sock_;
+		mux_socket_t rtcp_sock_;
+		pj_uint16_t rtp_port_;
+		pj_uint16_t rtcp_port_;
+
+		volatile bool running_;
+		boost::thread *receiver_;
+		boost::thread *sender_;
+
+		// channels by remote address and SSRC, their addresses, stats
+		boost::mutex mutex_;
+		AddressMap rtp_channels_;
+		AddressMap rtcp_channels_;
+		SsrcMap ssrc_channels_;
+		MediaMuxStats stats_;
+
+		// held by the receive thread while it calls the channels
+		boost::mutex dispatch_mutex_;
+
+		// packets to send, and free ones to fill
+		boost::mutex queue_mutex_;
+		boost::condition_variable queue_cond_;
+		std::vector<Packet*> queue_;
+		std::vector<Packet*> free_;
+		unsigned long dropped_;
+
+		// the receive thread's
+		std::vector<char*> rx_buffers_;
+
+	private:
+		MediaMux (const MediaMux&);
+		void operator= (const MediaMux&);
+};
+
+//=============================================================================
+// MuxTransport is a pjmedia_transport over a MediaMux, one per call slot of
+// pjsua. pjsua takes them with pjsua_media_transports_attach in place of
+// a UDP transport per call.
+
+class MuxTransport : public MuxChannel
+{
+	public:
+		MuxTransport(MediaMux *mux, const pj_sockaddr& public_addr, int index);
+
+		pjmedia_transport* transport() { return &tp_; }
+		void GetSockInfo(pjmedia_sock_info *info);
+
+		void OnRtp(void *pkt, pj_ssize_t size);
+		void OnRtcp(void *pkt, pj_ssize_t size);
+
+	private:
+		static pj_status_t get_info_(pjmedia_transport*, pjmedia_transport_info*);
+		static pj_status_t attach_(pjmedia_transport*, void*, const pj_sockaddr_t*, const pj_sockaddr_t*, unsigned,
+			void (*)(void*, void*, pj_ssize_t), void (*)(void*, void*, pj_ssize_t));
+		static void detach_(pjmedia_transport*, void*);
+		static pj_status_t send_rtp_(pjmedia_transport*, const void*, pj_size_t);
+		static pj_status_t send_rtcp_(pjmedia_transport*, const void*, pj_size_t);
+		static pj_status_t send_rtcp2_(pjmedia_transport*, const pj_sockaddr_t*, unsigned, const void*, pj_size_t);
+		static pj_status_t media_create_(pjmedia_transport*, pj_pool_t*, unsigned, const pjmedia_sdp_session*, unsigned);
+		static pj_status_t encode_sdp_(pjmedia_transport*, pj_pool_t*, pjmedia_sdp_session*, const pjmedia_sdp_session*, unsigned);
+		static pj_status_t media_start_(pjmedia_transport*, pj_pool_t*, const pjmedia_sdp_session*, const pjmedia_sdp_session*, unsigned);
+		static pj_status_t media_stop_(pjmedia_transport*);
+		static pj_status_t simulate_lost_(pjmedia_transport*, pjmedia_dir, unsigned);
+		static pj_status_t destroy_(pjmedia_transport*);
+
+		static pjmedia_transport_op op_;
+
+	private:
+		pjmedia_transport tp_;
+		MediaMux *mux_;
+		pj_sockaddr public_addr_;
+
+		// set by attach, used by the receive thread until detach returns
+		void *user_data_;
+		void (*rtp_cb_)(void*, void*, pj_ssize_t);
+		void (*rtcp_cb_)(void*, void*, pj_ssize_t);
+
+	private:
+		MuxTransport (const MuxTransport&);
+		void operator= (const MuxTransport&);
+};
+
+#endif //_MEDIAMUX_HPP_
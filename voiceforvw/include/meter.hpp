@@ -0,0 +1,69 @@
+/* meter.hpp -- signal meter definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _METER_HPP_
+#define _METER_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+//=============================================================================
+// A meter's last reading. Levels are on the scale of
+// pjsua_conf_get_signal_level: 0 is silence, a full scale signal is 127.
+
+struct MeterReading
+{
+	MeterReading() : level(0), peak(0), speaking(false) {}
+
+	unsigned level;		// RMS of the last frame
+	unsigned peak;		// largest sample of the last frame
+	bool speaking;
+};
+
+// A reading packed in one word: the meter stores it from the bridge's
+// clock thread and anyone loads it, without a lock
+typedef volatile pj_uint32_t MeterSnapshot;
+
+MeterReading read_meter(const MeterSnapshot&);
+
+//=============================================================================
+// MeterPort listens to the microphone in the conference bridge, with the
+// tx level of the call it meters, and publishes the level of every frame
+// to a snapshot as the frame goes through. Nothing has to poll
+// pjsua_conf_get_signal_level, which takes the pjsua lock.
+//
+// Speaking starts on the first frame at on_level or above and stops once
+// the level has stayed under off_level for a hangover of frames.
+
+class MeterPort
+{
+	public:
+		MeterPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame,
+				  unsigned on_level, unsigned off_level, MeterSnapshot *snapshot);
+
+		pjmedia_port* port() { return &port_; }
+
+	private:
+		static pj_status_t put_frame_(pjmedia_port*, const pjmedia_frame*);
+		static pj_status_t get_frame_(pjmedia_port*, pjmedia_frame*);
+
+	private:
+		pjmedia_port port_;
+
+		unsigned channel_count_;
+		unsigned on_level_;
+		unsigned off_level_;
+
+		// the bridge's clock thread only
+		bool speaking_;
+		unsigned quiet_frames_;
+
+		MeterSnapshot *snapshot_;
+
+	private:
+		MeterPort (const MeterPort&);
+		void operator= (const MeterPort&);
+};
+
+#endif //_METER_HPP_
@@ -0,0 +1,146 @@
+/* metrics.hpp -- latency metrics definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+//=============================================================================
+// Time helpers
+
+typedef boost::posix_time::ptime MetricTime;
+
+inline MetricTime metrics_now()
+{
+	return boost::posix_time::microsec_clock::universal_time();
+}
+
+// returns -1 if either timestamp was never taken
+inline long metrics_elapsed_usec(const MetricTime& from, const MetricTime& to)
+{
+	if (from.is_not_a_date_time() || to.is_not_a_date_time())
+		return -1;
+	return (long)(to - from).total_microseconds();
+}
+
+//=============================================================================
+// Stages a request goes through, from the viewer socket to the response
+enum MetricStage
+{
+	MetricStage_Parse,		// RequestParser and event creation
+	MetricStage_Queue,		// waiting in EventManager::blockQueue
+	MetricStage_React,		// state machine reaction
+	MetricStage_Format,		// response ToString()
+	MetricStage_Send,		// Server::Send
+	MetricStage_Total,		// received to sent
+	MetricStage_Count
+};
+
+//=============================================================================
+// LatencyHistogram class
+//
+// HDR-style log-linear histogram of microsecond values. Values below 32 us
+// get their own bucket, above that each power of two is split into 16
+// sub-buckets, which keeps the relative error under 6.25% up to ~35 minutes.
+
+class LatencyHistogram
+{
+	public:
+		enum {
+			SubBucketBits = 4,
+			SubBucketCount = 1 << SubBucketBits,	// 16
+			LinearCount = 2 * SubBucketCount,		// 32
+			MaxExponent = 26,
+			BucketCount = LinearCount + MaxExponent * SubBucketCount
+		};
+
+		LatencyHistogram();
+
+		void Record(long usec);
+
+		unsigned long long Count() const;
+		unsigned long long Sum() const;
+		long Percentile(double p) const;
+
+		// number of samples <= usec, exact when usec is a bucket's upper
+		// bound, as 2^n - 1 always is
+		unsigned long long CountBelow(long usec) const;
+
+		static int BucketIndex(long usec);
+		static long BucketUpperBound(int index);
+
+	private:
+		unsigned long long counts_[BucketCount];
+		unsigned long long count_;
+		unsigned long long sum_;
+		long max_;
+
+		mutable boost::mutex mutex_;
+};
+
+//=============================================================================
+// Metrics class
+//
+// One histogram per (ActionType, stage) for viewer requests and one per
+// (EventType, stage) for everything that goes through the EventManager,
+// including SIP callbacks that have no request attached. Gauges of the
+// quality of every session with media, and how long sound device switches
+// leave a direction silent.
+
+class Metrics
+{
+	public:
+		Metrics();
+		~Metrics();
+
+		void RecordAction(int action, MetricStage stage, long usec);
+		void RecordEvent(int event, MetricStage stage, long usec);
+
+		// the last quality sample of a session, until it is removed
+		void SetCallQuality(const string& session, const CallQuality&);
+		void RemoveCallQuality(const string& session);
+
+		// from the old device stopping to the new one running
+		void RecordDeviceSwitch(bool capture, long usec);
+
+		string ToPrometheus();
+
+	private:
+		enum { ActionCount = 32, EventCount = 32 };
+
+		LatencyHistogram* get_(LatencyHistogram **table, int key, MetricStage stage);
+		void format_(stringstream& out, LatencyHistogram **table, int count,
+			const string& metric, const string& label, string (*name)(int), bool quantiles);
+
+		LatencyHistogram *actions_[ActionCount * MetricStage_Count];
+		LatencyHistogram *events_[EventCount * MetricStage_Count];
+
+		map<string, CallQuality> calls_;
+
+		LatencyHistogram switches_[2];		// capture, render
+
+		boost::mutex mutex_;
+};
+
+//=============================================================================
+// MetricsServer class
+//
+// Serves the Prometheus text exposition on the loopback interface.
+// Runs in its own thread; any request on the socket gets the full dump.
+
+class MetricsServer
+{
+	public:
+		MetricsServer(int port) : port_(port) {};
+
+		void operator()();
+
+	private:
+		int port_;
+};
+
+#endif //_METRICS_HPP_
@@ -0,0 +1,75 @@
+/* mixer.hpp -- audio mixer definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _MIXER_HPP_
+#define _MIXER_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+#include <vector>
+#include <boost/thread.hpp>
+
+class SpatialPort;
+
+//=============================================================================
+// Mixing kernels. Sources are summed into a 32 bit accumulator, which is
+// saturated to 16 bit once all of them are in. The SIMD kernels (AVX2,
+// SSE2 or NEON, whichever the build targets) are bit exact with the
+// scalar ones.
+
+// gains are Q12: 4096 is unity, the largest is just under 8
+#define MIXER_GAIN_SHIFT	12
+#define MIXER_GAIN_UNITY	(1 << MIXER_GAIN_SHIFT)
+
+pj_int16_t mix_gain(float gain);
+
+// acc[i] += (in[i] * gain) >> 12
+void mix_accumulate(pj_int32_t *acc, const pj_int16_t *in, unsigned count, pj_int16_t gain);
+void mix_accumulate_scalar(pj_int32_t *acc, const pj_int16_t *in, unsigned count, pj_int16_t gain);
+
+// out[i] = acc[i] saturated to 16 bit
+void mix_saturate(const pj_int32_t *acc, pj_int16_t *out, unsigned count);
+void mix_saturate_scalar(const pj_int32_t *acc, pj_int16_t *out, unsigned count);
+
+// the instruction set the kernels were built for
+const char* mix_kernels();
+
+//=============================================================================
+// MixerPort mixes every call to the sound device in one pass, in place of
+// the conference bridge: each call is put into its own SpatialPort, which
+// is not connected any further, and the mixer takes the frames straight
+// from them. The mixer is then the only source of the sound device's slot,
+// so the bridge has nothing left to mix there.
+
+class MixerPort
+{
+	public:
+		MixerPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame);
+		~MixerPort();
+
+		pjmedia_port* port() { return &port_; }
+
+		// called from the pjsua callbacks, the bridge's clock thread mixes
+		void AddInput(SpatialPort*);
+		void RemoveInput(SpatialPort*);
+
+	private:
+		static pj_status_t put_frame_(pjmedia_port*, const pjmedia_frame*);
+		static pj_status_t get_frame_(pjmedia_port*, pjmedia_frame*);
+
+	private:
+		pjmedia_port port_;
+
+		pj_int32_t *acc_;		// one frame, all channels
+
+		std::vector<SpatialPort*> inputs_;
+		boost::mutex mutex_;	// guards inputs_
+
+	private:
+		MixerPort (const MixerPort&);
+		void operator= (const MixerPort&);
+};
+
+#endif //_MIXER_HPP_
@@ -22,6 +22,7 @@ const string ParticipantPropertiesEventString ("ParticipantPropertiesEvent");
 const string ParticipantStateChangeEventString ("ParticipantStateChangeEvent");
 const string SessionStateChangeEventString ("SessionStateChangeEvent");
 const string MediaStreamUpdatedEventString ("MediaStreamUpdatedEvent");				// v1.22
+const string SessionMediaQualityEventString ("SessionMediaQualityEvent");			// SLVoice's own
 
 const string AccountLogin1String ("Account.Login.1");
 const string AccountLogout1String ("Account.Logout.1");
@@ -310,6 +311,7 @@ struct Request
     virtual void SetState(Session& state) const;
     virtual void SetState(Audio& state) const;
     virtual void SetState(Orientation& state) const;
+    virtual void SetState(Orientation& speaker, Orientation& listener) const;
 
 	virtual ResponseBase* CreateResponse(const string& return_code);
 };
@@ -369,6 +371,8 @@ struct AuxGetCaptureDevicesRequest : public Request
 
     // No data
 
+	void SetState (Audio& state) const;
+
 	AuxGetCaptureDevicesResponse* CreateResponse(const string& return_code);
 };
 
@@ -379,6 +383,8 @@ struct AuxGetRenderDevicesRequest : public Request
 
     // No data
 
+	void SetState (Audio& state) const;
+
 	AuxGetRenderDevicesResponse* CreateResponse(const string& return_code);
 };
 
@@ -532,6 +538,7 @@ struct SessionSet3DPositionRequest : public Request
     Orientation listener;
         
     void SetState (Orientation& state) const;
+    void SetState (Orientation& speaker, Orientation& listener) const;
 
 // TODO : unnecessary?
 //	SessionSet3DPositionResponse* CreateResponse();
@@ -748,6 +755,27 @@ struct ParticipantPropertiesEvent : public EventBase
 	string ToString();
 };
 
+// not a Vivox event, only sent with QualityEvents; viewers that do not
+// know it skip it
+struct SessionMediaQualityEvent : public EventBase
+{
+    SessionMediaQualityEvent (const string& t="SessionMediaQualityEvent")
+        : EventBase (t) {}
+
+    string SessionHandle;
+    string PacketsReceived;
+    string PacketsLost;
+    string PacketLoss;			// percent lost since the last event
+    string RemotePacketsLost;
+    string Jitter;				// msec
+    string RoundTripTime;		// msec
+    string JitterBufferFrames;
+    string JitterBufferPrefetch;
+    string ConcealedFrames;
+
+	string ToString();
+};
+
 struct AuxAudioPropertiesEvent : public EventBase
 {
     AuxAudioPropertiesEvent (const string& t="AuxAudioPropertiesEvent")
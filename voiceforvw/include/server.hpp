@@ -39,7 +39,7 @@ class Server
 
     private:
         //void enqueue_request_ (char* mesg);
-        void process_request_queue_(const char* mesg);
+        void process_request_queue_(const char* mesg, const MetricTime& received);
         //void flush_messages_on_event_ (Event& ev);
 
     private:
@@ -49,6 +49,7 @@ class Server
 
         TCPSocketWrapper server_;
         auto_ptr <TCPSocketWrapper> sock_;
+        boost::mutex send_mutex_;
 
 		//Request *request;
 		//ResponseBase *response;
@@ -8,6 +8,19 @@
 
 #include <pjsua-lib/pjsua.h>
 
+#include <map>
+#include <set>
+#include <boost/thread.hpp>
+
+#include "spatial.hpp"
+#include "mixer.hpp"
+#include "meter.hpp"
+#include "capture.hpp"
+#include "mediamux.hpp"
+#include "adapt.hpp"
+#include "sound.hpp"
+#include "dsp.hpp"
+
 //#define VFVW_REALM	"asterisk"
 
 //=============================================================================
@@ -36,7 +49,85 @@ struct SIPServerInfo
 	string reguri;
 };
 
-class SIPConference
+//=============================================================================
+// A call's quality as its stream's RTCP and jitter buffer see it. The
+// counts run from the start of the call.
+
+struct CallQuality
+{
+	CallQuality() : rx_packets(0), rx_lost(0), tx_packets(0), tx_lost(0), jitter_ms(0), rtt_ms(0),
+					jb_frames(0), jb_prefetch(0), plc_frames(0) {}
+
+	unsigned rx_packets;
+	unsigned rx_lost;		// never arrived
+	unsigned tx_packets;
+	unsigned tx_lost;		// the remote's RTCP says it did not get
+	unsigned jitter_ms;		// mean interarrival jitter of what arrives
+	unsigned rtt_ms;		// last round trip, 0 until RTCP has gone both ways
+	unsigned jb_frames;		// frames in the jitter buffer
+	unsigned jb_prefetch;	// frames it waits for before playing
+	unsigned plc_frames;	// frames concealed for lack of a packet
+};
+
+//=============================================================================
+// SIPBackend is what the state machines talk to. Results come back the
+// same way for every backend: as Reg*/Dial* events on g_eventManager.
+
+class SIPBackend
+{
+    public:
+        virtual ~SIPBackend() {}
+
+        virtual void Register(const SIPUserInfo&, int*) = 0;
+        virtual void UnRegister(const int) = 0;
+
+        // throws runtime_error if the call cannot be made, as when
+        // MaxCalls are already up
+        virtual void Join(const string&, int, int*) = 0;
+        virtual void Answer(const int, const unsigned int) = 0;
+        virtual void Leave(const int) = 0;
+
+        virtual void AdjustTranVolume(int, float) = 0;
+
+        // a muted call is cut off from the microphone, so nothing is
+        // encoded or sent for it
+        virtual void SetMicMute(int, bool) = 0;
+        virtual void AdjustRecvVolume(int, float) = 0;
+        virtual void AdjustSpatialGains(int, const SpatialGains&) = 0;
+
+        // an inaudible call is disconnected from the mix, so it is
+        // neither decoded nor mixed until it is audible again
+        virtual void SetAudible(int, bool) = 0;
+
+        // the call's volume for this listener, 1.0 as sent, on top of the
+        // speaker's. Muted, it is disconnected like an inaudible call, not
+        // mixed at 0.
+        virtual void AdjustParticipantVolume(int, float) = 0;
+        virtual void SetParticipantMute(int, bool) = 0;
+
+        // the microphone as the call hears it, false if there is no call
+        virtual bool GetMeter(int, MeterReading*) = 0;
+
+        // false if the call has no media
+        virtual bool GetQuality(int, CallQuality*) = 0;
+
+        // a quality sample for g_config->AdaptiveCodecs, which may move the
+        // call to another of them
+        virtual void AdaptCodec(int, const CallQuality&) = 0;
+};
+
+// creates the backend selected by g_config->SIPBackend
+SIPBackend* create_sip_backend(const SIPServerInfo&);
+
+// sound devices are shared by all calls, matched by device name. Without
+// one (SoundDevice null or file) these only log.
+void set_capture_device(const string&);
+void set_render_device(const string&);
+
+//=============================================================================
+// pjsua backend
+
+class SIPConference : public SIPBackend
 {
     public:
         typedef list <SIPUserInfo> SIPUserList;
@@ -47,12 +138,25 @@ class SIPConference
         void Register(const SIPUserInfo&, int*); 
         void UnRegister(const int); 
 
-        void Join(const string&, int, int*, const string);
+        void Join(const string&, int, int*);
         void Answer(const int, const unsigned int);
         void Leave(const int);
 
-        void AdjustTranVolume(pjsua_call_id, float);
-        void AdjustRecvVolume(pjsua_call_id, float);
+        void AdjustTranVolume(int, float);
+        void SetMicMute(int, bool);
+        void AdjustRecvVolume(int, float);
+        void AdjustSpatialGains(int, const SpatialGains&);
+        void SetAudible(int, bool);
+        void AdjustParticipantVolume(int, float);
+        void SetParticipantMute(int, bool);
+
+        bool GetMeter(int, MeterReading*);
+        bool GetQuality(int, CallQuality*);
+        void AdaptCodec(int, const CallQuality&);
+
+        // the slot the microphone reaches the call through (its VAD gate),
+        // PJSUA_INVALID_ID when it is connected straight
+        pjsua_conf_port_id CaptureSlot(int);
 
     private:
         void start_sip_stack_(); 
@@ -66,6 +170,48 @@ class SIPConference
         void operator= (const SIPConference&);
 };
 
+//=============================================================================
+// Fake backend, no network and no audio. Every request is answered after
+// the Fake*Delay of the config, so that the daemon can be loaded with far
+// more sessions than a real SIP server and sound card would allow.
+
+class FakeSIPConference : public SIPBackend
+{
+    public:
+        FakeSIPConference (const SIPServerInfo&);
+        ~FakeSIPConference(); 
+
+        void Register(const SIPUserInfo&, int*); 
+        void UnRegister(const int); 
+
+        void Join(const string&, int, int*);
+        void Answer(const int, const unsigned int);
+        void Leave(const int);
+
+        void AdjustTranVolume(int, float);
+        void SetMicMute(int, bool);
+        void AdjustRecvVolume(int, float);
+        void AdjustSpatialGains(int, const SpatialGains&);
+        void SetAudible(int, bool);
+        void AdjustParticipantVolume(int, float);
+        void SetParticipantMute(int, bool);
+
+        bool GetMeter(int, MeterReading*);
+        bool GetQuality(int, CallQuality*);
+        void AdaptCodec(int, const CallQuality&);
+
+    private:
+        SIPServerInfo server_;
+
+        boost::mutex mutex_;
+        map <int, float> tx_levels_;	// call id -> tx level of live calls
+        set <int> muted_;				// call ids with the mic muted
+
+    private:
+        FakeSIPConference (const FakeSIPConference&);
+        void operator= (const FakeSIPConference&);
+};
+
 istream& operator>> (istream&, SIPUserInfo&);
 stringstream& operator>> (stringstream&, SIPUserInfo&);
 
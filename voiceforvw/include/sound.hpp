@@ -0,0 +1,40 @@
+/* sound.hpp -- headless sound definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _SOUND_HPP_
+#define _SOUND_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+//=============================================================================
+// FileSoundPort stands in for the sound card of a host that has none. A
+// master port clocks it against the bridge: what the bridge would play
+// goes to the sink, and the microphone is read from the source. Either
+// may be NULL, for silence in and nothing kept out.
+
+class FileSoundPort
+{
+	public:
+		FileSoundPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame,
+					  pjmedia_port *source, pjmedia_port *sink);
+
+		pjmedia_port* port() { return &port_; }
+
+	private:
+		static pj_status_t put_frame_(pjmedia_port*, const pjmedia_frame*);
+		static pj_status_t get_frame_(pjmedia_port*, pjmedia_frame*);
+
+	private:
+		pjmedia_port port_;
+
+		pjmedia_port *source_;
+		pjmedia_port *sink_;
+
+	private:
+		FileSoundPort (const FileSoundPort&);
+		void operator= (const FileSoundPort&);
+};
+
+#endif //_SOUND_HPP_
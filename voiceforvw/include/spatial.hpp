@@ -0,0 +1,109 @@
+/* spatial.hpp -- spatial audio definition
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#ifndef _SPATIAL_HPP_
+#define _SPATIAL_HPP_
+
+#include <pjsua-lib/pjsua.h>
+
+#include <boost/thread.hpp>
+
+struct Orientation;
+
+//=============================================================================
+// Per-source gains of the two output channels
+
+struct SpatialGains
+{
+	SpatialGains() : left(1.0f), right(1.0f) {}
+	SpatialGains(float l, float r) : left(l), right(r) {}
+
+	float left;
+	float right;
+};
+
+float spatial_distance(const Orientation& source, const Orientation& listener);
+
+// Distance attenuation (inverse distance beyond min_distance, silent beyond
+// max_distance) and constant power panning on the listener's left axis
+SpatialGains spatial_gains(const Orientation& source, const Orientation& listener,
+						   float min_distance, float max_distance);
+
+// Pans count mono samples into count interleaved stereo frames, moving the
+// gains linearly from 'from' to 'to' over the block so that a position
+// update does not click. Saturates to 16 bit.
+void spatial_pan(const pj_int16_t *in, pj_int16_t *out, unsigned count,
+				 const SpatialGains& from, const SpatialGains& to);
+
+// the portable version of spatial_pan, the SIMD one is checked against it
+void spatial_pan_scalar(const pj_int16_t *in, pj_int16_t *out, unsigned count,
+						const SpatialGains& from, const SpatialGains& to);
+
+// a source's volume for this listener, Q12 as the mixer's gains. Written
+// by the event thread and read once per frame, without a lock.
+typedef volatile pj_int32_t SourceVolume;
+
+//=============================================================================
+// SpatialPort takes one call's audio out of the conference bridge: the call
+// is put into it and, in a stereo bridge, comes out panned and attenuated.
+// In a mono bridge only the left gain is applied. It is either connected
+// on to the sound device or mixed by a MixerPort. The bridge gets before
+// it puts, so this adds one frame of delay.
+//
+// Frames whose mean absolute sample is under quiet_level (0 disables)
+// are not handed to the bridge once the hangover after the last loud
+// frame has run out, so the bridge skips them when mixing.
+//
+// The source's volume, if there is one, scales the gains from the frame
+// after it is written on, moving over the frame as a position update does.
+
+class SpatialPort
+{
+	public:
+		// samples_per_frame counts all channels, as the bridge does
+		SpatialPort(unsigned clock_rate, unsigned channel_count,
+					unsigned samples_per_frame, unsigned quiet_level = 0,
+					const SourceVolume *volume = NULL);
+		~SpatialPort();
+
+		pjmedia_port* port() { return &port_; }
+
+		// called from the event thread, applied from the next frame on
+		void SetGains(const SpatialGains&);
+
+		// adds the pending frame to a MixerPort's accumulator, false if
+		// there was none
+		bool Mix(pj_int32_t *acc);
+
+	private:
+		bool render_(pj_int16_t *out);
+		SpatialGains next_gains_();
+
+		static pj_status_t put_frame_(pjmedia_port*, const pjmedia_frame*);
+		static pj_status_t get_frame_(pjmedia_port*, pjmedia_frame*);
+
+	private:
+		pjmedia_port port_;
+
+		unsigned channel_count_;
+		pj_int16_t *mono_;		// one frame of the call, left channel
+		pj_int16_t *frame_;		// mono_ panned, for the mixer
+		bool has_frame_;
+
+		unsigned quiet_level_;
+		unsigned hangover_;		// frames left to pass after the last loud one
+
+		const SourceVolume *volume_;
+
+		SpatialGains current_;	// gains the last frame ended with, volume included
+		SpatialGains target_;
+		boost::mutex mutex_;	// guards target_
+
+	private:
+		SpatialPort (const SpatialPort&);
+		void operator= (const SpatialPort&);
+};
+
+#endif //_SPATIAL_HPP_
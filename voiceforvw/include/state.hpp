@@ -133,16 +133,6 @@ struct SessionConnectingState : state <SessionConnectingState, SessionMachine>
     SessionMachine& machine;
 };
 
-struct VolumeCheckingThread
-{
-	VolumeCheckingThread() :call_id(-1), handle(""), stopped(true) {};
-	VolumeCheckingThread(int cid, string hdl) : call_id(cid), handle(hdl), stopped(false) {};
-	void operator()();
-	int call_id;
-	string handle;
-	bool stopped;
-};
-
 struct SessionConfirmedState : state <SessionConfirmedState, SessionMachine> 
 {
     typedef boost::mpl::list<
@@ -150,6 +140,7 @@ struct SessionConfirmedState : state <SessionConfirmedState, SessionMachine>
 		custom_reaction<SessionMediaDisconnectEvent>,		// v1.22
 		custom_reaction<AudioEvent>, 
 		custom_reaction<PositionEvent>, 
+		custom_reaction<ParticipantEvent>, 
 		custom_reaction<DialDisconnectedEvent> > reactions;
 
     SessionConfirmedState(my_context ctx);
@@ -159,11 +150,10 @@ struct SessionConfirmedState : state <SessionConfirmedState, SessionMachine>
 	result react(const SessionMediaDisconnectEvent& ev);
     result react(const AudioEvent& ev);
     result react(const PositionEvent& ev);
+    result react(const ParticipantEvent& ev);
     result react(const DialDisconnectedEvent& ev);
 
     SessionMachine& machine;
-	boost::thread thr;
-	VolumeCheckingThread volumeCheckingThread;
 };
 
 // ------------------------------ Account ------------------------------
@@ -289,13 +279,14 @@ class AccountInfo : public BaseInfo {
 		AccountMachine machine;
 	    Account account;
 
-		SIPConference *sipconf;
+		SIPBackend *sipconf;
 };
 
 class SessionInfo : public BaseInfo {
 	
 	public:
 		SessionInfo(const AccountInfo* acc) {
+			culled = false;
 			machine.initiate();
 			machine.info = this;
 			account = acc;
@@ -306,9 +297,10 @@ class SessionInfo : public BaseInfo {
 
 		SessionMachine machine;
 
-		Session session; // the current session state
+		Session session; // the current session state, and connectedType the kind of call
 	    Orientation speaker; // the position of the speaking voice
 	    Orientation listener; // the position of the listener to the speaker
+		bool culled; // left out of the mix for being too far away
 
 		string incoming_uri;
 
@@ -337,6 +329,7 @@ class SessionManager : public BaseManager {
 		string create(const AccountInfo*);
 		SessionInfo* find(const string&);
 		void controlAudioLevel();
+		int privateCalls();
 };
 
 class AccountManager : public BaseManager {
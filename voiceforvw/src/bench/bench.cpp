@@ -0,0 +1,1435 @@
+/* bench.cpp -- microbenchmarks
+ *
+ *			Copyright 2009, 3di.jp Inc
+ *
+ * Times the pieces every viewer request goes through: RequestParser for
+ * each action, the Response/Event serializers, the EventManager queue,
+ * the handle managers, statechart dispatch, the spatial audio kernels run
+ * per call and frame, a whole room's mix with and without culling, and
+ * the mixing kernels next to their scalar versions, the VAD, the capture
+ * DSP stages and MediaMux's batched sockets against one system call per
+ * packet.
+ * Results are written as JSON so that runs of different releases can be
+ * compared by a script.
+ *
+ * Every benchmark is calibrated to run for at least -t msec per sample
+ * and sampled -r times; the median and the fastest sample are reported.
+ */
+
+#include "main.h"
+#include "state.hpp"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cmath>
+
+#ifndef WIN32
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+Config *g_config;
+Logger *g_logger;
+Metrics *g_metrics (NULL);
+
+// there is no viewer connection in the benchmarks
+Server *glb_server (NULL);
+
+EventManager g_eventManager;
+
+//=============================================================================
+// Timing
+
+typedef boost::posix_time::ptime BenchTime;
+
+static BenchTime bench_now_()
+{
+	return boost::posix_time::microsec_clock::universal_time();
+}
+
+static double elapsed_ns_(const BenchTime& from, const BenchTime& to)
+{
+	return (double)(to - from).total_microseconds() * 1e3;
+}
+
+// results of benchmarked code end up here so that it cannot be optimized away
+static volatile size_t bench_sink_ (0);
+
+struct BenchResult
+{
+	string name;
+	unsigned long iterations;		// per sample
+	double ns_median;
+	double ns_min;
+};
+
+class BenchRunner
+{
+	public:
+		BenchRunner(const string& filter, double min_ms, int samples)
+			: filter_(filter), min_ns_(min_ms * 1e6), samples_(samples) {}
+
+		bool Wanted(const string& name) const
+		{
+			return filter_.empty() || name.find(filter_) != string::npos;
+		}
+
+		// F provides void operator()(unsigned long n) running n operations
+		template <class F>
+		void Run(const string& name, F& f)
+		{
+			if (!Wanted(name))
+				return;
+
+			// find an iteration count that fills a sample
+			unsigned long n = 1;
+			for (;;)
+			{
+				BenchTime start = bench_now_();
+				f(n);
+				double ns = elapsed_ns_(start, bench_now_());
+				if (ns >= min_ns_ || n >= (1UL << 30))
+					break;
+				n = (ns < min_ns_ / 100) ? n * 10 : (unsigned long)(n * 1.5 * min_ns_ / ns) + 1;
+			}
+
+			vector<double> per_op;
+			for (int s = 0; s < samples_; s++)
+			{
+				BenchTime start = bench_now_();
+				f(n);
+				per_op.push_back(elapsed_ns_(start, bench_now_()) / n);
+			}
+
+			Add(name, n, per_op);
+		}
+
+		void Add(const string& name, unsigned long n, vector<double> per_op)
+		{
+			sort(per_op.begin(), per_op.end());
+
+			BenchResult r;
+			r.name = name;
+			r.iterations = n;
+			r.ns_median = per_op[per_op.size() / 2];
+			r.ns_min = per_op.front();
+			results_.push_back(r);
+
+			cerr << name << ": " << r.ns_median << " ns/op" << endl;
+		}
+
+		int Samples() const { return samples_; }
+
+		void WriteJson(ostream& out) const;
+
+	private:
+		string filter_;
+		double min_ns_;
+		int samples_;
+		vector<BenchResult> results_;
+};
+
+static string json_escape_(const string& s)
+{
+	string out;
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		if (s[i] == '"' || s[i] == '\\')
+			out += '\\';
+		out += s[i];
+	}
+	return out;
+}
+
+void BenchRunner::WriteJson(ostream& out) const
+{
+	out << "{\n"
+		<< "  \"suite\": \"slvoice_bench\",\n"
+		<< "  \"date\": \"" << boost::posix_time::to_iso_extended_string(bench_now_()) << "Z\",\n"
+		<< "  \"samples\": " << samples_ << ",\n"
+		<< "  \"benchmarks\": [";
+
+	for (size_t i = 0; i < results_.size(); i++)
+	{
+		const BenchResult& r = results_[i];
+		out << (i ? ",\n" : "\n")
+			<< "    {\"name\": \"" << json_escape_(r.name) << "\", "
+			<< "\"iterations\": " << r.iterations << ", "
+			<< "\"ns_per_op\": " << r.ns_median << ", "
+			<< "\"ns_per_op_min\": " << r.ns_min << ", "
+			<< "\"ops_per_sec\": " << (r.ns_median > 0 ? 1e9 / r.ns_median : 0) << "}";
+	}
+
+	out << "\n  ]\n}\n";
+}
+
+//=============================================================================
+// Sample viewer requests, one per action
+
+static const char* position_xml_ =
+	"<Position X=\"128.5\" Y=\"22.0\" Z=\"131.25\" />"
+	"<Velocity X=\"0.0\" Y=\"0.0\" Z=\"0.0\" />"
+	"<AtOrientation X=\"0.7071\" Y=\"0.0\" Z=\"0.7071\" />"
+	"<UpOrientation X=\"0.0\" Y=\"1.0\" Z=\"0.0\" />"
+	"<LeftOrientation X=\"0.7071\" Y=\"0.0\" Z=\"-0.7071\" />";
+
+struct SampleRequest
+{
+	const char *action;
+	string body;
+};
+
+static vector<SampleRequest> sample_requests_()
+{
+	const string pos (position_xml_);
+	const string con ("<ConnectorHandle>xxxx</ConnectorHandle>");
+	const string acc ("<AccountHandle>8a3f10</AccountHandle>");
+	const string ses ("<SessionHandle>8a4c20</SessionHandle>");
+	const string part ("<ParticipantURI>sip:avatar@example.org</ParticipantURI>");
+
+	SampleRequest table[] =
+	{
+		{ "Connector.Create.1",
+		  "<ClientName>V2 SDK</ClientName><AttemptStun>Unimplemented</AttemptStun>"
+		  "<AccountManagementServer>https://www.example.org/api2/</AccountManagementServer>"
+		  "<ProxyManagementServer>127.0.0.1</ProxyManagementServer>"
+		  "<MinimumPort>30000</MinimumPort><MaximumPort>31000</MaximumPort>"
+		  "<Logging><Folder>/tmp</Folder><FileNamePrefix>Connector</FileNamePrefix>"
+		  "<FileNameSuffix>.log</FileNameSuffix><LogLevel>0</LogLevel></Logging>" },
+		{ "Connector.InitiateShutdown.1", con },
+		{ "Connector.MuteLocalMic.1", con + "<Value>true</Value>" },
+		{ "Connector.MuteLocalSpeaker.1", con + "<Value>false</Value>" },
+		{ "Connector.SetLocalMicVolume.1", con + "<Value>50</Value>" },
+		{ "Connector.SetLocalSpeakerVolume.1", con + "<Value>50</Value>" },
+		{ "Account.Login.1",
+		  con + "<AccountName>avatar</AccountName><AccountPassword>secret</AccountPassword>"
+		  "<AudioSessionAnswerMode>VerifyAnswer</AudioSessionAnswerMode>"
+		  "<AccountURI>sip:avatar@voice.example.org</AccountURI>"
+		  "<ParticipantPropertyFrequency>5</ParticipantPropertyFrequency>"
+		  "<EnableBuddiesAndPresence>false</EnableBuddiesAndPresence>" },
+		{ "Account.Logout.1", acc },
+		{ "Account.BlockListRules.1", acc },
+		{ "Account.ListAutoAcceptRules.1", acc },
+		{ "Aux.CaptureAudioStart.1", "<Duration>-1</Duration>" },
+		{ "Aux.CaptureAudioStop.1", "" },
+		{ "Aux.GetCaptureDevices.1", "" },
+		{ "Aux.GetRenderDevices.1", "" },
+		{ "Aux.SetCaptureDevice.1", "<CaptureDeviceSpecifier>Default</CaptureDeviceSpecifier>" },
+		{ "Aux.SetRenderDevice.1", "<RenderDeviceSpecifier>Default</RenderDeviceSpecifier>" },
+		{ "Aux.SetMicLevel.1", "<Level>50</Level>" },
+		{ "Aux.SetSpeakerLevel.1", "<Level>50</Level>" },
+		{ "Session.Create.1",
+		  acc + "<URI>sip:confctl-2@voice.example.org</URI><Name>region</Name>"
+		  "<Password>x</Password><JoinAudio>true</JoinAudio><JoinText>false</JoinText>"
+		  "<Type>1</Type><PasswordHashAlgorithm>SHA1UserName</PasswordHashAlgorithm>" },
+		{ "Session.Connect.1", ses + "<AudioMedia>default</AudioMedia>" },
+		{ "Session.Set3DPosition.1",
+		  ses + "<SpeakerPosition>" + pos + "</SpeakerPosition>"
+		  "<ListenerPosition>" + pos + "</ListenerPosition>" },
+		{ "Session.SetParticipantMuteForMe.1", ses + part + "<Mute>true</Mute>" },
+		{ "Session.SetParticipantVolumeForMe.1", ses + part + "<Volume>40</Volume>" },
+		{ "Session.Terminate.1", ses },
+		{ "Session.RenderAudioStart.1", "<SoundFilePath>x.wav</SoundFilePath><Loop>false</Loop>" },
+		{ "Session.RenderAudioStop.1", "" },
+		{ "Session.MediaDisconnect.1", ses + "<Media>Audio</Media>" },
+	};
+
+	vector<SampleRequest> out (table, table + sizeof(table) / sizeof(table[0]));
+	for (size_t i = 0; i < out.size(); i++)
+	{
+		out[i].body = string("<Request requestId=\"42\" action=\"") + out[i].action + "\">"
+			+ out[i].body + "</Request>";
+	}
+	return out;
+}
+
+//=============================================================================
+// Parser and serializers
+
+struct ParseBench
+{
+	ParseBench(const string& xml) : xml_(xml) {}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+		{
+			RequestParser parser(xml_.c_str());
+			auto_ptr<const Request> req(parser.Parse());
+			bench_sink_ += req->Type;
+		}
+	}
+
+	string xml_;
+};
+
+struct ResponseBench
+{
+	ResponseBench(ResponseBase *resp) : resp_(resp) {}
+	~ResponseBench() { delete resp_; }
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			bench_sink_ += resp_->ToString().size();
+	}
+
+	ResponseBase *resp_;
+};
+
+template <class E>
+struct EventBench
+{
+	EventBench(const E& ev) : ev_(ev) {}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			bench_sink_ += ev_.ToString().size();
+	}
+
+	E ev_;
+};
+
+static void bench_parsing_(BenchRunner& runner)
+{
+	vector<SampleRequest> samples (sample_requests_());
+
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		ParseBench parse (samples[i].body);
+		runner.Run(string("parse/") + samples[i].action, parse);
+	}
+
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		RequestParser parser(samples[i].body.c_str());
+		auto_ptr<const Request> req(parser.Parse());
+
+		ResponseBase *resp = const_cast<Request*>(req.get())->CreateResponse("0");
+		if (resp == NULL)
+			continue;	// actions without a Response
+
+		// the InputXml echo is part of every response
+		resp->InputXml = samples[i].body;
+
+		ResponseBench serialize (resp);
+		runner.Run(string("serialize/") + samples[i].action, serialize);
+	}
+
+	{
+		LoginStateChangeEvent ev;
+		ev.AccountHandle = "8a3f10";
+		ev.StatusCode = ev.OKCode;
+		ev.StatusString = ev.OKString;
+		ev.State = "1";
+		EventBench<LoginStateChangeEvent> b (ev);
+		runner.Run("serialize/LoginStateChangeEvent", b);
+	}
+	{
+		SessionNewEvent ev;
+		ev.AccountHandle = "8a3f10";
+		ev.SessionHandle = "8a4c20";
+		ev.State = "0";
+		ev.URI = "sip:confctl-2@voice.example.org";
+		ev.Name = "region";
+		ev.IsChannel = "true";
+		ev.AudioMedia = "default";
+		ev.HasText = "false";
+		ev.HasAudio = "true";
+		ev.HasVideo = "false";
+		EventBench<SessionNewEvent> b (ev);
+		runner.Run("serialize/SessionNewEvent", b);
+	}
+	{
+		SessionStateChangeEvent ev;
+		ev.SessionHandle = "8a4c20";
+		ev.StatusCode = ev.OKCode;
+		ev.StatusString = ev.OKString;
+		ev.State = "4";
+		ev.URI = "sip:confctl-2@voice.example.org";
+		ev.IsChannel = "true";
+		ev.ChannelName = "region";
+		EventBench<SessionStateChangeEvent> b (ev);
+		runner.Run("serialize/SessionStateChangeEvent", b);
+	}
+	{
+		ParticipantStateChangeEvent ev;
+		ev.StatusCode = ev.OKCode;
+		ev.StatusString = ev.OKString;
+		ev.State = "7";
+		ev.ParticipantURI = "sip:avatar@voice.example.org";
+		ev.AccountName = "avatar";
+		ev.DisplayName = "avatar";
+		ev.ParticipantType = "0";
+		EventBench<ParticipantStateChangeEvent> b (ev);
+		runner.Run("serialize/ParticipantStateChangeEvent", b);
+	}
+	{
+		ParticipantPropertiesEvent ev;
+		ev.SessionHandle = "8a4c20";
+		ev.ParticipantURI = "sip:avatar@voice.example.org";
+		ev.IsLocallyMuted = "false";
+		ev.IsModeratorMuted = "false";
+		ev.Volume = "50";
+		ev.Energy = "0.42";
+		ev.IsSpeaking = "true";
+		EventBench<ParticipantPropertiesEvent> b (ev);
+		runner.Run("serialize/ParticipantPropertiesEvent", b);
+	}
+	{
+		AuxAudioPropertiesEvent ev;
+		ev.MicIsActive = "true";
+		ev.MicEnergy = "0.42";
+		ev.MicVolume = "50";
+		ev.SpeakerVolume = "50";
+		EventBench<AuxAudioPropertiesEvent> b (ev);
+		runner.Run("serialize/AuxAudioPropertiesEvent", b);
+	}
+	{
+		MediaStreamUpdatedEvent ev;
+		ev.SessionHandle = "8a4c20";
+		ev.SessionGroupHandle = "8a4c20";
+		ev.State = "2";
+		ev.StatusCode = ev.OKCode;
+		ev.StatusString = ev.OKString;
+		EventBench<MediaStreamUpdatedEvent> b (ev);
+		runner.Run("serialize/MediaStreamUpdatedEvent", b);
+	}
+}
+
+//=============================================================================
+// BlockingQueue
+
+struct QueueBench
+{
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+		{
+			queue_.enqueue(this);
+			bench_sink_ += (size_t)queue_.dequeue();
+		}
+	}
+
+	BlockingQueue queue_;
+};
+
+struct QueueProducer
+{
+	QueueProducer(BlockingQueue& q, unsigned long n) : queue_(q), n_(n) {}
+
+	void operator()()
+	{
+		for (unsigned long i = 0; i < n_; i++)
+			queue_.enqueue(&queue_);
+	}
+
+	BlockingQueue& queue_;
+	unsigned long n_;
+};
+
+// producers enqueue while the calling thread drains, like the server,
+// SIP callback and volume threads feeding the EventManager
+static void bench_queue_contention_(BenchRunner& runner, int producers)
+{
+	stringstream name;
+	name << "queue/contended_" << producers << "_producers";
+	if (!runner.Wanted(name.str()))
+		return;
+
+	const unsigned long per_thread = 200000 / producers;
+	const unsigned long total = per_thread * producers;
+
+	vector<double> per_op;
+	for (int s = 0; s < runner.Samples(); s++)
+	{
+		BlockingQueue queue;
+		boost::thread_group group;
+
+		BenchTime start = bench_now_();
+		for (int p = 0; p < producers; p++)
+			group.create_thread(QueueProducer(queue, per_thread));
+		for (unsigned long i = 0; i < total; i++)
+			bench_sink_ += (size_t)queue.dequeue();
+		group.join_all();
+
+		per_op.push_back(elapsed_ns_(start, bench_now_()) / total);
+	}
+
+	runner.Add(name.str(), total, per_op);
+}
+
+static void bench_queue_(BenchRunner& runner)
+{
+	QueueBench uncontended;
+	runner.Run("queue/enqueue_dequeue", uncontended);
+
+	bench_queue_contention_(runner, 1);
+	bench_queue_contention_(runner, 2);
+	bench_queue_contention_(runner, 4);
+	bench_queue_contention_(runner, 8);
+}
+
+//=============================================================================
+// Handle managers
+
+struct ManagerBench
+{
+	ManagerBench(int size) : infos_(size), next_(0)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			infos_[i].id = i;
+			handles_.push_back(manager_.registHandle(&infos_[i]));
+			manager_.registId(i, handles_.back());
+		}
+	}
+
+	BaseManager manager_;
+	vector<BaseInfo> infos_;
+	vector<string> handles_;
+	size_t next_;
+};
+
+struct FindBench : ManagerBench
+{
+	FindBench(int size) : ManagerBench(size) {}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+		{
+			bench_sink_ += (size_t)manager_.findBase(handles_[next_]);
+			if (++next_ == handles_.size())
+				next_ = 0;
+		}
+	}
+};
+
+struct ConvertIdBench : ManagerBench
+{
+	ConvertIdBench(int size) : ManagerBench(size) {}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+		{
+			bench_sink_ += manager_.convertId((int)next_).size();
+			if (++next_ == handles_.size())
+				next_ = 0;
+		}
+	}
+};
+
+static void bench_managers_(BenchRunner& runner)
+{
+	static const int sizes[] = { 4, 64, 1024 };
+
+	for (int i = 0; i < 3; i++)
+	{
+		stringstream find, convert;
+		find << "manager/findBase_" << sizes[i];
+		convert << "manager/convertId_" << sizes[i];
+
+		FindBench f (sizes[i]);
+		runner.Run(find.str(), f);
+
+		ConvertIdBench c (sizes[i]);
+		runner.Run(convert.str(), c);
+	}
+}
+
+//=============================================================================
+// Statechart dispatch
+
+// Connector.MuteLocalMic in ConnectorActive, which also hands an AudioEvent
+// to every session of the connector
+struct ConnectorAudioBench
+{
+	ConnectorAudioBench(int sessions) : request_("42")
+	{
+		InitializeEvent init;
+		ConnectorCreateResponse resp (ConnectorCreate1String, "41", "0");
+		init.result = &resp;
+		connector_.machine.process_event(init);
+
+		for (int i = 0; i < sessions; i++)
+			connector_.session.create(NULL);
+
+		request_.ConnectorHandle = VFVW_CONNECTOR_HANDLE;
+		request_.Value = "true";
+		ev_.message = &request_;
+	}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			connector_.machine.process_event(ev_);
+		bench_sink_ += connector_.audio.mic_mute;
+	}
+
+	ConnectorInfo connector_;
+	ConnectorMuteLocalMicRequest request_;
+	AudioEvent ev_;
+};
+
+// Connector.Create followed by Connector.InitiateShutdown, two transitions
+struct ConnectorTransitBench
+{
+	ConnectorTransitBench() : resp_(ConnectorCreate1String, "41", "0")
+	{
+		init_.result = &resp_;
+	}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+		{
+			connector_.machine.process_event(init_);
+			connector_.machine.process_event(shutdown_);
+		}
+	}
+
+	ConnectorInfo connector_;
+	ConnectorCreateResponse resp_;
+	InitializeEvent init_;
+	ShutdownEvent shutdown_;
+};
+
+// an event the current state has no reaction for
+struct SessionDiscardBench
+{
+	SessionDiscardBench() : session_(NULL) {}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			session_.machine.process_event(ev_);
+	}
+
+	SessionInfo session_;
+	DialEarlyEvent ev_;
+};
+
+static void bench_statechart_(BenchRunner& runner)
+{
+	{
+		ConnectorAudioBench b (0);
+		runner.Run("statechart/connector_audio", b);
+	}
+	{
+		ConnectorAudioBench b (16);
+		runner.Run("statechart/connector_audio_16_sessions", b);
+	}
+	{
+		ConnectorTransitBench b;
+		runner.Run("statechart/connector_create_shutdown", b);
+	}
+	{
+		SessionDiscardBench b;
+		runner.Run("statechart/session_discard", b);
+	}
+}
+
+//=============================================================================
+// Spatial audio: one op is one source for one 20 msec frame at the bridge
+// rate, so ns_per_op / 200000 is the share of a core each mixed source takes
+
+#define BENCH_SPATIAL_FRAME	(PJSUA_DEFAULT_CLOCK_RATE * PJSUA_DEFAULT_AUDIO_FRAME_PTIME / 1000)
+
+struct SpatialGainsBench
+{
+	SpatialGainsBench()
+	{
+		float left[3] = { 0.0f, 0.0f, 1.0f };
+		listener_.set_left(left);
+	}
+
+	void operator()(unsigned long n)
+	{
+		float sum = 0.0f;
+		for (unsigned long i = 0; i < n; i++)
+		{
+			float pos[3] = { 128.0f + (i & 63), 22.0f, 128.0f };
+			source_.set_position(pos);
+			sum += spatial_gains(source_, listener_, 10.0f, 60.0f).left;
+		}
+		bench_sink_ += (size_t)sum;
+	}
+
+	Orientation source_;
+	Orientation listener_;
+};
+
+template <void (*Pan)(const pj_int16_t*, pj_int16_t*, unsigned,
+					  const SpatialGains&, const SpatialGains&)>
+struct SpatialPanBench
+{
+	SpatialPanBench()
+	{
+		for (int i = 0; i < BENCH_SPATIAL_FRAME; i++)
+			in_[i] = (pj_int16_t)(8000 * sin(i * 0.3));
+	}
+
+	void operator()(unsigned long n)
+	{
+		SpatialGains from (0.9f, 0.3f), to (0.8f, 0.4f);
+		for (unsigned long i = 0; i < n; i++)
+			Pan(in_, out_, BENCH_SPATIAL_FRAME, from, to);
+		bench_sink_ += out_[7];
+	}
+
+	pj_int16_t in_[BENCH_SPATIAL_FRAME];
+	pj_int16_t out_[2 * BENCH_SPATIAL_FRAME];
+};
+
+// A whole room mixed for one frame, the way the bridge mixes it: every
+// source is panned and summed into the listener's stereo frame. Sources
+// are spread over a 256 m region around the listener and one in four is
+// silent. Culling leaves out those beyond the audible radius, as
+// SetAudible does, and the silent ones, as SpatialPort's quiet gate does.
+// ns_per_op / 200000 is the share of a core the room's mix takes.
+
+#define BENCH_ROOM_RADIUS		60.0f
+
+class SpatialRoomBench
+{
+	public:
+		SpatialRoomBench(int sources, bool cull)
+			: sources_(sources), cull_(cull)
+		{
+			float left[3] = { 0.0f, 0.0f, 1.0f };
+			float center[3] = { 128.0f, 22.0f, 128.0f };
+			listener_.set_left(left);
+			listener_.set_position(center);
+
+			for (int i = 0; i < BENCH_SPATIAL_FRAME; i++)
+				voice_[i] = (pj_int16_t)(8000 * sin(i * 0.3));
+			memset(silence_, 0, sizeof(silence_));
+
+			// fixed seed, runs stay comparable
+			unsigned seed = 12345;
+			for (int s = 0; s < sources_; s++)
+			{
+				Orientation o;
+				float pos[3];
+				pos[0] = (float)((seed = seed * 1103515245 + 12345) >> 16 & 255);
+				pos[1] = 22.0f;
+				pos[2] = (float)((seed = seed * 1103515245 + 12345) >> 16 & 255);
+				o.set_position(pos);
+
+				gains_.push_back(spatial_gains(o, listener_, 10.0f, BENCH_ROOM_RADIUS));
+				distances_.push_back(spatial_distance(o, listener_));
+			}
+		}
+
+		void operator()(unsigned long n)
+		{
+			for (unsigned long i = 0; i < n; i++)
+			{
+				memset(mix_, 0, sizeof(mix_));
+
+				for (int s = 0; s < sources_; s++)
+				{
+					const pj_int16_t *in = (s % 4 == 3) ? silence_ : voice_;
+
+					if (cull_ && (distances_[s] >= BENCH_ROOM_RADIUS || quiet_(in)))
+						continue;
+
+					spatial_pan(in, frame_, BENCH_SPATIAL_FRAME, gains_[s], gains_[s]);
+					mix_accumulate(mix_, frame_, 2 * BENCH_SPATIAL_FRAME, MIXER_GAIN_UNITY);
+				}
+
+				mix_saturate(mix_, out_, 2 * BENCH_SPATIAL_FRAME);
+			}
+			bench_sink_ += out_[7];
+		}
+
+		int Audible() const
+		{
+			int audible = 0;
+			for (int s = 0; s < sources_; s++)
+				if (distances_[s] < BENCH_ROOM_RADIUS && s % 4 != 3)
+					audible++;
+			return audible;
+		}
+
+	private:
+		// the same mean absolute level test as SpatialPort, at its default
+		static bool quiet_(const pj_int16_t *in)
+		{
+			unsigned long energy = 0;
+			for (int k = 0; k < BENCH_SPATIAL_FRAME; k++)
+				energy += abs(in[k]);
+			return energy < 32UL * BENCH_SPATIAL_FRAME;
+		}
+
+		int sources_;
+		bool cull_;
+		Orientation listener_;
+		vector<SpatialGains> gains_;
+		vector<float> distances_;
+
+		pj_int16_t voice_[BENCH_SPATIAL_FRAME];
+		pj_int16_t silence_[BENCH_SPATIAL_FRAME];
+		pj_int16_t frame_[2 * BENCH_SPATIAL_FRAME];
+		pj_int32_t mix_[2 * BENCH_SPATIAL_FRAME];
+		pj_int16_t out_[2 * BENCH_SPATIAL_FRAME];
+};
+
+static void bench_spatial_(BenchRunner& runner)
+{
+	{
+		SpatialGainsBench b;
+		runner.Run("spatial/gains", b);
+	}
+	{
+		SpatialPanBench<spatial_pan> b;
+		runner.Run("spatial/pan_source_frame", b);
+	}
+	{
+		SpatialPanBench<spatial_pan_scalar> b;
+		runner.Run("spatial/pan_source_frame_scalar", b);
+	}
+
+	int rooms[] = { 8, 32, 128 };
+	for (size_t i = 0; i < sizeof(rooms) / sizeof(rooms[0]); i++)
+	{
+		stringstream name;
+		name << "cull/room_" << rooms[i];
+
+		SpatialRoomBench culled (rooms[i], true);
+		if (runner.Wanted(name.str()))
+			cerr << name.str() << ": " << culled.Audible() << " of " << rooms[i] << " sources audible" << endl;
+		runner.Run(name.str(), culled);
+
+		SpatialRoomBench all (rooms[i], false);
+		runner.Run(name.str() + "_nocull", all);
+	}
+}
+
+//=============================================================================
+// Mixing kernels: one op is one stereo 20 msec frame, the mixer does one
+// accumulate per talking call and one saturate per frame
+
+typedef void (*AccumulateKernel)(pj_int32_t*, const pj_int16_t*, unsigned, pj_int16_t);
+typedef void (*SaturateKernel)(const pj_int32_t*, pj_int16_t*, unsigned);
+
+#define BENCH_MIXER_FRAME	(2 * BENCH_SPATIAL_FRAME)
+
+static void fill_random_(pj_int16_t *buf, unsigned count, unsigned& seed)
+{
+	for (unsigned i = 0; i < count; i++)
+		buf[i] = (pj_int16_t)((seed = seed * 1103515245 + 12345) >> 16);
+}
+
+struct MixerAccumulateBench
+{
+	MixerAccumulateBench(AccumulateKernel kernel, pj_int16_t gain)
+		: kernel_(kernel), gain_(gain)
+	{
+		unsigned seed = 1;
+		fill_random_(in_, BENCH_MIXER_FRAME, seed);
+		memset(acc_, 0, sizeof(acc_));
+	}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			kernel_(acc_, in_, BENCH_MIXER_FRAME, gain_);
+		bench_sink_ += acc_[7];
+	}
+
+	AccumulateKernel kernel_;
+	pj_int16_t gain_;
+	pj_int16_t in_[BENCH_MIXER_FRAME];
+	pj_int32_t acc_[BENCH_MIXER_FRAME];
+};
+
+struct MixerSaturateBench
+{
+	MixerSaturateBench(SaturateKernel kernel)
+		: kernel_(kernel)
+	{
+		// a few loud sources on top of each other, some of it clips
+		for (int i = 0; i < BENCH_MIXER_FRAME; i++)
+			acc_[i] = (pj_int32_t)(40000 * sin(i * 0.1));
+	}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			kernel_(acc_, out_, BENCH_MIXER_FRAME);
+		bench_sink_ += out_[7];
+	}
+
+	SaturateKernel kernel_;
+	pj_int32_t acc_[BENCH_MIXER_FRAME];
+	pj_int16_t out_[BENCH_MIXER_FRAME];
+};
+
+static void bench_mixer_(BenchRunner& runner)
+{
+	pj_int16_t half = mix_gain(0.5f);
+	{
+		MixerAccumulateBench b (mix_accumulate, MIXER_GAIN_UNITY);
+		runner.Run(string("mixer/accumulate_frame_") + mix_kernels(), b);
+	}
+	{
+		MixerAccumulateBench b (mix_accumulate_scalar, MIXER_GAIN_UNITY);
+		runner.Run("mixer/accumulate_frame_scalar", b);
+	}
+	{
+		MixerAccumulateBench b (mix_accumulate, half);
+		runner.Run(string("mixer/accumulate_gain_frame_") + mix_kernels(), b);
+	}
+	{
+		MixerAccumulateBench b (mix_accumulate_scalar, half);
+		runner.Run("mixer/accumulate_gain_frame_scalar", b);
+	}
+	{
+		MixerSaturateBench b (mix_saturate);
+		runner.Run(string("mixer/saturate_frame_") + mix_kernels(), b);
+	}
+	{
+		MixerSaturateBench b (mix_saturate_scalar);
+		runner.Run("mixer/saturate_frame_scalar", b);
+	}
+}
+
+//=============================================================================
+// VAD: one op is one 20 msec mono frame through the detector. The signal
+// is a second of room noise and tone bursts, talking 30% of the time;
+// the share of frames each mode lets through is printed as well.
+
+#define BENCH_VAD_FRAMES	50
+
+class VoiceDetectorBench
+{
+	public:
+		VoiceDetectorBench(int mode)
+			: detector_(mode), next_(0), passed_(0)
+		{
+			unsigned seed = 3;
+			for (int f = 0; f < BENCH_VAD_FRAMES; f++)
+			{
+				// 300 msec spurts every second, -50 dB noise all along
+				bool talk = f < BENCH_VAD_FRAMES * 3 / 10;
+				for (int i = 0; i < BENCH_SPATIAL_FRAME; i++)
+				{
+					int noise = (int)((seed = seed * 1103515245 + 12345) >> 16 & 63) - 32;
+					int voice = talk ? (int)(6000 * sin((f * BENCH_SPATIAL_FRAME + i) * 0.2)) : 0;
+					signal_[f][i] = (pj_int16_t)(noise + voice);
+				}
+			}
+		}
+
+		void operator()(unsigned long n)
+		{
+			for (unsigned long i = 0; i < n; i++)
+			{
+				if (detector_.IsVoice(signal_[next_], BENCH_SPATIAL_FRAME, 1))
+					passed_++;
+				next_ = (next_ + 1) % BENCH_VAD_FRAMES;
+			}
+			bench_sink_ += passed_;
+		}
+
+		// over whole seconds of the signal, after the noise floor settled
+		unsigned Passed(int seconds)
+		{
+			unsigned long before = passed_;
+			next_ = 0;
+			(*this)(seconds * BENCH_VAD_FRAMES);
+			return (unsigned)((passed_ - before) * 100 / (seconds * BENCH_VAD_FRAMES));
+		}
+
+	private:
+		VoiceDetector detector_;
+		pj_int16_t signal_[BENCH_VAD_FRAMES][BENCH_SPATIAL_FRAME];
+		unsigned next_;
+		unsigned long passed_;
+};
+
+static void bench_vad_(BenchRunner& runner)
+{
+	for (int mode = 1; mode <= VAD_MODE_MAX; mode++)
+	{
+		stringstream name;
+		name << "vad/detect_frame_mode_" << mode;
+
+		VoiceDetectorBench b (mode);
+		if (runner.Wanted(name.str()))
+		{
+			b.Passed(2);
+			cerr << name.str() << ": " << b.Passed(10) << "% of the frames sent, talking 30%" << endl;
+		}
+		runner.Run(name.str(), b);
+	}
+}
+
+//=============================================================================
+// Capture DSP: one op is one 20 msec mono frame through a stage, the level
+// and gain kernels next to their scalar versions. The signal is a second
+// of fan noise with speech 30% of the time, as for the VAD; each op copies
+// its frame in first, since the stages work in place.
+
+typedef unsigned (*LevelKernel)(const pj_int16_t*, unsigned);
+typedef void (*GainKernel)(pj_int16_t*, unsigned, pj_int16_t);
+
+struct DspSignal
+{
+	DspSignal() : next_(0)
+	{
+		unsigned seed = 5;
+		for (int f = 0; f < BENCH_VAD_FRAMES; f++)
+		{
+			bool talk = f < BENCH_VAD_FRAMES * 3 / 10;
+			for (int i = 0; i < BENCH_SPATIAL_FRAME; i++)
+			{
+				int noise = (int)((seed = seed * 1103515245 + 12345) >> 16 & 511) - 256;
+				int voice = talk ? (int)(3000 * sin((f * BENCH_SPATIAL_FRAME + i) * 0.2)) : 0;
+				signal_[f][i] = (pj_int16_t)(noise + voice + 200);		// and some DC
+			}
+		}
+	}
+
+	pj_int16_t* Next()
+	{
+		memcpy(frame_, signal_[next_], sizeof(frame_));
+		next_ = (next_ + 1) % BENCH_VAD_FRAMES;
+		return frame_;
+	}
+
+	pj_int16_t signal_[BENCH_VAD_FRAMES][BENCH_SPATIAL_FRAME];
+	pj_int16_t frame_[BENCH_SPATIAL_FRAME];
+	unsigned next_;
+};
+
+struct DspLevelBench
+{
+	DspLevelBench(LevelKernel kernel) : kernel_(kernel) {}
+
+	void operator()(unsigned long n)
+	{
+		unsigned sum = 0;
+		for (unsigned long i = 0; i < n; i++)
+			sum += kernel_(signal_.Next(), BENCH_SPATIAL_FRAME);
+		bench_sink_ += sum;
+	}
+
+	LevelKernel kernel_;
+	DspSignal signal_;
+};
+
+struct DspGainBench
+{
+	DspGainBench(GainKernel kernel) : kernel_(kernel) {}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			kernel_(signal_.Next(), BENCH_SPATIAL_FRAME, 6000);
+		bench_sink_ += signal_.frame_[7];
+	}
+
+	GainKernel kernel_;
+	DspSignal signal_;
+};
+
+template <class Stage>
+struct DspStageBench
+{
+	DspStageBench(const Stage& stage) : stage_(stage) {}
+
+	void operator()(unsigned long n)
+	{
+		for (unsigned long i = 0; i < n; i++)
+			stage_.Process(signal_.Next(), BENCH_SPATIAL_FRAME);
+		bench_sink_ += signal_.frame_[7];
+	}
+
+	Stage stage_;
+	DspSignal signal_;
+};
+
+static void bench_dsp_(BenchRunner& runner)
+{
+	const unsigned clock_rate = 16000;
+	{
+		DspLevelBench b (dsp_level);
+		runner.Run(string("dsp/level_frame_") + dsp_kernels(), b);
+	}
+	{
+		DspLevelBench b (dsp_level_scalar);
+		runner.Run("dsp/level_frame_scalar", b);
+	}
+	{
+		DspGainBench b (dsp_gain);
+		runner.Run(string("dsp/gain_frame_") + dsp_kernels(), b);
+	}
+	{
+		DspGainBench b (dsp_gain_scalar);
+		runner.Run("dsp/gain_frame_scalar", b);
+	}
+	{
+		DspStageBench<HighPassFilter> b (HighPassFilter(clock_rate, 100));
+		runner.Run("dsp/highpass_frame", b);
+	}
+	{
+		DspStageBench<NoiseSuppressor> b ((NoiseSuppressor()));
+		runner.Run("dsp/noise_frame", b);
+	}
+	{
+		DspStageBench<GainControl> b ((GainControl()));
+		runner.Run("dsp/agc_frame", b);
+	}
+	{
+		DspStageBench<CapturePipeline> b (CapturePipeline(clock_rate, true, true, true));
+		runner.Run("dsp/pipeline_frame", b);
+	}
+}
+
+//=============================================================================
+// MediaMux: 64 calls over loopback. Every tick each call's remote sends it
+// an RTP packet, the mux hands them to their channels and the channels
+// answer one each, like the bridge does every frame. One op is one call's
+// packet in and its answer out. Besides the time, the packets per system
+// call of the mux and the packets per second per core of the whole process,
+// remotes included, are printed. Not on Windows, where the mux has no
+// batching to compare anyway.
+
+#ifndef WIN32
+
+#define BENCH_MUX_CALLS		64
+#define BENCH_MUX_PACKET	172		// 20 msec of PCMU
+
+static double process_cpu_usec_()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+class MuxBenchChannel : public MuxChannel
+{
+	public:
+		MuxBenchChannel() : received_(0) {}
+
+		void OnRtp(void*, pj_ssize_t) { received_++; }
+		void OnRtcp(void*, pj_ssize_t) {}
+
+		unsigned long Received() const { return received_; }
+
+	private:
+		volatile unsigned long received_;	// the receive thread's
+};
+
+class MediaMuxBench
+{
+	public:
+		MediaMuxBench(unsigned batch)
+			: mux_(batch), ok_(false), packets_(0), cpu_usec_(0.0)
+		{
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			if (mux_.Open(addr) != PJ_SUCCESS)
+				return;
+
+			mux_addr_ = addr;
+			mux_addr_.sin_port = htons(mux_.RtpPort());
+
+			memset(packet_, 0, sizeof(packet_));
+			packet_[0] = (char)0x80;
+
+			for (int i = 0; i < BENCH_MUX_CALLS; i++)
+			{
+				remotes_[i] = socket(AF_INET, SOCK_DGRAM, 0);
+				bind(remotes_[i], (const sockaddr*)&addr, sizeof(addr));
+
+				sockaddr_in remote;
+				socklen_t len = sizeof(remote);
+				getsockname(remotes_[i], (sockaddr*)&remote, &len);
+
+				mux_.Attach(&channels_[i], remote, remote);
+			}
+
+			ok_ = true;
+		}
+
+		~MediaMuxBench()
+		{
+			mux_.Close();
+
+			if (!ok_)
+				return;
+
+			for (int i = 0; i < BENCH_MUX_CALLS; i++)
+				close(remotes_[i]);
+		}
+
+		bool Ok() const { return ok_; }
+
+		void operator()(unsigned long n)
+		{
+			double cpu = process_cpu_usec_();
+
+			for (unsigned long done = 0; done < n; done += BENCH_MUX_CALLS)
+				Tick();
+
+			cpu_usec_ += process_cpu_usec_() - cpu;
+		}
+
+		void Report(const string& name)
+		{
+			MediaMuxStats stats = mux_.Stats();
+
+			cerr << name << ": " << (double)stats.rx_packets / max(1UL, stats.rx_calls) << " packets per receive call, "
+				 << (double)stats.tx_packets / max(1UL, stats.tx_calls) << " per send call, "
+				 << (stats.rx_packets + stats.tx_packets) - (stats.rx_calls + stats.tx_calls) << " calls saved, "
+				 << (long)(packets_ * 1e6 / max(1.0, cpu_usec_)) << " packets/s per core" << endl;
+		}
+
+	private:
+		void Tick()
+		{
+			unsigned long before = received_();
+
+			for (int i = 0; i < BENCH_MUX_CALLS; i++)
+			{
+				// the remote's SSRC
+				pj_uint32_t ssrc = htonl(i + 1);
+				memcpy(packet_ + 8, &ssrc, 4);
+				sendto(remotes_[i], packet_, BENCH_MUX_PACKET, 0, (const sockaddr*)&mux_addr_, sizeof(mux_addr_));
+			}
+
+			// a lost packet on loopback only ends the wait
+			BenchTime deadline = bench_now_() + boost::posix_time::milliseconds(100);
+			while (received_() - before < BENCH_MUX_CALLS && bench_now_() < deadline)
+				boost::this_thread::yield();
+
+			for (int i = 0; i < BENCH_MUX_CALLS; i++)
+				mux_.Send(&channels_[i], false, packet_, BENCH_MUX_PACKET);
+
+			char buf[MEDIAMUX_PACKET_MAX];
+			for (int i = 0; i < BENCH_MUX_CALLS; i++)
+			{
+				while (recv(remotes_[i], buf, sizeof(buf), MSG_DONTWAIT) < 0 && bench_now_() < deadline)
+					boost::this_thread::yield();
+			}
+
+			packets_ += 2 * BENCH_MUX_CALLS;
+		}
+
+		unsigned long received_() const
+		{
+			unsigned long sum = 0;
+			for (int i = 0; i < BENCH_MUX_CALLS; i++)
+				sum += channels_[i].Received();
+			return sum;
+		}
+
+	private:
+		MediaMux mux_;
+		bool ok_;
+		sockaddr_in mux_addr_;
+		mux_socket_t remotes_[BENCH_MUX_CALLS];
+		MuxBenchChannel channels_[BENCH_MUX_CALLS];
+		char packet_[BENCH_MUX_PACKET];
+
+		unsigned long packets_;
+		double cpu_usec_;
+};
+
+static void bench_mediamux_(BenchRunner& runner)
+{
+	const unsigned batches[] = { 1, 32 };
+
+	for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+	{
+		stringstream name;
+		name << "mediamux/calls_" << BENCH_MUX_CALLS << "_batch_" << batches[b];
+		if (!runner.Wanted(name.str()))
+			continue;
+
+		MediaMuxBench bench (batches[b]);
+		if (!bench.Ok())
+		{
+			cerr << name.str() << ": could not open the sockets" << endl;
+			continue;
+		}
+
+		runner.Run(name.str(), bench);
+		bench.Report(name.str());
+	}
+}
+
+#endif
+
+//=============================================================================
+// -v: the SIMD kernels against the scalar ones on random input, every
+// length up to a few vectors so that the tails are covered. The mixing
+// and DSP kernels must be bit exact, spatial_pan may round differently by
+// one.
+
+static bool verify_kernels_()
+{
+	const unsigned max_count = 70;
+	const pj_int16_t gains[] = { 0, 1, 2048, MIXER_GAIN_UNITY, 6000, 32767 };
+
+	pj_int16_t in[max_count];
+	pj_int32_t acc[max_count], acc_ref[max_count];
+	pj_int16_t out[2 * max_count], out_ref[2 * max_count];
+	unsigned seed = 7;
+	int failed = 0;
+
+	for (unsigned count = 0; count <= max_count; count++)
+	{
+		for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++)
+		{
+			fill_random_(in, count, seed);
+			for (unsigned i = 0; i < count; i++)
+				acc[i] = acc_ref[i] = (pj_int32_t)in[(i * 7) % count] * 3;
+
+			mix_accumulate(acc, in, count, gains[g]);
+			mix_accumulate_scalar(acc_ref, in, count, gains[g]);
+
+			if (memcmp(acc, acc_ref, count * sizeof(pj_int32_t)) != 0)
+			{
+				cerr << "mix_accumulate differs, count=" << count << " gain=" << gains[g] << endl;
+				failed++;
+			}
+		}
+
+		// most of these are out of the 16 bit range
+		for (unsigned i = 0; i < count; i++)
+			acc[i] = (pj_int32_t)((seed = seed * 1103515245 + 12345) >> 1) - 0x40000000;
+
+		mix_saturate(acc, out, count);
+		mix_saturate_scalar(acc, out_ref, count);
+
+		if (memcmp(out, out_ref, count * sizeof(pj_int16_t)) != 0)
+		{
+			cerr << "mix_saturate differs, count=" << count << endl;
+			failed++;
+		}
+
+		fill_random_(in, count, seed);
+		SpatialGains from (1.3f, 0.2f), to (0.7f, 0.9f);
+
+		spatial_pan(in, out, count, from, to);
+		spatial_pan_scalar(in, out_ref, count, from, to);
+
+		for (unsigned i = 0; i < 2 * count; i++)
+		{
+			if (abs(out[i] - out_ref[i]) > 1)
+			{
+				cerr << "spatial_pan differs, count=" << count << " at " << i << endl;
+				failed++;
+				break;
+			}
+		}
+
+		fill_random_(in, count, seed);
+		if (count > 0)
+			in[count - 1] = -32768;
+
+		if (dsp_level(in, count) != dsp_level_scalar(in, count))
+		{
+			cerr << "dsp_level differs, count=" << count << endl;
+			failed++;
+		}
+
+		for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++)
+		{
+			fill_random_(in, count, seed);
+			memcpy(out, in, count * sizeof(pj_int16_t));
+			memcpy(out_ref, in, count * sizeof(pj_int16_t));
+
+			dsp_gain(out, count, gains[g]);
+			dsp_gain_scalar(out_ref, count, gains[g]);
+
+			if (memcmp(out, out_ref, count * sizeof(pj_int16_t)) != 0)
+			{
+				cerr << "dsp_gain differs, count=" << count << " gain=" << gains[g] << endl;
+				failed++;
+			}
+		}
+	}
+
+	cerr << "kernels (" << mix_kernels() << "): " << (failed ? "FAILED" : "ok") << endl;
+	return failed == 0;
+}
+
+//=============================================================================
+static void print_usage_and_exit (char **argv)
+{
+	cout << "usage: " << argv[0] << " [-o <FILE>] [-f <FILTER>] [-t <MSEC>] [-r <SAMPLES>] [-v]\n"
+		 << "  -o  write the JSON results to FILE instead of stdout\n"
+		 << "  -f  only run benchmarks whose name contains FILTER\n"
+		 << "  -t  minimum duration of one sample in msec (default 50)\n"
+		 << "  -r  samples per benchmark (default 5)\n"
+		 << "  -v  check the SIMD kernels against the scalar ones and exit"
+		 << endl;
+
+	exit (0);
+}
+
+int main (int argc, char **argv)
+{
+	string output, filter;
+	double min_ms (50.0);
+	int samples (5);
+
+	for (int i = 1; i < argc; i++)
+	{
+		string opt (argv[i]);
+		if (opt == "-v")
+			return verify_kernels_ () ? EXIT_SUCCESS : EXIT_FAILURE;
+		if (opt == "-h" || i + 1 >= argc)
+			print_usage_and_exit (argv);
+
+		string val (argv[++i]);
+		if (opt == "-o") output = val;
+		else if (opt == "-f") filter = val;
+		else if (opt == "-t") min_ms = atof (val.c_str());
+		else if (opt == "-r") samples = max (1, atoi (val.c_str()));
+		else print_usage_and_exit (argv);
+	}
+
+	// default settings, no log file: the log calls still run but go nowhere
+	g_config = new Config();
+	g_logger = new Logger();
+
+	BenchRunner runner (filter, min_ms, samples);
+
+	bench_parsing_ (runner);
+	bench_queue_ (runner);
+	bench_managers_ (runner);
+	bench_statechart_ (runner);
+	bench_spatial_ (runner);
+	bench_mixer_ (runner);
+	bench_vad_ (runner);
+	bench_dsp_ (runner);
+#ifndef WIN32
+	bench_mediamux_ (runner);
+#endif
+
+	if (output.empty())
+		runner.WriteJson (cout);
+	else
+	{
+		ofstream out (output.c_str());
+		runner.WriteJson (out);
+	}
+
+	return EXIT_SUCCESS;
+}
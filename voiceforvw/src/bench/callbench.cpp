@@ -0,0 +1,508 @@
+/* callbench.cpp -- end to end call benchmark
+ *
+ *			Copyright 2009, 3di.jp Inc
+ *
+ * Drives SIPConference the way the account and session state machines do
+ * against slvoice_sipecho running on the same machine, with the null
+ * sound device, and measures:
+ *
+ *  - registration and call setup time, from Register()/Join() to the
+ *    RegSucceed/DialSucceed event
+ *  - audio round trip: a probe port in the conference bridge sends a
+ *    short 1 kHz burst into each call every -i msec and times it until
+ *    the echo comes back. This is two mouth-to-ear legs, including both
+ *    jitter buffers and the echo server's bridge.
+ *  - CPU of this process per established call while -n calls are up
+ *  - RTP sent per call, which the VAD gate (-v) cuts in the silence
+ *    between the bursts; -t makes each burst a talk spurt of that share
+ *    of the interval
+ *
+ * -m runs it with one MediaProfile, or with -m all once with each of them
+ * in turn, to compare their latency and CPU.
+ *
+ * -s tcp runs the SIP over one TCP connection, as SIPTransport does. The
+ * registration then pays for the handshake and the calls and the -R
+ * re-registrations after it do not; against -s udp that is what a kept
+ * connection saves on every request.
+ */
+
+#include "main.h"
+#include "state.hpp"
+
+#include <cmath>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+Config *g_config;
+Logger *g_logger;
+Metrics *g_metrics (NULL);
+
+// there is no viewer connection in the benchmarks
+Server *glb_server (NULL);
+
+EventManager g_eventManager;
+
+const int callbench_default_port (5062);
+
+// the default MaxCalls
+const int callbench_max_calls (4);
+
+//=============================================================================
+static double process_cpu_usec_()
+{
+#ifdef WIN32
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+
+	// 100 nsec units
+	return (double)(k.QuadPart + u.QuadPart) / 10.0;
+#else
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+static double elapsed_msec_(const pj_timestamp& from)
+{
+	pj_timestamp now;
+	pj_get_timestamp(&now);
+	return pj_elapsed_usec(&from, &now) / 1e3;
+}
+
+// RTP packets and payload bytes sent on all the calls so far
+static void rtp_sent_(const vector<int>& call_ids, double *pkt, double *bytes)
+{
+	*pkt = *bytes = 0.0;
+
+	for (size_t i = 0; i < call_ids.size(); i++)
+	{
+		pjmedia_session *session = pjsua_call_get_media_session(call_ids[i]);
+		pjmedia_rtcp_stat stat;
+
+		if (session != NULL && pjmedia_session_get_stream_stat(session, 0, &stat) == PJ_SUCCESS)
+		{
+			*pkt += stat.tx.pkt;
+			*bytes += stat.tx.bytes;
+		}
+	}
+}
+
+static void print_stats_(const string& name, vector<double> v)
+{
+	cout << "  " << name;
+	if (v.empty())
+	{
+		cout << ": no samples" << endl;
+		return;
+	}
+
+	sort(v.begin(), v.end());
+	cout << ": n=" << v.size()
+		 << " p50=" << v[v.size() / 2]
+		 << " p90=" << v[v.size() * 9 / 10]
+		 << " max=" << v.back() << " msec" << endl;
+}
+
+//=============================================================================
+// Probe port, connected both ways to one call in the conference bridge.
+// The bridge calls get_frame/put_frame from its clock thread.
+
+#define PROBE_SIGNATURE		PJMEDIA_PORT_SIGNATURE('S', 'L', 'P', 'B')
+#define PROBE_AMPLITUDE		8000
+#define PROBE_THRESHOLD		2000
+
+class ProbePort
+{
+	public:
+		ProbePort(pj_pool_t *pool, const MediaProfile& profile, unsigned interval_ms, unsigned talk_percent)
+			: frame_(0), waiting_(false)
+		{
+			const pj_str_t name = pj_str((char*)"probe");
+
+			// the bridge's format, which the profile sets
+			pjmedia_port_info_init(&port_.info, &name, PROBE_SIGNATURE,
+				profile.clock_rate, 1, 16,
+				profile.clock_rate * profile.frame_ptime / 1000);
+
+			port_.port_data.user_data = this;
+			port_.get_frame = &get_frame_;
+			port_.put_frame = &put_frame_;
+			port_.on_destroy = NULL;
+
+			interval_ = max(1u, interval_ms / profile.frame_ptime);
+			talk_ = max(1u, interval_ * talk_percent / 100);
+		}
+
+		pjmedia_port* port() { return &port_; }
+
+		vector<double> RoundTrips()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			return round_trips_;
+		}
+
+	private:
+		static pj_status_t get_frame_(pjmedia_port *port, pjmedia_frame *frame)
+		{
+			ProbePort *self = (ProbePort*)port->port_data.user_data;
+			pj_int16_t *samples = (pj_int16_t*)frame->buf;
+			unsigned count = port->info.samples_per_frame;
+
+			frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+			frame->size = count * 2;
+
+			// tone for the talk spurt, then silence until the next
+			// interval; a burst that never came back is given up on at
+			// the next one
+			unsigned long phase = self->frame_++ % self->interval_;
+			if (phase < self->talk_)
+			{
+				for (unsigned i = 0; i < count; i++)
+					samples[i] = (pj_int16_t)(PROBE_AMPLITUDE
+						* sin(2.0 * 3.14159265 * 1000.0 * i / port->info.clock_rate));
+
+				if (phase == 0)
+				{
+					pj_get_timestamp(&self->sent_);
+					self->waiting_ = true;
+				}
+			}
+			else
+				memset(samples, 0, frame->size);
+
+			return PJ_SUCCESS;
+		}
+
+		static pj_status_t put_frame_(pjmedia_port *port, const pjmedia_frame *frame)
+		{
+			ProbePort *self = (ProbePort*)port->port_data.user_data;
+
+			if (!self->waiting_ || frame->type != PJMEDIA_FRAME_TYPE_AUDIO)
+				return PJ_SUCCESS;
+
+			const pj_int16_t *samples = (const pj_int16_t*)frame->buf;
+			unsigned count = frame->size / 2;
+
+			for (unsigned i = 0; i < count; i++)
+			{
+				if (abs(samples[i]) > PROBE_THRESHOLD)
+				{
+					boost::mutex::scoped_lock lock(self->mutex_);
+					self->round_trips_.push_back(elapsed_msec_(self->sent_));
+					self->waiting_ = false;
+					break;
+				}
+			}
+
+			return PJ_SUCCESS;
+		}
+
+	private:
+		pjmedia_port port_;
+
+		unsigned interval_;		// in frames
+		unsigned talk_;			// frames of tone at the start of each interval
+		unsigned long frame_;
+		bool waiting_;
+		pj_timestamp sent_;
+
+		boost::mutex mutex_;
+		vector<double> round_trips_;
+};
+
+//=============================================================================
+// Takes the events SIPConference's callbacks enqueue, in place of the
+// EventManager thread
+
+static SessionEvent* wait_session_event_(EventType type, unsigned int timeout_ms)
+{
+	Event *ev;
+
+	while ((ev = (Event *)g_eventManager.blockQueue.dequeue(timeout_ms)) != NULL)
+	{
+		if (ev->type == type)
+			return (SessionEvent *)ev;
+
+		delete ev;
+	}
+
+	return NULL;
+}
+
+static bool wait_account_event_(unsigned int timeout_ms)
+{
+	Event *ev;
+
+	while ((ev = (Event *)g_eventManager.blockQueue.dequeue(timeout_ms)) != NULL)
+	{
+		bool succeeded = (ev->type == EventType_RegSucceed);
+		bool failed = (ev->type == EventType_RegFailed);
+		delete ev;
+
+		if (succeeded || failed)
+			return succeeded;
+	}
+
+	return false;
+}
+
+//=============================================================================
+// One run of the benchmark, with the SIP stack set up for the profile and
+// torn down again at the end
+
+static bool run_ (const string& profile, const string& address, int port, int calls,
+				  double hold, int interval, int talk, const string& codec, int vad, int reregisters)
+{
+	g_config->MediaProfile = profile;
+
+	stringstream domain;
+	domain << address << ":" << port;
+
+	SIPServerInfo sipinfo;
+	sipinfo.sipuri = "sip:callbench@" + domain.str();
+	sipinfo.reguri = "sip:" + domain.str();
+
+	SIPConference conf (sipinfo);
+
+	pj_status_t status = pjsua_set_null_snd_dev ();
+	if (status != PJ_SUCCESS)
+	{
+		cerr << "cannot set the null sound device" << endl;
+		return false;
+	}
+
+	const MediaProfile *media = find_media_profile (profile);
+
+	SIPUserInfo uinfo ("callbench", domain.str());
+	vector<double> reg_ms, setup_ms;
+	int acc_id;
+
+	// Account.Login
+	pj_timestamp start;
+	pj_get_timestamp (&start);
+
+	conf.Register (uinfo, &acc_id);
+	if (!wait_account_event_ (5000))
+	{
+		cerr << "registration with " << sipinfo.reguri << " failed" << endl;
+		return false;
+	}
+	reg_ms.push_back (elapsed_msec_ (start));
+
+	// refreshes, over the connection of the first with TCP
+	vector<double> rereg_ms;
+	for (int i = 0; i < reregisters; i++)
+	{
+		pj_get_timestamp (&start);
+		pjsua_acc_set_registration (acc_id, PJ_TRUE);
+		if (!wait_account_event_ (5000))
+		{
+			cerr << "re-registration " << i << " failed" << endl;
+			return false;
+		}
+		rereg_ms.push_back (elapsed_msec_ (start));
+	}
+
+	// Session.Create, one call at a time as the session state machine does
+	vector<int> call_ids;
+	for (int i = 0; i < calls; i++)
+	{
+		int call_id;
+
+		pj_get_timestamp (&start);
+		conf.Join ("sip:echo@" + domain.str(), acc_id, &call_id);
+
+		SessionEvent *ev = wait_session_event_ (EventType_DialSucceed, 5000);
+		if (ev == NULL)
+		{
+			cerr << "call " << i << " was not answered" << endl;
+			return false;
+		}
+		setup_ms.push_back (elapsed_msec_ (start));
+		delete ev;
+
+		call_ids.push_back (call_id);
+	}
+
+	// media is up once the calls are confirmed, attach a probe to each
+	pj_pool_t *pool = pjsua_pool_create ("callbench", 1000, 1000);
+	vector<ProbePort*> probes;
+	vector<pjsua_conf_port_id> slots;
+
+	for (size_t i = 0; i < call_ids.size(); i++)
+	{
+		pjsua_call_info ci;
+		pjsua_call_get_info (call_ids[i], &ci);
+
+		ProbePort *probe = new ProbePort (pool, *media, interval, talk);
+		pjsua_conf_port_id slot;
+
+		// the probe talks where the microphone would, through the VAD gate
+		pjsua_conf_port_id capture = conf.CaptureSlot (call_ids[i]);
+
+		pjsua_conf_add_port (pool, probe->port(), &slot);
+		pjsua_conf_connect (slot, capture != PJSUA_INVALID_ID ? capture : ci.conf_slot);
+		pjsua_conf_connect (ci.conf_slot, slot);
+
+		probes.push_back (probe);
+		slots.push_back (slot);
+	}
+
+	double tx_pkt_start, tx_bytes_start;
+	rtp_sent_ (call_ids, &tx_pkt_start, &tx_bytes_start);
+
+	double cpu_start = process_cpu_usec_ ();
+	pj_get_timestamp (&start);
+
+	pj_thread_sleep ((unsigned)(hold * 1000));
+
+	double wall = elapsed_msec_ (start) * 1e3;
+	double cpu = process_cpu_usec_ () - cpu_start;
+
+	double tx_pkt, tx_bytes;
+	rtp_sent_ (call_ids, &tx_pkt, &tx_bytes);
+	tx_pkt -= tx_pkt_start;
+	tx_bytes -= tx_bytes_start;
+
+	// Session.Terminate and Account.Logout
+	for (size_t i = 0; i < call_ids.size(); i++)
+	{
+		conf.Leave (call_ids[i]);
+		delete wait_session_event_ (EventType_DialDisconnected, 5000);
+	}
+
+	conf.UnRegister (acc_id);
+	wait_account_event_ (5000);
+
+	vector<double> round_trip_ms;
+	for (size_t i = 0; i < probes.size(); i++)
+	{
+		vector<double> r (probes[i]->RoundTrips ());
+		round_trip_ms.insert (round_trip_ms.end(), r.begin(), r.end());
+
+		pjsua_conf_remove_port (slots[i]);
+		delete probes[i];
+	}
+	pj_pool_release (pool);
+
+	// half the round trip; the echo server's leg keeps its own settings,
+	// and the null sound device has none of the sound card's latency
+	vector<double> mouth_to_ear_ms;
+	for (size_t i = 0; i < round_trip_ms.size(); i++)
+		mouth_to_ear_ms.push_back (round_trip_ms[i] / 2.0);
+
+	cout << calls << " call(s) to sip:echo@" << domain.str() << " with " << codec
+		 << ", VAD mode " << vad << ", " << profile << " profile, held for " << hold << " s, SIP over "
+		 << g_config->SIPTransport << endl;
+	print_stats_ ("register", reg_ms);
+	if (reregisters > 0)
+		print_stats_ ("re-register", rereg_ms);
+	print_stats_ ("call setup", setup_ms);
+	print_stats_ ("audio round trip", round_trip_ms);
+	print_stats_ ("mouth-to-ear", mouth_to_ear_ms);
+	cout << "  CPU " << cpu / wall * 100.0 / calls << "% of a core per call" << endl;
+	cout << "  RTP sent " << tx_pkt / calls / (wall / 1e6) << " packets/s, "
+		 << tx_bytes * 8 / 1000 / calls / (wall / 1e6) << " kbit/s (payload) per call" << endl;
+
+	return true;
+}
+
+//=============================================================================
+static void print_usage_and_exit (char **argv)
+{
+	cout << "usage: " << argv[0] << " [-a <ADDRESS>] [-p <PORT>] [-n <CALLS>] [-d <SECONDS>]\n"
+		 << "       [-i <MSEC>] [-t <PERCENT>] [-c <CODEC>] [-v <MODE>] [-m <PROFILE>]\n"
+		 << "       [-s udp|tcp] [-R <COUNT>]\n"
+		 << "  -a  address of slvoice_sipecho (default 127.0.0.1)\n"
+		 << "  -p  SIP port of slvoice_sipecho (default " << callbench_default_port << ")\n"
+		 << "  -n  concurrent calls, at most " << callbench_max_calls << " (default 1)\n"
+		 << "  -d  seconds to hold the calls (default 10)\n"
+		 << "  -i  msec between two round trip probes (default 500)\n"
+		 << "  -t  percent of each interval the probe talks for (default 0, one frame)\n"
+		 << "  -c  codec, as Codec in SLVoice.xml (default PCMU)\n"
+		 << "  -v  VAD mode, as VADMode in SLVoice.xml (default 1, 0 is off)\n"
+		 << "  -m  media profile, as MediaProfile in SLVoice.xml, or all (default balanced)\n"
+		 << "  -s  SIP transport, as SIPTransport in SLVoice.xml (default udp)\n"
+		 << "  -R  re-registrations timed after the first (default 0)"
+		 << endl;
+
+	exit (0);
+}
+
+int main (int argc, char **argv)
+{
+	string address ("127.0.0.1");
+	int port (callbench_default_port);
+	int calls (1);
+	double hold (10.0);
+	int interval (500);
+	int talk (0);
+	string codec ("PCMU");
+	int vad (1);
+	string profile ("balanced");
+	string transport ("udp");
+	int reregisters (0);
+
+	for (int i = 1; i < argc; i++)
+	{
+		string opt (argv[i]);
+		if (opt == "-h" || i + 1 >= argc)
+			print_usage_and_exit (argv);
+
+		string val (argv[++i]);
+		if (opt == "-a") address = val;
+		else if (opt == "-p") port = atoi (val.c_str());
+		else if (opt == "-n") calls = min (callbench_max_calls, max (1, atoi (val.c_str())));
+		else if (opt == "-d") hold = atof (val.c_str());
+		else if (opt == "-i") interval = max (20, atoi (val.c_str()));
+		else if (opt == "-t") talk = min (100, max (0, atoi (val.c_str())));
+		else if (opt == "-c") codec = val;
+		else if (opt == "-v") vad = min (VAD_MODE_MAX, max (VAD_MODE_OFF, atoi (val.c_str())));
+		else if (opt == "-m") profile = val;
+		else if (opt == "-s" && (val == "udp" || val == "tcp")) transport = val;
+		else if (opt == "-R") reregisters = max (0, atoi (val.c_str()));
+		else print_usage_and_exit (argv);
+	}
+
+	vector<string> profiles;
+	if (profile == "all")
+	{
+		profiles.push_back ("low-latency");
+		profiles.push_back ("balanced");
+		profiles.push_back ("low-cpu");
+	}
+	else if (find_media_profile (profile) != NULL)
+		profiles.push_back (profile);
+	else
+		print_usage_and_exit (argv);
+
+	// default settings, no log file
+	g_config = new Config();
+	g_config->Codecs.assign(1, codec);
+	g_config->VADMode = vad;
+	g_config->SIPTransport = transport;
+	g_logger = new Logger();
+
+	for (size_t i = 0; i < profiles.size(); i++)
+	{
+		if (i > 0)
+			cout << endl;
+
+		if (!run_ (profiles[i], address, port, calls, hold, interval, talk, codec, vad, reregisters))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,930 @@
+/* loadgen.cpp -- viewer load generator
+ *
+ *			Copyright 2009, 3di.jp Inc
+ *
+ * Connects to a running SLVoice on its viewer port and replays a script of
+ * viewer requests, measuring the time from each request to its Response
+ * and counting the Events that come back.
+ *
+ * A minimal SIP registrar/conference stand-in runs inside the process so
+ * that no outside services are needed: it answers REGISTER, INVITE (with
+ * an SDP answer), BYE and everything else with 200 OK and swallows RTP.
+ * Account.Login is sent with an AccountURI in the stand-in's domain, so
+ * SLVoice derives its registrar and conference URIs from it.
+ *
+ * Script format, one step per line ('#' starts a comment):
+ *
+ *   <Action> [count] [rate]       send count requests (default 1) at rate
+ *                                 requests/second (default 0, unpaced).
+ *                                 Session.* actions are sent once per
+ *                                 session, everything else once.
+ *   Wait <Event>[:State] [n|each] [timeout]
+ *                                 wait for n events (default 1, "each" for
+ *                                 one per session) since the last send step
+ *   Sleep <msec>
+ *
+ * Actions can be given with or without the ".1" version suffix; the
+ * Session.Set3DPosition alias Set3DPosition is accepted as well.
+ */
+
+#include <sockets/Sockets.h>
+#include <tinyxml/tinyxml.h>
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef WIN32
+#define close_socket_ closesocket
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define close_socket_ ::close
+#endif
+
+using namespace std;
+
+typedef boost::posix_time::ptime Time;
+
+// default viewer port, same as glb_default_port in server.hpp
+const int loadgen_default_port (44125);
+const int loadgen_default_sip_port (5070);
+
+#define	LOADGEN_XMLMSG_DELIM		"\n\n\n"
+
+static Time now_()
+{
+	return boost::posix_time::microsec_clock::universal_time();
+}
+
+static long elapsed_usec_(const Time& from, const Time& to)
+{
+	return (long)(to - from).total_microseconds();
+}
+
+static void sleep_usec_(long usec)
+{
+	if (usec > 0)
+		boost::this_thread::sleep(boost::posix_time::microseconds(usec));
+}
+
+//=============================================================================
+// SIPStandIn class
+//
+// Single threaded UDP responder. It keeps no dialog state; every response
+// is built from the headers of the request it answers.
+
+class SIPStandIn
+{
+	public:
+		SIPStandIn(int port);
+		~SIPStandIn();
+
+		void operator()();
+		void Stop() { stop_ = true; }
+
+		unsigned long registers;
+		unsigned long invites;
+		unsigned long byes;
+		unsigned long others;
+		unsigned long rtp_packets;
+
+	private:
+		void handle_(const string& msg, const sockaddr_in& from);
+		string answer_sdp_(const string& offer);
+
+		int port_;
+		int sip_;
+		int rtp_;
+		volatile bool stop_;
+		unsigned long tag_;
+};
+
+SIPStandIn::SIPStandIn(int port) :
+	registers(0), invites(0), byes(0), others(0), rtp_packets(0),
+	port_(port), sip_(-1), rtp_(-1), stop_(false), tag_(0)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	sip_ = (int)socket(AF_INET, SOCK_DGRAM, 0);
+	addr.sin_port = htons((unsigned short)port_);
+	if (sip_ < 0 || bind(sip_, (sockaddr*)&addr, sizeof(addr)) != 0)
+		throw SocketRunTimeException("cannot bind SIP stand-in port");
+
+	// RTP goes to the next even port and is only counted
+	rtp_ = (int)socket(AF_INET, SOCK_DGRAM, 0);
+	addr.sin_port = htons((unsigned short)(port_ + 2));
+	if (rtp_ < 0 || bind(rtp_, (sockaddr*)&addr, sizeof(addr)) != 0)
+		throw SocketRunTimeException("cannot bind SIP stand-in RTP port");
+}
+
+SIPStandIn::~SIPStandIn()
+{
+	if (sip_ >= 0) close_socket_(sip_);
+	if (rtp_ >= 0) close_socket_(rtp_);
+}
+
+void SIPStandIn::operator()()
+{
+	char buf[8192];
+
+	while (!stop_)
+	{
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(sip_, &fds);
+		FD_SET(rtp_, &fds);
+
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 200000;
+
+		if (select(max(sip_, rtp_) + 1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		if (FD_ISSET(rtp_, &fds))
+		{
+			if (recv(rtp_, buf, sizeof(buf), 0) > 0)
+				rtp_packets++;
+		}
+
+		if (FD_ISSET(sip_, &fds))
+		{
+			sockaddr_in from;
+			socklen_t len = sizeof(from);
+			int n = recvfrom(sip_, buf, sizeof(buf), 0, (sockaddr*)&from, &len);
+			if (n > 0)
+				handle_(string(buf, n), from);
+		}
+	}
+}
+
+// returns the lowercased header name of a "Name: value" line, expanding
+// the compact forms pjsip may use
+static string header_name_(const string& line)
+{
+	string::size_type colon = line.find(':');
+	if (colon == string::npos)
+		return "";
+
+	string name(line, 0, colon);
+	while (!name.empty() && name[name.size() - 1] == ' ')
+		name.erase(name.size() - 1);
+	for (size_t i = 0; i < name.size(); i++)
+		name[i] = (char)tolower(name[i]);
+
+	if (name == "v") return "via";
+	if (name == "f") return "from";
+	if (name == "t") return "to";
+	if (name == "i") return "call-id";
+	if (name == "m") return "contact";
+	return name;
+}
+
+void SIPStandIn::handle_(const string& msg, const sockaddr_in& from)
+{
+	// responses (e.g. to nothing we sent) and keep-alives are ignored
+	if (msg.compare(0, 4, "SIP/") == 0 || msg.size() < 8)
+		return;
+
+	string method(msg, 0, msg.find(' '));
+	if (method == "ACK")
+		return;
+
+	string::size_type body_at = msg.find("\r\n\r\n");
+	string head(msg, 0, body_at);
+	string body(body_at == string::npos ? "" : msg.substr(body_at + 4));
+
+	stringstream resp;
+	resp << "SIP/2.0 200 OK\r\n";
+
+	istringstream lines(head);
+	string line;
+	getline(lines, line);	// request line
+	while (getline(lines, line))
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+
+		string name(header_name_(line));
+		if (name == "via" || name == "from" || name == "call-id" || name == "cseq")
+			resp << line << "\r\n";
+		else if (name == "to")
+		{
+			resp << line;
+			if (line.find(";tag=") == string::npos)
+				resp << ";tag=sb" << ++tag_;
+			resp << "\r\n";
+		}
+		else if (name == "contact" && method == "REGISTER")
+			resp << line << ";expires=3600\r\n";
+	}
+
+	string sdp;
+	if (method == "REGISTER")
+		registers++;
+	else if (method == "INVITE")
+	{
+		invites++;
+		sdp = answer_sdp_(body);
+		stringstream contact;
+		contact << "Contact: <sip:conference@127.0.0.1:" << port_ << ">\r\n";
+		resp << contact.str();
+	}
+	else if (method == "BYE")
+		byes++;
+	else
+		others++;
+
+	if (!sdp.empty())
+		resp << "Content-Type: application/sdp\r\n";
+	resp << "Content-Length: " << sdp.size() << "\r\n\r\n" << sdp;
+
+	string out(resp.str());
+	sendto(sip_, out.c_str(), (int)out.size(), 0, (const sockaddr*)&from, sizeof(from));
+}
+
+// accepts the first payload type of the offer and points RTP at our sink
+string SIPStandIn::answer_sdp_(const string& offer)
+{
+	string pt("0"), rtpmap;
+
+	istringstream lines(offer);
+	string line;
+	while (getline(lines, line))
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+
+		if (line.compare(0, 8, "m=audio ") == 0)
+		{
+			// m=audio <port> RTP/AVP <pt> ...
+			istringstream m(line.substr(8));
+			string port, proto;
+			m >> port >> proto >> pt;
+		}
+		else if (rtpmap.empty() && line.compare(0, 9, "a=rtpmap:") == 0
+			&& line.compare(9, pt.size() + 1, pt + " ") == 0)
+		{
+			rtpmap = line;
+		}
+	}
+
+	stringstream sdp;
+	sdp << "v=0\r\n"
+		<< "o=standin 1 1 IN IP4 127.0.0.1\r\n"
+		<< "s=slvoice load\r\n"
+		<< "c=IN IP4 127.0.0.1\r\n"
+		<< "t=0 0\r\n"
+		<< "m=audio " << port_ + 2 << " RTP/AVP " << pt << "\r\n";
+	if (!rtpmap.empty())
+		sdp << rtpmap << "\r\n";
+	sdp << "a=sendrecv\r\n";
+
+	return sdp.str();
+}
+
+//=============================================================================
+// Step of a load script
+
+struct Step
+{
+	enum Kind { SendStep, WaitStep, SleepStep };
+
+	Kind kind;
+	string name;		// action, or event type for Wait
+	string state;		// optional State filter for Wait
+	int count;			// -1 for "each"
+	double rate;		// requests/second, or timeout in seconds for Wait
+};
+
+static string normalize_action_(string action)
+{
+	if (action == "Set3DPosition")
+		action = "Session.Set3DPosition";
+
+	// Connector.Create -> Connector.Create.1
+	if (action.find_last_of('.') == string::npos
+		|| !isdigit(action[action.size() - 1]))
+		action += ".1";
+
+	return action;
+}
+
+static vector<Step> load_script_(istream& in)
+{
+	vector<Step> steps;
+	string line;
+	int lineno = 0;
+
+	while (getline(in, line))
+	{
+		lineno++;
+
+		string::size_type hash = line.find('#');
+		if (hash != string::npos)
+			line.erase(hash);
+
+		istringstream words(line);
+		string first;
+		if (!(words >> first))
+			continue;
+
+		Step step;
+		step.count = 1;
+		step.rate = 0.0;
+
+		if (first == "Wait")
+		{
+			string what, count, timeout;
+			step.kind = Step::WaitStep;
+			words >> what >> count >> timeout;
+			step.rate = timeout.empty() ? 10.0 : atof(timeout.c_str());
+
+			string::size_type colon = what.find(':');
+			step.name = what.substr(0, colon);
+			if (colon != string::npos)
+				step.state = what.substr(colon + 1);
+
+			if (count == "each")
+				step.count = -1;
+			else if (!count.empty())
+				step.count = atoi(count.c_str());
+		}
+		else if (first == "Sleep")
+		{
+			string msec;
+			step.kind = Step::SleepStep;
+			words >> msec;
+			step.count = atoi(msec.c_str());
+		}
+		else
+		{
+			string count, rate;
+			step.kind = Step::SendStep;
+			step.name = normalize_action_(first);
+			words >> count >> rate;
+			if (!count.empty())
+				step.count = atoi(count.c_str());
+			if (!rate.empty())
+				step.rate = atof(rate.c_str());
+		}
+
+		if (step.name.empty() && step.kind == Step::WaitStep)
+		{
+			cerr << "script line " << lineno << ": Wait needs an event type" << endl;
+			exit(1);
+		}
+
+		steps.push_back(step);
+	}
+
+	return steps;
+}
+
+static const char* default_script_ =
+	"Connector.Create\n"
+	"Account.Login\n"
+	"Wait LoginStateChangeEvent:1\n"
+	"Session.Create\n"
+	"Wait SessionStateChangeEvent:4 each\n"
+	"Set3DPosition 200 500\n"
+	"Connector.MuteLocalMic 10 20\n"
+	"Session.Terminate\n"
+	"Wait SessionStateChangeEvent:5 each\n"
+	"Account.Logout\n"
+	"Connector.InitiateShutdown\n";
+
+//=============================================================================
+// LoadClient class
+//
+// Owns the viewer connection. The reader thread matches Responses to the
+// requests in flight by requestId and counts Events by type.
+
+class LoadClient
+{
+	public:
+		LoadClient(const string& address, int port, int sessions, int sip_port);
+
+		void operator()();		// reader thread
+
+		void Run(const vector<Step>& steps, double timeout);
+		void Report(ostream& out, double seconds);
+
+	private:
+		struct ActionStats
+		{
+			ActionStats() : sent(0), answered(0), failed(0), timed_out(0) {}
+			unsigned long sent;
+			unsigned long answered;
+			unsigned long failed;
+			unsigned long timed_out;
+			vector<long> usec;
+		};
+
+		struct EventStats
+		{
+			EventStats() : count(0) {}
+			unsigned long count;
+			Time first;
+			Time last;
+		};
+
+		struct InFlight
+		{
+			string action;
+			int session;
+			Time sent_at;
+		};
+
+		void send_(const string& action, int session, int seq);
+		string build_(const string& action, const string& rid, int session, int seq);
+		void handle_(const string& msg);
+		void wait_replies_(double timeout);
+		void wait_event_(const Step& step);
+
+		unsigned long event_count_(const string& type, const string& state);
+
+		TCPSocketWrapper sock_;
+
+		int sessions_;
+		int sip_port_;
+		unsigned long next_id_;
+
+		string connector_;
+		string account_;
+		vector<string> session_handles_;
+
+		map<string, InFlight> in_flight_;
+		map<string, ActionStats> actions_;
+		map<string, EventStats> events_;
+		map<string, unsigned long> event_states_;	// "Type:State" counts
+		map<string, unsigned long> baseline_;		// event_states_ at last send step
+
+		boost::mutex mutex_;
+		boost::condition_variable cond_;
+		volatile bool closed_;
+};
+
+LoadClient::LoadClient(const string& address, int port, int sessions, int sip_port) :
+	sessions_(sessions), sip_port_(sip_port), next_id_(0),
+	session_handles_(sessions), closed_(false)
+{
+	sock_.connect(address, port);
+
+	// requests are small and back to back; do not let them wait for ACKs
+	sock_.nodelay();
+}
+
+void LoadClient::operator()()
+{
+	char buf[8192];
+	string pending;
+
+	for (;;)
+	{
+		size_t nread = 0;
+		try { nread = sock_.read(buf, sizeof(buf)); }
+		catch (exception&) { nread = 0; }
+
+		if (nread == 0)
+			break;
+
+		pending.append(buf, nread);
+
+		string::size_type pos;
+		while ((pos = pending.find(LOADGEN_XMLMSG_DELIM)) != string::npos)
+		{
+			handle_(pending.substr(0, pos));
+			pending.erase(0, pos + strlen(LOADGEN_XMLMSG_DELIM));
+		}
+	}
+
+	boost::mutex::scoped_lock lk(mutex_);
+	closed_ = true;
+	cond_.notify_all();
+}
+
+static string child_text_(const TiXmlElement *e, const char *name)
+{
+	const TiXmlElement *c = e ? e->FirstChildElement(name) : NULL;
+	return (c && c->GetText()) ? c->GetText() : "";
+}
+
+void LoadClient::handle_(const string& msg)
+{
+	Time at(now_());
+
+	TiXmlDocument doc;
+	doc.Parse(msg.c_str());
+	const TiXmlElement *root = doc.RootElement();
+	if (root == NULL)
+		return;
+
+	boost::mutex::scoped_lock lk(mutex_);
+
+	if (root->ValueStr() == "Response")
+	{
+		const char *rid = root->Attribute("requestId");
+		map<string, InFlight>::iterator it = in_flight_.find(rid ? rid : "");
+		if (it == in_flight_.end())
+			return;
+
+		const InFlight& req = it->second;
+		ActionStats& stats = actions_[req.action];
+		stats.answered++;
+		stats.usec.push_back(elapsed_usec_(req.sent_at, at));
+
+		if (child_text_(root, "ReturnCode") != "0")
+			stats.failed++;
+
+		// keep the handles the following steps need
+		const TiXmlElement *results = root->FirstChildElement("Results");
+		string handle;
+		if (!(handle = child_text_(results, "ConnectorHandle")).empty())
+			connector_ = handle;
+		if (!(handle = child_text_(results, "AccountHandle")).empty())
+			account_ = handle;
+		if (!(handle = child_text_(results, "SessionHandle")).empty() && req.session >= 0)
+			session_handles_[req.session] = handle;
+
+		in_flight_.erase(it);
+	}
+	else if (root->ValueStr() == "Event")
+	{
+		const char *type = root->Attribute("type");
+		string name(type ? type : "");
+
+		EventStats& stats = events_[name];
+		if (stats.count++ == 0)
+			stats.first = at;
+		stats.last = at;
+
+		event_states_[name]++;
+		string state(child_text_(root, "State"));
+		if (!state.empty())
+			event_states_[name + ":" + state]++;
+	}
+
+	cond_.notify_all();
+}
+
+// counts events whose type ends with the given name, so that
+// LoginStateChangeEvent also matches AccountLoginStateChangeEvent
+unsigned long LoadClient::event_count_(const string& type, const string& state)
+{
+	unsigned long total = 0;
+	string suffix(state.empty() ? type : type + ":" + state);
+
+	for (map<string, unsigned long>::iterator it = event_states_.begin();
+		 it != event_states_.end(); ++it)
+	{
+		const string& key = it->first;
+		if (key.size() >= suffix.size()
+			&& key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0
+			&& (!state.empty() || key.find(':') == string::npos))
+		{
+			total += it->second - baseline_[key];
+		}
+	}
+	return total;
+}
+
+string LoadClient::build_(const string& action, const string& rid, int session, int seq)
+{
+	stringstream x;
+	x << "<Request requestId=\"" << rid << "\" action=\"" << action << "\">";
+
+	string shandle(session >= 0 ? session_handles_[session] : "");
+
+	if (action == "Connector.Create.1")
+	{
+		x << "<ClientName>slvoice_loadgen</ClientName>"
+		  << "<AccountManagementServer>http://127.0.0.1/</AccountManagementServer>"
+		  << "<ProxyManagementServer>127.0.0.1</ProxyManagementServer>"
+		  << "<MinimumPort>30000</MinimumPort><MaximumPort>31000</MaximumPort>";
+	}
+	else if (action == "Connector.InitiateShutdown.1")
+		x << "<ConnectorHandle>" << connector_ << "</ConnectorHandle>";
+	else if (action == "Connector.MuteLocalMic.1" || action == "Connector.MuteLocalSpeaker.1")
+		x << "<ConnectorHandle>" << connector_ << "</ConnectorHandle>"
+		  << "<Value>" << (seq % 2 ? "false" : "true") << "</Value>";
+	else if (action == "Connector.SetLocalMicVolume.1" || action == "Connector.SetLocalSpeakerVolume.1")
+		x << "<ConnectorHandle>" << connector_ << "</ConnectorHandle>"
+		  << "<Value>" << 30 + seq % 40 << "</Value>";
+	else if (action == "Account.Login.1")
+	{
+		x << "<ConnectorHandle>" << connector_ << "</ConnectorHandle>"
+		  << "<AccountName>loadgen</AccountName>"
+		  << "<AccountPassword>loadgen</AccountPassword>"
+		  << "<AccountURI>sip:loadgen@127.0.0.1:" << sip_port_ << "</AccountURI>"
+		  << "<AudioSessionAnswerMode>VerifyAnswer</AudioSessionAnswerMode>"
+		  << "<ParticipantPropertyFrequency>5</ParticipantPropertyFrequency>";
+	}
+	else if (action == "Account.Logout.1")
+		x << "<AccountHandle>" << account_ << "</AccountHandle>";
+	else if (action == "Session.Create.1")
+	{
+		x << "<AccountHandle>" << account_ << "</AccountHandle>"
+		  << "<URI>sip:conf" << session << "@127.0.0.1</URI>"
+		  << "<Name>conf" << session << "</Name>"
+		  << "<Password>x</Password>"
+		  << "<JoinAudio>true</JoinAudio><JoinText>false</JoinText>"
+		  << "<Type>1</Type>"
+		  << "<PasswordHashAlgorithm>SHA1UserName</PasswordHashAlgorithm>";
+	}
+	else if (action == "Session.Set3DPosition.1")
+	{
+		// walk the avatar around a circle so every update differs
+		double a = seq * 0.05 + session;
+		stringstream pos;
+		pos << "<Position X=\"" << 128.0 + 10.0 * cos(a) << "\" Y=\"22.0\" Z=\""
+			<< 128.0 + 10.0 * sin(a) << "\" />"
+			<< "<Velocity X=\"0\" Y=\"0\" Z=\"0\" />"
+			<< "<AtOrientation X=\"" << -sin(a) << "\" Y=\"0\" Z=\"" << cos(a) << "\" />"
+			<< "<UpOrientation X=\"0\" Y=\"1\" Z=\"0\" />"
+			<< "<LeftOrientation X=\"" << cos(a) << "\" Y=\"0\" Z=\"" << sin(a) << "\" />";
+
+		x << "<SessionHandle>" << shandle << "</SessionHandle>"
+		  << "<SpeakerPosition>" << pos.str() << "</SpeakerPosition>"
+		  << "<ListenerPosition>" << pos.str() << "</ListenerPosition>";
+	}
+	else if (action == "Session.Connect.1")
+		x << "<SessionHandle>" << shandle << "</SessionHandle>"
+		  << "<AudioMedia>default</AudioMedia>";
+	else if (action.compare(0, 8, "Session.") == 0)
+		x << "<SessionHandle>" << shandle << "</SessionHandle>";
+
+	x << "</Request>" << LOADGEN_XMLMSG_DELIM;
+	return x.str();
+}
+
+void LoadClient::send_(const string& action, int session, int seq)
+{
+	stringstream rid;
+	string msg;
+	{
+		boost::mutex::scoped_lock lk(mutex_);
+
+		rid << ++next_id_;
+		msg = build_(action, rid.str(), session, seq);
+
+		ActionStats& stats = actions_[action];
+		stats.sent++;
+
+		// SLVoice sends no Response for these
+		if (action != "Session.Set3DPosition.1")
+		{
+			InFlight& req = in_flight_[rid.str()];
+			req.action = action;
+			req.session = session;
+			req.sent_at = now_();
+		}
+	}
+
+	sock_.write(msg.c_str(), msg.size());
+}
+
+void LoadClient::wait_replies_(double timeout)
+{
+	boost::mutex::scoped_lock lk(mutex_);
+
+	Time deadline(now_() + boost::posix_time::microseconds((long)(timeout * 1e6)));
+	while (!in_flight_.empty() && !closed_)
+	{
+		if (!cond_.timed_wait(lk, deadline))
+			break;
+	}
+
+	// whatever is left counts as lost
+	for (map<string, InFlight>::iterator it = in_flight_.begin(); it != in_flight_.end(); ++it)
+		actions_[it->second.action].timed_out++;
+	in_flight_.clear();
+}
+
+void LoadClient::wait_event_(const Step& step)
+{
+	unsigned long want = step.count < 0 ? (unsigned long)sessions_ : (unsigned long)step.count;
+
+	boost::mutex::scoped_lock lk(mutex_);
+
+	Time deadline(now_() + boost::posix_time::microseconds((long)(step.rate * 1e6)));
+	while (event_count_(step.name, step.state) < want && !closed_)
+	{
+		if (!cond_.timed_wait(lk, deadline))
+		{
+			cerr << "timed out waiting for " << want << " " << step.name
+				 << (step.state.empty() ? "" : ":" + step.state) << endl;
+			break;
+		}
+	}
+}
+
+void LoadClient::Run(const vector<Step>& steps, double timeout)
+{
+	for (size_t i = 0; i < steps.size() && !closed_; i++)
+	{
+		const Step& step = steps[i];
+
+		if (step.kind == Step::SleepStep)
+		{
+			sleep_usec_(step.count * 1000L);
+			continue;
+		}
+		if (step.kind == Step::WaitStep)
+		{
+			wait_event_(step);
+			continue;
+		}
+
+		{
+			boost::mutex::scoped_lock lk(mutex_);
+			baseline_ = event_states_;
+		}
+
+		bool per_session = (step.name.compare(0, 8, "Session.") == 0);
+		int fanout = per_session ? sessions_ : 1;
+
+		// open loop: the schedule does not slow down when replies do
+		Time start(now_());
+		long n = 0;
+		for (int seq = 0; seq < step.count && !closed_; seq++)
+		{
+			for (int s = 0; s < fanout && !closed_; s++, n++)
+			{
+				if (step.rate > 0.0)
+					sleep_usec_((long)(n * 1e6 / step.rate) - elapsed_usec_(start, now_()));
+
+				try { send_(step.name, per_session ? s : -1, seq); }
+				catch (exception& e)
+				{
+					cerr << "send failed: " << e.what() << endl;
+					return;
+				}
+			}
+		}
+
+		wait_replies_(timeout);
+	}
+}
+
+static long percentile_(const vector<long>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > sorted.size()) rank = sorted.size();
+	return sorted[rank - 1];
+}
+
+void LoadClient::Report(ostream& out, double seconds)
+{
+	boost::mutex::scoped_lock lk(mutex_);
+
+	char line[256];
+
+	out << "\nRequests (latency in msec)\n";
+	sprintf(line, "%-36s %7s %7s %6s %6s %8s %8s %8s %8s\n",
+		"action", "sent", "answer", "fail", "lost", "p50", "p90", "p99", "max");
+	out << line;
+
+	for (map<string, ActionStats>::iterator it = actions_.begin(); it != actions_.end(); ++it)
+	{
+		ActionStats& s = it->second;
+		sort(s.usec.begin(), s.usec.end());
+
+		sprintf(line, "%-36s %7lu %7lu %6lu %6lu %8.3f %8.3f %8.3f %8.3f\n",
+			it->first.c_str(), s.sent, s.answered, s.failed, s.timed_out,
+			percentile_(s.usec, 50) / 1e3, percentile_(s.usec, 90) / 1e3,
+			percentile_(s.usec, 99) / 1e3, (s.usec.empty() ? 0 : s.usec.back()) / 1e3);
+		out << line;
+	}
+
+	out << "\nEvents\n";
+	sprintf(line, "%-36s %7s %10s %10s\n", "type", "count", "per sec", "run/sec");
+	out << line;
+
+	for (map<string, EventStats>::iterator it = events_.begin(); it != events_.end(); ++it)
+	{
+		const EventStats& e = it->second;
+		double span = elapsed_usec_(e.first, e.last) / 1e6;
+
+		// rate while the event was flowing, and averaged over the whole run
+		sprintf(line, "%-36s %7lu %10.1f %10.1f\n", it->first.c_str(), e.count,
+			span > 0.0 ? (e.count - 1) / span : 0.0, seconds > 0.0 ? e.count / seconds : 0.0);
+		out << line;
+	}
+}
+
+//=============================================================================
+static void print_usage_and_exit (char **argv)
+{
+	cout << "usage: " << argv[0] << " [-a <ADDRESS>] [-p <PORT>] [-s <SCRIPT>] [-n <SESSIONS>]\n"
+		 << "       [-S <SIPPORT>] [-t <TIMEOUT>]\n"
+		 << "  -a  address of SLVoice (default 127.0.0.1)\n"
+		 << "  -p  viewer port of SLVoice (default " << loadgen_default_port << ")\n"
+		 << "  -s  load script, see loadgen.cpp for the format (default built in)\n"
+		 << "  -n  concurrent sessions (default 1)\n"
+		 << "  -S  port of the built in SIP stand-in (default " << loadgen_default_sip_port << ")\n"
+		 << "  -t  seconds to wait for outstanding responses after each step (default 10)"
+		 << endl;
+
+	exit (0);
+}
+
+int main (int argc, char **argv)
+{
+	string address ("127.0.0.1");
+	int port (loadgen_default_port);
+	int sip_port (loadgen_default_sip_port);
+	int sessions (1);
+	double timeout (10.0);
+	string script;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string opt (argv[i]);
+		if (opt == "-h" || i + 1 >= argc)
+			print_usage_and_exit (argv);
+
+		string val (argv[++i]);
+		if (opt == "-a") address = val;
+		else if (opt == "-p") port = atoi (val.c_str());
+		else if (opt == "-s") script = val;
+		else if (opt == "-n") sessions = max (1, atoi (val.c_str()));
+		else if (opt == "-S") sip_port = atoi (val.c_str());
+		else if (opt == "-t") timeout = atof (val.c_str());
+		else print_usage_and_exit (argv);
+	}
+
+	vector<Step> steps;
+	if (script.empty())
+	{
+		istringstream in (default_script_);
+		steps = load_script_ (in);
+	}
+	else
+	{
+		ifstream in (script.c_str());
+		if (!in)
+		{
+			cerr << "cannot open " << script << endl;
+			return EXIT_FAILURE;
+		}
+		steps = load_script_ (in);
+	}
+
+	socketsInit ();
+
+	try
+	{
+		SIPStandIn standin (sip_port);
+		boost::thread sipThr (boost::ref (standin));
+
+		// the reader may still be blocked in read() when we are done,
+		// so the client lives as long as the process
+		LoadClient *client = new LoadClient (address, port, sessions, sip_port);
+		boost::thread readThr (boost::ref (*client));
+
+		Time start (now_());
+		client->Run (steps, timeout);
+		double seconds = elapsed_usec_(start, now_()) / 1e6;
+
+		cout << "ran " << steps.size () << " steps with " << sessions
+			 << " session(s) in " << seconds << " s" << endl;
+		client->Report (cout, seconds);
+
+		cout << "\nSIP stand-in: " << standin.registers << " REGISTER, "
+			 << standin.invites << " INVITE, " << standin.byes << " BYE, "
+			 << standin.others << " other, " << standin.rtp_packets << " RTP packets" << endl;
+
+		standin.Stop ();
+		sipThr.join ();
+	}
+	catch (exception& e)
+	{
+		cerr << argv[0] << " failed due to " << e.what() << endl;
+		socketsEnd ();
+		return EXIT_FAILURE;
+	}
+
+	socketsEnd ();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,333 @@
+/* sipecho.cpp -- loopback SIP registrar and echo server
+ *
+ *			Copyright 2009, 3di.jp Inc
+ *
+ * A small SIP UAS built on pjsua for benchmarking the media path of
+ * SLVoice on one machine, without an Asterisk or FreeSWITCH instance.
+ *
+ *  - every REGISTER is accepted with a 200 OK (no authentication), the
+ *    Contact and Expires of the request are copied into the response
+ *  - every INVITE is answered with 200 OK
+ *  - the audio of each call is sent straight back to the caller (echo),
+ *    or a continuous 440 Hz tone is played to it instead (-m tone)
+ *
+ * With -s tcp it takes SIP over TCP on the same port as well, for
+ * slvoice_callbench -s tcp.
+ *
+ * The null sound device is used, so no sound card is needed. On exit
+ * (Ctrl-C) the number of registrations and calls and the CPU used per
+ * call are printed. slvoice_callbench is the client side.
+ */
+
+#include <pjsua-lib/pjsua.h>
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+const int sipecho_default_port (5062);
+const int sipecho_default_rtp_port (4100);
+
+static bool tone_mode_ = false;
+static pjsua_conf_port_id tone_slot_ = PJSUA_INVALID_ID;
+
+// updated from the pjsua worker thread only
+static unsigned long registers_ = 0;
+static unsigned long calls_ = 0;
+static unsigned long active_ = 0;
+static unsigned long peak_active_ = 0;
+static double call_usec_ = 0.0;			// summed duration of finished calls
+static pj_timestamp call_start_[PJSUA_MAX_CALLS];
+
+static volatile bool stopped_ = false;
+
+//=============================================================================
+static double process_cpu_usec_()
+{
+#ifdef WIN32
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+
+	// 100 nsec units
+	return (double)(k.QuadPart + u.QuadPart) / 10.0;
+#else
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+static void error_exit_ (const char *title, pj_status_t status)
+{
+	pjsua_perror ("sipecho", title, status);
+	pjsua_destroy ();
+	exit (1);
+}
+
+static void on_signal_ (int)
+{
+	stopped_ = true;
+}
+
+//=============================================================================
+// Registrar: pjsua has no UAS side for REGISTER, so a module in front of
+// it answers them statelessly
+
+static pj_bool_t on_rx_request_ (pjsip_rx_data *rdata)
+{
+	pjsip_msg *msg = rdata->msg_info.msg;
+
+	if (msg->line.req.method.id != PJSIP_REGISTER_METHOD)
+		return PJ_FALSE;
+
+	pjsip_hdr hdr_list;
+	pj_list_init (&hdr_list);
+
+	void *contact = pjsip_msg_find_hdr (msg, PJSIP_H_CONTACT, NULL);
+	if (contact != NULL)
+		pj_list_push_back (&hdr_list, pjsip_hdr_clone (rdata->tp_info.pool, contact));
+
+	void *expires = pjsip_msg_find_hdr (msg, PJSIP_H_EXPIRES, NULL);
+	if (expires != NULL)
+		pj_list_push_back (&hdr_list, pjsip_hdr_clone (rdata->tp_info.pool, expires));
+	else
+		pj_list_push_back (&hdr_list, pjsip_expires_hdr_create (rdata->tp_info.pool, 3600));
+
+	pjsip_endpt_respond_stateless (pjsua_get_pjsip_endpt (), rdata, 200, NULL, &hdr_list, NULL);
+	registers_++;
+
+	return PJ_TRUE;
+}
+
+static pjsip_module mod_registrar_ =
+{
+	NULL, NULL,							// prev, next
+	{ (char*)"mod-sipecho-registrar", 21 },	// name
+	-1,									// id
+	PJSIP_MOD_PRIORITY_APPLICATION,		// priority
+	NULL, NULL, NULL, NULL,				// load, start, stop, unload
+	&on_rx_request_,					// on_rx_request
+	NULL, NULL, NULL, NULL				// on_rx_response, on_tx_*, on_tsx_state
+};
+
+//=============================================================================
+// Calls
+
+static void on_incoming_call_ (pjsua_acc_id acc_id, pjsua_call_id call_id,
+                               pjsip_rx_data *rdata)
+{
+	pjsua_call_answer (call_id, 200, NULL, NULL);
+}
+
+static void on_call_state_ (pjsua_call_id call_id, pjsip_event *e)
+{
+	pjsua_call_info ci;
+	pjsua_call_get_info (call_id, &ci);
+
+	if (ci.state == PJSIP_INV_STATE_CONFIRMED)
+	{
+		pj_get_timestamp (&call_start_[call_id]);
+
+		calls_++;
+		if (++active_ > peak_active_)
+			peak_active_ = active_;
+	}
+	else if (ci.state == PJSIP_INV_STATE_DISCONNECTED && call_start_[call_id].u64 != 0)
+	{
+		pj_timestamp now;
+		pj_get_timestamp (&now);
+
+		call_usec_ += pj_elapsed_usec (&call_start_[call_id], &now);
+		call_start_[call_id].u64 = 0;
+		active_--;
+	}
+}
+
+static void on_call_media_state_ (pjsua_call_id call_id)
+{
+	pjsua_call_info ci;
+	pjsua_call_get_info (call_id, &ci);
+
+	if (ci.media_status != PJSUA_CALL_MEDIA_ACTIVE)
+		return;
+
+	if (tone_mode_)
+		pjsua_conf_connect (tone_slot_, ci.conf_slot);
+	else
+		pjsua_conf_connect (ci.conf_slot, ci.conf_slot);
+}
+
+//=============================================================================
+static void start_tone_ ()
+{
+	pj_status_t status;
+	pjmedia_port *tone;
+	pj_pool_t *pool = pjsua_pool_create ("sipecho", 1000, 1000);
+
+	status = pjmedia_tonegen_create (pool, PJSUA_DEFAULT_CLOCK_RATE, 1,
+		PJSUA_DEFAULT_CLOCK_RATE * PJSUA_DEFAULT_AUDIO_FRAME_PTIME / 1000,
+		16, 0, &tone);
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error creating tone generator", status);
+
+	pjmedia_tone_desc desc;
+	desc.freq1 = 440;
+	desc.freq2 = 0;
+	desc.on_msec = 1000;
+	desc.off_msec = 0;
+	desc.volume = 0;
+	desc.flags = 0;
+
+	pjmedia_tonegen_play (tone, 1, &desc, PJMEDIA_TONEGEN_LOOP);
+
+	status = pjsua_conf_add_port (pool, tone, &tone_slot_);
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error adding tone generator", status);
+}
+
+//=============================================================================
+static void print_usage_and_exit (char **argv)
+{
+	cout << "usage: " << argv[0] << " [-p <PORT>] [-r <RTPPORT>] [-m echo|tone] [-s udp|tcp]\n"
+		 << "  -p  SIP port to listen on (default " << sipecho_default_port << ")\n"
+		 << "  -r  first RTP port (default " << sipecho_default_rtp_port << ")\n"
+		 << "  -m  echo the caller's audio back (default) or play a tone\n"
+		 << "  -s  tcp also listens for SIP over TCP (default udp only)"
+		 << endl;
+
+	exit (0);
+}
+
+int main (int argc, char **argv)
+{
+	int port (sipecho_default_port);
+	int rtp_port (sipecho_default_rtp_port);
+	bool tcp (false);
+
+	for (int i = 1; i < argc; i++)
+	{
+		string opt (argv[i]);
+		if (opt == "-h" || i + 1 >= argc)
+			print_usage_and_exit (argv);
+
+		string val (argv[++i]);
+		if (opt == "-p") port = atoi (val.c_str());
+		else if (opt == "-r") rtp_port = atoi (val.c_str());
+		else if (opt == "-m" && (val == "echo" || val == "tone")) tone_mode_ = (val == "tone");
+		else if (opt == "-s" && (val == "udp" || val == "tcp")) tcp = (val == "tcp");
+		else print_usage_and_exit (argv);
+	}
+
+	pj_status_t status;
+
+	status = pjsua_create ();
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error in pjsua_create()", status);
+
+	pjsua_config cfg;
+	pjsua_config_default (&cfg);
+	cfg.max_calls = PJSUA_MAX_CALLS;
+	cfg.cb.on_incoming_call = &on_incoming_call_;
+	cfg.cb.on_call_state = &on_call_state_;
+	cfg.cb.on_call_media_state = &on_call_media_state_;
+
+	pjsua_logging_config lcfg;
+	pjsua_logging_config_default (&lcfg);
+	lcfg.console_level = 1;
+
+	pjsua_media_config mcfg;
+	pjsua_media_config_default (&mcfg);
+
+	status = pjsua_init (&cfg, &lcfg, &mcfg);
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error in pjsua_init()", status);
+
+	status = pjsip_endpt_register_module (pjsua_get_pjsip_endpt (), &mod_registrar_);
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error registering the registrar module", status);
+
+	pjsua_transport_config tcfg;
+	pjsua_transport_config_default (&tcfg);
+	tcfg.port = port;
+
+	pjsua_transport_id tid;
+	status = pjsua_transport_create (PJSIP_TRANSPORT_UDP, &tcfg, &tid);
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error creating transport", status);
+
+	// incoming calls are taken by the transport's local account
+	status = pjsua_acc_add_local (tid, PJ_TRUE, NULL);
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error adding local account", status);
+
+	if (tcp)
+	{
+		status = pjsua_transport_create (PJSIP_TRANSPORT_TCP, &tcfg, &tid);
+		if (status != PJ_SUCCESS)
+			error_exit_ ("Error creating TCP transport", status);
+
+		status = pjsua_acc_add_local (tid, PJ_FALSE, NULL);
+		if (status != PJ_SUCCESS)
+			error_exit_ ("Error adding local TCP account", status);
+	}
+
+	// keep clear of the RTP ports of SLVoice on the same machine
+	pjsua_transport_config rtpcfg;
+	pjsua_transport_config_default (&rtpcfg);
+	rtpcfg.port = rtp_port;
+
+	status = pjsua_media_transports_create (&rtpcfg);
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error creating media transports", status);
+
+	status = pjsua_start ();
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error starting pjsua", status);
+
+	status = pjsua_set_null_snd_dev ();
+	if (status != PJ_SUCCESS)
+		error_exit_ ("Error setting the null sound device", status);
+
+	if (tone_mode_)
+		start_tone_ ();
+
+	signal (SIGINT, on_signal_);
+	signal (SIGTERM, on_signal_);
+
+	cout << "sipecho listening on " << (tcp ? "UDP and TCP" : "UDP") << " port " << port << ", "
+		 << (tone_mode_ ? "playing a tone" : "echoing audio") << ", Ctrl-C to stop" << endl;
+
+	double cpu_start = process_cpu_usec_ ();
+
+	while (!stopped_)
+		pj_thread_sleep (200);
+
+	double cpu = process_cpu_usec_ () - cpu_start;
+
+	cout << "\n" << registers_ << " REGISTER, " << calls_ << " calls, "
+		 << peak_active_ << " at most at once, " << active_ << " still up" << endl;
+	cout << "CPU " << cpu / 1e6 << " s";
+	if (call_usec_ > 0.0)
+		cout << ", " << cpu / call_usec_ * 100.0 << "% of a core per finished call";
+	cout << endl;
+
+	pjsua_destroy ();
+
+	return EXIT_SUCCESS;
+}
@@ -6,6 +6,51 @@
 #include "main.h"
 #include "config.hpp"
 
+//=============================================================================
+// balanced is what pjsua does by default. low-latency halves the frames
+// and packets and keeps the sound device and jitter buffers short, at the
+// cost of twice the packets and wakeups and of audio that breaks up
+// sooner on a poor network. low-cpu runs the bridge narrowband, sends
+// 40 msec packets and has no echo canceller, so it wants a headset.
+
+static const MediaProfile media_profiles_[] =
+{
+	//  name           clock  frame ptime  rec play  jb: init min max  max   ec  thr q
+	{ "low-latency",   16000, 10,   10,    20,  40,      20,  10, 60, 240, 100, 1, 8 },
+	{ "balanced",      16000, 20,   0,     100, 140,     -1,  -1, -1, -1,  200, 1, 8 },
+	{ "low-cpu",       8000,  20,   40,    100, 160,     -1,  -1, -1, -1,  0,   1, 4 },
+};
+
+const MediaProfile* find_media_profile(const string& name)
+{
+	for (size_t i = 0; i < sizeof(media_profiles_) / sizeof(media_profiles_[0]); i++)
+	{
+		if (name == media_profiles_[i].name)
+			return &media_profiles_[i];
+	}
+
+	return NULL;
+}
+
+//=============================================================================
+// a comma separated list, blanks around the items dropped
+static vector<string> split_list_(const string& value)
+{
+	vector<string> items;
+
+	stringstream list(value);
+	string item;
+	while (getline(list, item, ','))
+	{
+		size_t begin = item.find_first_not_of(" \t\r\n");
+		size_t end = item.find_last_not_of(" \t\r\n");
+		if (begin != string::npos)
+			items.push_back(item.substr(begin, end - begin + 1));
+	}
+
+	return items;
+}
+
 void Config::LoadConfig(string configFilePath)
 {
 	ConfigFilePath = configFilePath;
@@ -61,19 +106,403 @@ void Config::LoadConfig(string configFilePath)
 			Realm = value;
 		}
 
-		// Codec
+		// Codec, a comma separated list in order of preference
 		value = get_value("Codec");
 		if (value != "")
 		{
-			Codec = value;
+			Codecs = split_list_(value);
 		}
 
 		// Disable other codecs
 		value = get_value("Disable");
 		DisableOtherCodecs = (value.compare("true") == 0);
+
+		// Metrics
+		value = get_value("Metrics");
+		EnableMetrics = (value.compare("true") == 0);
+
+		// MetricsPort
+		value = get_value("MetricsPort");
+		if (value != "")
+		{
+			MetricsPort = atoi(value.c_str());
+		}
+
+		// SIPBackend
+		value = get_value("SIPBackend");
+		if (value != "")
+		{
+			SIPBackend = value;
+		}
+
+		// Fake backend timing
+		value = get_value("FakeRegisterDelay");
+		if (value != "")
+		{
+			FakeRegisterDelay = atoi(value.c_str());
+		}
+
+		value = get_value("FakeRingDelay");
+		if (value != "")
+		{
+			FakeRingDelay = atoi(value.c_str());
+		}
+
+		value = get_value("FakeAnswerDelay");
+		if (value != "")
+		{
+			FakeAnswerDelay = atoi(value.c_str());
+		}
+
+		// Spatial audio
+		value = get_value("SpatialAudio");
+		SpatialAudio = (value.compare("true") == 0);
+
+		value = get_value("SpatialMinDistance");
+		if (value != "")
+		{
+			SpatialMinDistance = (float)atof(value.c_str());
+		}
+
+		value = get_value("SpatialMaxDistance");
+		if (value != "")
+		{
+			SpatialMaxDistance = (float)atof(value.c_str());
+		}
+
+		value = get_value("SpatialCulling");
+		if (value != "")
+		{
+			SpatialCulling = (value.compare("true") == 0);
+		}
+
+		value = get_value("SpatialQuietLevel");
+		if (value != "")
+		{
+			SpatialQuietLevel = atoi(value.c_str());
+		}
+
+		value = get_value("SIMDMixer");
+		if (value != "")
+		{
+			SIMDMixer = (value.compare("true") == 0);
+		}
+
+		value = get_value("SpeakingOnLevel");
+		if (value != "")
+		{
+			SpeakingOnLevel = atoi(value.c_str());
+		}
+
+		value = get_value("SpeakingOffLevel");
+		if (value != "")
+		{
+			SpeakingOffLevel = atoi(value.c_str());
+		}
+
+		value = get_value("ParticipantEnergyDelta");
+		if (value != "")
+		{
+			ParticipantEnergyDelta = (float)atof(value.c_str());
+		}
+
+		value = get_value("ParticipantHeartbeat");
+		if (value != "")
+		{
+			ParticipantHeartbeat = atoi(value.c_str());
+		}
+
+		value = get_value("VADMode");
+		if (value != "")
+		{
+			VADMode = atoi(value.c_str());
+		}
+
+		value = get_value("MediaProfile");
+		if (value != "")
+		{
+			MediaProfile = value;
+		}
+
+		value = get_value("MaxCalls");
+		if (value != "")
+		{
+			MaxCalls = max(1, atoi(value.c_str()));
+		}
+
+		value = get_value("MediaMux");
+		if (value != "")
+		{
+			MediaMux = (value.compare("true") == 0);
+		}
+
+		value = get_value("MediaMuxPort");
+		if (value != "")
+		{
+			MediaMuxPort = atoi(value.c_str());
+		}
+
+		value = get_value("MediaMuxBatch");
+		if (value != "")
+		{
+			MediaMuxBatch = atoi(value.c_str());
+		}
+
+		value = get_value("SIPPort");
+		if (value != "")
+		{
+			SIPPort = atoi(value.c_str());
+		}
+
+		value = get_value("SIPPortRange");
+		if (value != "")
+		{
+			SIPPortRange = max(1, atoi(value.c_str()));
+		}
+
+		value = get_value("RTPPort");
+		if (value != "")
+		{
+			RTPPort = atoi(value.c_str());
+		}
+
+		value = get_value("RTPPortRange");
+		if (value != "")
+		{
+			RTPPortRange = max(2, atoi(value.c_str()));
+		}
+
+		value = get_value("PortStride");
+		if (value != "")
+		{
+			PortStride = max(1, atoi(value.c_str()));
+		}
+
+		value = get_value("SIPTransport");
+		if (value != "")
+		{
+			SIPTransport = value;
+		}
+
+		value = get_value("SIPKeepAlive");
+		if (value != "")
+		{
+			SIPKeepAlive = max(0, atoi(value.c_str()));
+		}
+
+		value = get_value("SIPTLSCAFile");
+		if (value != "")
+		{
+			SIPTLSCAFile = value;
+		}
+
+		value = get_value("SIPTLSNoVerify");
+		if (value != "")
+		{
+			SIPTLSNoVerify = (value.compare("true") == 0);
+		}
+
+		value = get_value("QualityInterval");
+		if (value != "")
+		{
+			QualityInterval = max(0, atoi(value.c_str()));
+		}
+
+		value = get_value("QualityEvents");
+		if (value != "")
+		{
+			QualityEvents = (value.compare("true") == 0);
+		}
+
+		// AdaptiveCodecs, as Codec
+		value = get_value("AdaptiveCodecs");
+		if (value != "")
+		{
+			AdaptiveCodecs = split_list_(value);
+		}
+
+		value = get_value("AdaptLossHigh");
+		if (value != "")
+		{
+			AdaptLossHigh = (float)atof(value.c_str());
+		}
+
+		value = get_value("AdaptLossLow");
+		if (value != "")
+		{
+			AdaptLossLow = (float)atof(value.c_str());
+		}
+
+		value = get_value("AdaptRttHigh");
+		if (value != "")
+		{
+			AdaptRttHigh = max(0, atoi(value.c_str()));
+		}
+
+		value = get_value("AdaptDownSamples");
+		if (value != "")
+		{
+			AdaptDownSamples = max(1, atoi(value.c_str()));
+		}
+
+		value = get_value("AdaptUpSamples");
+		if (value != "")
+		{
+			AdaptUpSamples = max(1, atoi(value.c_str()));
+		}
+
+		value = get_value("AdaptHoldTime");
+		if (value != "")
+		{
+			AdaptHoldTime = max(0, atoi(value.c_str()));
+		}
+
+		value = get_value("DeviceRefreshInterval");
+		if (value != "")
+		{
+			DeviceRefreshInterval = max(0, atoi(value.c_str()));
+		}
+
+		value = get_value("SplitSoundDevice");
+		if (value != "")
+		{
+			SplitSoundDevice = (value.compare("true") == 0);
+		}
+
+		value = get_value("SoundDevice");
+		if (value != "")
+		{
+			SoundDevice = value;
+		}
+
+		value = get_value("SoundCaptureFile");
+		if (value != "")
+		{
+			SoundCaptureFile = value;
+		}
+
+		value = get_value("SoundRenderFile");
+		if (value != "")
+		{
+			SoundRenderFile = value;
+		}
+
+		value = get_value("CaptureHighPass");
+		if (value != "")
+		{
+			CaptureHighPass = (value.compare("true") == 0);
+		}
+
+		value = get_value("CaptureNoiseSuppression");
+		if (value != "")
+		{
+			CaptureNoiseSuppression = (value.compare("true") == 0);
+		}
+
+		value = get_value("CaptureAGC");
+		if (value != "")
+		{
+			CaptureAGC = (value.compare("true") == 0);
+		}
 	}
 }
 
+//=============================================================================
+// Instance n gets the n-th block of SIPPortRange SIP ports and RTPPortRange
+// RTP ports, the viewer and metrics ports n * PortStride after the first's
+// and a log of its own, SLVoice.3.log for the fourth. Ports of 0, which are
+// any, stay so.
+
+void Config::SetInstance(int n)
+{
+	Instance = n;
+	if (n == 0)
+		return;
+
+	Port += n * PortStride;
+	MetricsPort += n * PortStride;
+
+	if (SIPPort != 0)
+		SIPPort += n * SIPPortRange;
+	RTPPort += n * RTPPortRange;
+	if (MediaMuxPort != 0)
+		MediaMuxPort += n * RTPPortRange;
+
+	stringstream suffix;
+	suffix << "." << n;
+
+	size_t dot = LogFilePath.find_last_of('.');
+	size_t slash = LogFilePath.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		LogFilePath += suffix.str();
+	else
+		LogFilePath.insert(dot, suffix.str());
+}
+
+//=============================================================================
+// The ports SetInstance gives count instances, as blocks of width ports
+// stride apart, are checked against each other two by two.
+
+struct PortBlock
+{
+	const char *name;
+	int first;
+	int width;
+	int stride;
+};
+
+string Config::CheckInstances(int count) const
+{
+	vector<PortBlock> blocks;
+
+	PortBlock viewer = { "Port", Port, 1, PortStride };
+	blocks.push_back(viewer);
+	if (EnableMetrics)
+	{
+		PortBlock metrics = { "MetricsPort", MetricsPort, 1, PortStride };
+		blocks.push_back(metrics);
+	}
+	if (SIPPort != 0)
+	{
+		PortBlock sip = { "SIPPort", SIPPort, SIPPortRange, SIPPortRange };
+		blocks.push_back(sip);
+	}
+	if (MediaMux)
+	{
+		if (MediaMuxPort != 0)
+		{
+			PortBlock mux = { "MediaMuxPort", MediaMuxPort, 2, RTPPortRange };
+			blocks.push_back(mux);
+		}
+	}
+	else
+	{
+		PortBlock rtp = { "RTPPort", RTPPort, RTPPortRange, RTPPortRange };
+		blocks.push_back(rtp);
+	}
+
+	for (size_t a = 0; a < blocks.size(); a++)
+	for (size_t b = a + 1; b < blocks.size(); b++)
+	{
+		for (int i = 0; i < count; i++)
+		for (int j = 0; j < count; j++)
+		{
+			int first_a = blocks[a].first + i * blocks[a].stride;
+			int first_b = blocks[b].first + j * blocks[b].stride;
+
+			if (first_a < first_b + blocks[b].width && first_b < first_a + blocks[a].width)
+			{
+				stringstream error;
+				error << blocks[a].name << " of instance " << i << " and " << blocks[b].name
+					  << " of instance " << j << " overlap at " << max(first_a, first_b);
+				return error.str();
+			}
+		}
+	}
+
+	return "";
+}
+
 //=============================================================================
 string Config::get_value(const string& name)
 {
@@ -8,6 +8,9 @@
 Config *g_config;
 Logger *g_logger;
 
+// latency metrics, NULL unless enabled in SLVoice.xml
+Metrics *g_metrics (NULL);
+
 // global reference to server instance
 // used to send messages from state machine or SIP stack
 Server *glb_server (NULL);
@@ -21,6 +24,80 @@ void dump_to_stdout (TiXmlNode* pParent, unsigned int indent = 0);
 void print_usage_and_exit (char **argv);
 char get_short_option (char *arg);
 
+//=============================================================================
+// --instances starts that many SLVoice processes, each told its number
+// with --instance, and waits for them. Config::SetInstance gives each its
+// own ports and log, so that voice bots can be packed onto one host.
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+static vector<pid_t> glb_instances;
+
+static void stop_instances_ (int sig)
+{
+	for (size_t i = 0; i < glb_instances.size(); i++)
+		kill (glb_instances[i], sig);
+}
+
+static int run_instances_ (char **argv, int count)
+{
+	string overlap = g_config->CheckInstances (count);
+	if (!overlap.empty())
+	{
+		cerr << argv[0] << ": " << overlap << ", not starting " << count << " instances" << endl;
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		stringstream port, instance;
+		port << g_config->Port;
+		instance << i;
+
+		pid_t pid = fork ();
+		if (pid < 0)
+		{
+			cerr << argv[0] << ": could not start instance " << i << endl;
+			break;
+		}
+
+		if (pid == 0)
+		{
+			string p (port.str()), n (instance.str());
+			char *args[] = { argv[0], const_cast<char*>(p.c_str()),
+							 const_cast<char*>("--instance"), const_cast<char*>(n.c_str()), NULL };
+			execvp (argv[0], args);
+			_exit (EXIT_FAILURE);
+		}
+
+		glb_instances.push_back (pid);
+	}
+
+	signal (SIGINT, stop_instances_);
+	signal (SIGTERM, stop_instances_);
+
+	int failed = 0;
+	for (size_t i = 0; i < glb_instances.size(); i++)
+	{
+		int status;
+		pid_t pid;
+
+		// the signals passed on interrupt the wait
+		while ((pid = waitpid (glb_instances[i], &status, 0)) < 0 && errno == EINTR) ;
+
+		if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			failed++;
+	}
+
+	return (failed == 0 && (int)glb_instances.size() == count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
+
 //=============================================================================
 // Main entry point
 int main (int argc, char **argv) {
@@ -36,14 +113,42 @@ int main (int argc, char **argv) {
     g_config = new Config();
 	g_config->LoadConfig("./SLVoice.xml");
 
+	int instances = 0;
+	int instance = 0;
+
     if (argc > 1) {
         if (argv [1][0] != '-')
 			g_config->Port = atoi (argv [1]);
     }
 
+	// anything else is the viewer's, as before
+	for (int i = 1; i + 1 < argc; i++) {
+		string opt (argv[i]);
+
+		if (opt == "--instances")
+			instances = atoi (argv[++i]);
+		else if (opt == "--instance")
+			instance = atoi (argv[++i]);
+	}
+
+#ifndef WIN32
+	if (instances > 0)
+		return run_instances_ (argv, instances);
+#endif
+
+	g_config->SetInstance (instance);
+
+	g_logger = new Logger();
+	g_logger->Init();
+
     try {
 		boost::thread thr(boost::ref(g_eventManager));
 
+		if (g_config->EnableMetrics) {
+			g_metrics = new Metrics();
+			boost::thread metricsThr(MetricsServer(g_config->MetricsPort));
+		}
+
 		glb_server = new Server(g_config->Port);
         glb_server-> Start();
 
@@ -64,6 +169,49 @@ int main (int argc, char **argv) {
 // WinMain
 #ifdef WIN32
 #include <windows.h>
+
+// as run_instances_ above, args being the command line less --instances
+static int run_instances_win_ (const string& args, int count)
+{
+	// with no console to say so, the overlap is only refused
+	if (!g_config->CheckInstances(count).empty())
+		return EXIT_FAILURE;
+
+	char path[MAX_PATH];
+	GetModuleFileNameA(NULL, path, MAX_PATH);
+
+	vector<HANDLE> processes;
+
+	for (int i = 0; i < count && i < MAXIMUM_WAIT_OBJECTS; i++)
+	{
+		stringstream cmd;
+		cmd << "\"" << path << "\" " << args << (args.empty() ? "" : ",") << "--instance=" << i;
+
+		string line (cmd.str());
+		vector<char> buf (line.begin(), line.end());
+		buf.push_back('\0');
+
+		STARTUPINFOA si;
+		PROCESS_INFORMATION pi;
+		ZeroMemory(&si, sizeof(si));
+		si.cb = sizeof(si);
+
+		if (!CreateProcessA(path, &buf[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+			break;
+
+		CloseHandle(pi.hThread);
+		processes.push_back(pi.hProcess);
+	}
+
+	if (!processes.empty())
+		WaitForMultipleObjects((DWORD)processes.size(), &processes[0], TRUE, INFINITE);
+
+	for (size_t i = 0; i < processes.size(); i++)
+		CloseHandle(processes[i]);
+
+	return ((int)processes.size() == count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int APIENTRY WinMain( HINSTANCE hInstance,
                       HINSTANCE hPrevInstance,
                       LPSTR lpCmdLine,
@@ -77,10 +225,17 @@ int APIENTRY WinMain( HINSTANCE hInstance,
         exit(0);
     }
 
+	int instances = 0;
+	int instance = 0;
+	string childArgs;
+
 	char *token = strtok(lpCmdLine, ",");
 	while (token != NULL)
 	{
 		string arg = string(token);
+		if (arg.find("--instances=") != 0)
+			childArgs += (childArgs.empty() ? "" : ",") + arg;
+
 		int eq = arg.find_first_of("=");
 		if (eq > 0)
 		{
@@ -94,10 +249,17 @@ int APIENTRY WinMain( HINSTANCE hInstance,
 			//else if (key == "--loglevel") g_config->LogLevel = value;
 			else if (key == "--version") g_config->Version = atoi(value.c_str());
 			else if (key == "--port") g_config->Port = atoi(value.c_str());
+			else if (key == "--instances") instances = atoi(value.c_str());
+			else if (key == "--instance") instance = atoi(value.c_str());
 		}
 		token = strtok(NULL, ",");
 	}
 
+	if (instances > 0)
+		return run_instances_win_(childArgs, instances);
+
+	g_config->SetInstance(instance);
+
 
 	g_logger = new Logger();
 	g_logger->Init();
@@ -105,17 +267,30 @@ int APIENTRY WinMain( HINSTANCE hInstance,
     g_logger->Terse("MAIN") << "===================== Config =====================" << endl;
     g_logger->Terse("MAIN") << "Version               : " << g_config->Version << endl;
     g_logger->Terse("MAIN") << "Port                  : " << g_config->Port << endl;
+    g_logger->Terse("MAIN") << "Instance              : " << g_config->Instance << endl;
+    g_logger->Terse("MAIN") << "SIPPort               : " << g_config->SIPPort << endl;
+    g_logger->Terse("MAIN") << "RTPPort               : " << g_config->RTPPort << endl;
     g_logger->Terse("MAIN") << "LogLevel              : " << g_config->LogLevel << endl;
     g_logger->Terse("MAIN") << "LogFilePath           : " << g_config->LogFilePath << endl;
     g_logger->Terse("MAIN") << "Realm                 : " << g_config->Realm << endl;
-    g_logger->Terse("MAIN") << "Codec                 : " << g_config->Codec << endl;
+    string codecs;
+    for (size_t i = 0; i < g_config->Codecs.size(); i++)
+        codecs += (i == 0 ? "" : ",") + g_config->Codecs[i];
+    g_logger->Terse("MAIN") << "Codec                 : " << codecs << endl;
     g_logger->Terse("MAIN") << "Disable               : " << g_config->DisableOtherCodecs << endl;
+    g_logger->Terse("MAIN") << "Metrics               : " << g_config->EnableMetrics << endl;
+    g_logger->Terse("MAIN") << "MetricsPort           : " << g_config->MetricsPort << endl;
     g_logger->Terse("MAIN") << "===================== Config =====================" << endl;
 
     try {
 		EventManager evm;
 		boost::thread thr(boost::ref(g_eventManager));
 
+		if (g_config->EnableMetrics) {
+			g_metrics = new Metrics();
+			boost::thread metricsThr(MetricsServer(g_config->MetricsPort));
+		}
+
 		glb_server = new Server(g_config->Port);
         glb_server->Start();
 
@@ -140,8 +315,9 @@ int APIENTRY WinMain( HINSTANCE hInstance,
 //
 void
 print_usage_and_exit (char **argv) {
-    cout << "usage: " << argv[0] << " [<PORT>]" << "\n"
-         << "where <PORT> is the address to communicate with SL viewer."
+    cout << "usage: " << argv[0] << " [<PORT>] [--instances <N>]" << "\n"
+         << "where <PORT> is the address to communicate with SL viewer,\n"
+         << "and <N> instances are started on <PORT> and the ports after it."
          << endl;
 
     exit (0);
@@ -6,13 +6,16 @@
 #include <main.h>
 #include <state.hpp>
 
+#include <boost/cstdint.hpp>
+
 string BaseManager::registHandle(BaseInfo* baseInfo) {
 
 	string ret;
 	stringstream ss;
 
 	try {
-		ss << hex << (unsigned int)baseInfo;
+		// the whole pointer: long is 32 bits on Win64
+		ss << hex << (boost::uintptr_t)baseInfo;
 
 		baseInfo->handle = ss.str();
 		infos.insert(pair<string, BaseInfo*>(baseInfo->handle, baseInfo));
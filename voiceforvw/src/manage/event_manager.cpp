@@ -6,6 +6,12 @@
 #include <main.h>
 
 void BlockingQueue::enqueue(void *data) {
+	// the server stamps its events when it parses them, the SIP callbacks
+	// and the state machines leave that to here
+	Event *ev = (Event*)data;
+	if (ev != NULL && g_metrics != NULL && ev->enqueued_at.is_not_a_date_time())
+		ev->enqueued_at = metrics_now();
+
 	_lock lk(_mutex);
 	_queue.push(data);
 	_cond.notify_all();
@@ -26,6 +32,25 @@ void* BlockingQueue::dequeue() {
 	return ret;
 }
 
+void* BlockingQueue::dequeue(unsigned int timeout_ms) {
+	void *ret = NULL;
+
+	boost::system_time until = boost::get_system_time()
+		+ boost::posix_time::milliseconds(timeout_ms);
+
+	_lock lk(_mutex);
+
+	while (_queue.size() == 0) {
+		if (!_cond.timed_wait(lk, until))
+			return NULL;
+	}
+
+	ret = _queue.front();
+	_queue.pop();
+
+	return ret;
+}
+
 void EventManager::operator()() 
 {
 	pj_thread_init();
@@ -44,80 +69,12 @@ void EventManager::operator()()
 		g_logger->Warn("EventManager") << "Thread already registered" << endl;
 	}
 
-	pj_status_t status;
-	pj_caching_pool cp;
-	pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
-	pjmedia_aud_subsys_init(&cp.factory);
-
-	unsigned int devcount = pjmedia_aud_dev_count();
-	pjmedia_aud_dev_info info;
-
-	g_logger->Debug("AudioDevices") << "Audio device count " << devcount << endl;
-	
-	for(unsigned int i = 0; i < devcount; i++)
-	{
-		status = pjmedia_aud_dev_get_info((pjmedia_aud_dev_index)i, &info);
-		if (status != PJ_SUCCESS)
-		{
-			g_logger->Warn("AudioDevices") << "Could not retreive audio device information. {ERROR:" << status << "}" << endl;
-		}
-		else
-		{
-			string devicename = string(info.name);
-			g_logger->Info("AudioDevices") << "Audio device " << i << " name=" << string(info.name) << endl;
-			g_logger->Debug("AudioDevices") << "Properties: CAPS=" << info.caps << " Samplerate=" << info.default_samples_per_sec << " Driver=" << string(info.driver) << endl;
-			g_logger->Debug("AudioDevices") << "Formats=" << info.ext_fmt_cnt << " Inputs=" << info.input_count << " Outputs=" << info.output_count << endl;
-			g_logger->Debug("AudioDevices") << "Routes=" << info.routes << endl;
-			for(int j = 0; j < info.ext_fmt_cnt; j++)
-			{
-				g_logger->Debug("AudioDevices") << "Format(" << j << ")=" << info.ext_fmt[j].id << endl;
-			}
-			g_logger->Debug("AudioDevices") << endl;
-
-			if (info.input_count > 0)
-			{
-				bool supported = false;
-				for (int k = 0; k < info.ext_fmt_cnt; k++)
-				{
-					//if (info.ext_fmt[k].id == PJMEDIA_FORMAT_ULAW || info.ext_fmt[k].id == PJMEDIA_FORMAT_ILBC)
-					if (info.ext_fmt[k].id == PJMEDIA_FORMAT_PCM || info.ext_fmt[k].id == PJMEDIA_FORMAT_PCMU || info.ext_fmt[k].id == PJMEDIA_FORMAT_PCMA)
-					{
-						if (strcmp(info.name, "Wave mapper"))
-							supported = true;
-					}
-				}
-				if (supported)
-				{
-					g_eventManager.CaptureDevices += "<CaptureDevice><Device>" + devicename + "</Device></CaptureDevice>";
-					g_logger->Debug("AudioDevices") << "Supported capture device: " << devicename << endl;
-				}
-			}
-			if (info.output_count > 0)
-			{
-				bool supported = false;
-				for (int l = 0; l < info.ext_fmt_cnt; l++)
-				{
-					//if (info.ext_fmt[l].id == PJMEDIA_FORMAT_ULAW || info.ext_fmt[l].id == PJMEDIA_FORMAT_ILBC)
-					if (info.ext_fmt[l].id == PJMEDIA_FORMAT_PCM || info.ext_fmt[l].id == PJMEDIA_FORMAT_PCMU || info.ext_fmt[l].id == PJMEDIA_FORMAT_PCMA)
-					{
-						if (strcmp(info.name, "Wave mapper"))
-							supported = true;
-					}
-				}
-				if (supported)
-				{
-					g_eventManager.RenderDevices += "<RenderDevice><Device>" + devicename + "</Device></RenderDevice>";
-					g_logger->Debug("AudioDevices") << "Supported render device: " << devicename << endl;
-				}
-			}
-		}
-	}
+	// Aux.Get*Devices wait for the first list, nothing else does
+	boost::thread devicesThr(boost::ref(Devices));
 
 	g_eventManager.CurrentCaptureDevice = "default";
 	g_eventManager.CurrentRenderDevice = "default";
 
-	pjmedia_aud_subsys_shutdown();
-
 	g_logger->Debug("EventManager") << "entering EventManager::operator()()" << endl;
 
 	Event *item = NULL;
@@ -249,6 +206,17 @@ void EventManager::processSession(SessionEvent *ev)
 
 		AccountInfo *accinfo = con->account.find(ev->account_handle);
 
+		if (accinfo != NULL && ev->type == EventType_DialIncoming
+		 && con->session.privateCalls() > 0) {
+
+			// one private call at a time, next to any number of channels
+			g_logger->Info("EventManager") << "Private call in progress, refusing call " << ev->call_id << endl;
+
+			if (accinfo->sipconf != NULL)
+				accinfo->sipconf->Answer(ev->call_id, 486);
+			return;
+		}
+
 		if (accinfo != NULL) {
 
 			// create new session
@@ -261,8 +229,10 @@ void EventManager::processSession(SessionEvent *ev)
 			sinfo->id = ev->call_id;
 			con->session.registId(sinfo->id, sinfo->handle);
 
-			// set incoming user's uri
+			// set incoming user's uri; incoming calls are all private
 			sinfo->incoming_uri = ev->uri;
+			if (ev->type == EventType_DialIncoming)
+				sinfo->session.connectedType = "0";
 		}
 		else 
 		{
@@ -303,6 +273,11 @@ void EventManager::processSession(SessionEvent *ev)
 			info->machine.process_event(*(PositionEvent*)ev);
             break;
 
+        case EventType_Participant:
+			g_logger->Debug("EventManager") << "EventType_Participant" << endl;
+			info->machine.process_event(*(ParticipantEvent*)ev);
+            break;
+
         case EventType_SessionTerminate:
 			g_logger->Debug("EventManager") << "EventType_SessionTerminate" << endl;
 			info->machine.process_event(*(SessionTerminateEvent*)ev);
@@ -362,6 +337,10 @@ void EventManager::eventProc(Event *ev)
 {
 	g_logger->Debug("EventManager") << "entering eventProc()" << endl;
 
+	MetricTime dequeued, reacted, formatted, sent;
+	if (g_metrics != NULL)
+		dequeued = metrics_now();
+
     //******************************************************
     g_logger->Terse("EVENT") << "======= EVENT ======== EventProc " << ev->event_name << endl;
     //******************************************************
@@ -387,6 +366,7 @@ void EventManager::eventProc(Event *ev)
 		// Session Events
 		case EventType_SessionCreate:
         case EventType_Position:
+        case EventType_Participant:
         case EventType_SessionTerminate:
         case EventType_SessionConnect:
         case EventType_DialIncoming:
@@ -404,12 +384,18 @@ void EventManager::eventProc(Event *ev)
             break;
     }
 
+	if (g_metrics != NULL)
+		reacted = metrics_now();
+
 	if (ev->result != NULL) {
 
 		ev->result->ReturnCode = "0";
 
 		string respStr = ev->result->ToString();
 
+		if (g_metrics != NULL)
+			formatted = metrics_now();
+
 		g_logger->Debug("EventManager") << "Deleting response message [" << ev->result << "]" << endl;
 		delete ev->result;
 		ev->result = NULL;
@@ -422,8 +408,14 @@ void EventManager::eventProc(Event *ev)
         { 
             // ignore
         }
+
+		if (g_metrics != NULL)
+			sent = metrics_now();
 	}
 
+	if (g_metrics != NULL)
+		record_metrics_(ev, dequeued, reacted, formatted, sent);
+
 	if (ev->message != NULL) 
 	{
 		g_logger->Debug("EventManager") << "Deleting request message [" << ev->message << "]" << endl;
@@ -439,3 +431,30 @@ void EventManager::eventProc(Event *ev)
 
 	g_logger->Debug("EventManager") << "exiting eventProc()" << endl;
 }
+
+void EventManager::record_metrics_(const Event *ev, const MetricTime& dequeued,
+	const MetricTime& reacted, const MetricTime& formatted, const MetricTime& sent)
+{
+	long queue = metrics_elapsed_usec(ev->enqueued_at, dequeued);
+	long react = metrics_elapsed_usec(dequeued, reacted);
+	long format = metrics_elapsed_usec(reacted, formatted);
+	long send = metrics_elapsed_usec(formatted, sent);
+	long total = metrics_elapsed_usec(ev->received_at, sent);
+
+	g_metrics->RecordEvent(ev->type, MetricStage_Queue, queue);
+	g_metrics->RecordEvent(ev->type, MetricStage_React, react);
+	g_metrics->RecordEvent(ev->type, MetricStage_Format, format);
+	g_metrics->RecordEvent(ev->type, MetricStage_Send, send);
+
+	// events raised by the SIP stack or the state machines have no request
+	if (ev->message != NULL)
+	{
+		ActionType action = ev->message->Type;
+
+		g_metrics->RecordAction(action, MetricStage_Queue, queue);
+		g_metrics->RecordAction(action, MetricStage_React, react);
+		g_metrics->RecordAction(action, MetricStage_Format, format);
+		g_metrics->RecordAction(action, MetricStage_Send, send);
+		g_metrics->RecordAction(action, MetricStage_Total, total);
+	}
+}
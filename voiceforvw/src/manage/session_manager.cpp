@@ -54,3 +54,16 @@ void SessionManager::controlAudioLevel() {
 	}
 }
 
+// private calls, placed or taken, among the sessions: as Join always did,
+// any Type but 1 (a channel), none included
+int SessionManager::privateCalls() {
+
+	int count = 0;
+
+	for (map<string, BaseInfo*>::iterator ite = infos.begin(); ite != infos.end(); ite++) {
+		if (((SessionInfo *)ite->second)->session.connectedType != "1")
+			count++;
+	}
+
+	return count;
+}
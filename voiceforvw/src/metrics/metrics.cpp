@@ -0,0 +1,418 @@
+/* metrics.cpp -- latency metrics module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include "main.h"
+#include "metrics.hpp"
+
+#include <iomanip>
+
+//=============================================================================
+static string action_name_(int action)
+{
+	switch (action)
+	{
+		case AccountLogin1: return AccountLogin1String;
+		case AccountLogout1: return AccountLogout1String;
+		case AuxCaptureAudioStart1: return AuxCaptureAudioStart1String;
+		case AuxCaptureAudioStop1: return AuxCaptureAudioStop1String;
+		case SessionRenderAudioStart1: return SessionRenderAudioStart1String;
+		case SessionRenderAudioStop1: return SessionRenderAudioStop1String;
+		case AuxGetCaptureDevices1: return AuxGetCaptureDevices1String;
+		case AuxGetRenderDevices1: return AuxGetRenderDevices1String;
+		case AuxSetCaptureDevice1: return AuxSetCaptureDevice1String;
+		case AuxSetMicLevel1: return AuxSetMicLevel1String;
+		case AuxSetRenderDevice1: return AuxSetRenderDevice1String;
+		case AuxSetSpeakerLevel1: return AuxSetSpeakerLevel1String;
+		case ConnectorCreate1: return ConnectorCreate1String;
+		case ConnectorInitiateShutdown1: return ConnectorInitiateShutdown1String;
+		case ConnectorMuteLocalMic1: return ConnectorMuteLocalMic1String;
+		case ConnectorMuteLocalSpeaker1: return ConnectorMuteLocalSpeaker1String;
+		case ConnectorSetLocalMicVolume1: return ConnectorSetLocalMicVolume1String;
+		case ConnectorSetLocalSpeakerVolume1: return ConnectorSetLocalSpeakerVolume1String;
+		case SessionCreate1: return SessionCreate1String;
+		case SessionConnect1: return SessionConnect1String;
+		case SessionSet3DPosition1: return SessionSet3DPosition1String;
+		case SessionSetParticipantMuteForMe1: return SessionSetParticipantMuteForMe1String;
+		case SessionSetParticipantVolumeForMe1: return SessionSetParticipantVolumeForMe1String;
+		case SessionTerminate1: return SessionTerminate1String;
+		case AccountBlockListRules1: return AccountBlockListRules1String;
+		case AccountListAutoAcceptRules1: return AccountListAutoAcceptRules1String;
+		case SessionMediaDisconnect1: return SessionMediaDisconnect1String;
+		default: return "None";
+	}
+}
+
+static string event_name_(int event)
+{
+	switch (event)
+	{
+		case EventType_Initialize: return "Initialize";
+		case EventType_Shutdown: return "Shutdown";
+		case EventType_Audio: return "Audio";
+		case EventType_AccountLogin: return "AccountLogin";
+		case EventType_AccountLogout: return "AccountLogout";
+		case EventType_RegSucceed: return "RegSucceed";
+		case EventType_RegFailed: return "RegFailed";
+		case EventType_AccountRemove: return "AccountRemove";
+		case EventType_SessionCreate: return "SessionCreate";
+		case EventType_SessionTerminate: return "SessionTerminate";
+		case EventType_SessionConnect: return "SessionConnect";
+		case EventType_SessionMediaDisconnect: return "SessionMediaDisconnect";
+		case EventType_DialIncoming: return "DialIncoming";
+		case EventType_DialEarly: return "DialEarly";
+		case EventType_DialConnecting: return "DialConnecting";
+		case EventType_DialSucceed: return "DialSucceed";
+		case EventType_DialDisconnected: return "DialDisconnected";
+		case EventType_Position: return "Position";
+		case EventType_SessionRemove: return "SessionRemove";
+		case EventType_Participant: return "Participant";
+		default: return "None";
+	}
+}
+
+static const char* stage_name_[MetricStage_Count] =
+{
+	"parse", "queue", "react", "format", "send", "total"
+};
+
+//=============================================================================
+// LatencyHistogram
+//=============================================================================
+LatencyHistogram::LatencyHistogram()
+	: count_(0), sum_(0), max_(0)
+{
+	fill_n(counts_, (int)BucketCount, 0ULL);
+}
+
+int LatencyHistogram::BucketIndex(long usec)
+{
+	if (usec < 0)
+		usec = 0;
+
+	if (usec < LinearCount)
+		return (int)usec;
+
+	// position of the highest set bit
+	int msb = 0;
+	for (unsigned long v = (unsigned long)usec; v > 1; v >>= 1)
+		msb++;
+
+	// shift so that the top SubBucketBits+1 bits remain, i.e. [16, 31]
+	int exponent = msb - SubBucketBits;
+	if (exponent > MaxExponent)
+		return BucketCount - 1;
+
+	int sub = (int)((unsigned long)usec >> exponent) - SubBucketCount;
+	return LinearCount + (exponent - 1) * SubBucketCount + sub;
+}
+
+long LatencyHistogram::BucketUpperBound(int index)
+{
+	if (index < LinearCount)
+		return index;
+
+	int exponent = (index - LinearCount) / SubBucketCount + 1;
+	long mantissa = (index - LinearCount) % SubBucketCount + SubBucketCount;
+
+	return ((mantissa + 1) << exponent) - 1;
+}
+
+void LatencyHistogram::Record(long usec)
+{
+	if (usec < 0)
+		return;
+
+	int index = BucketIndex(usec);
+
+	boost::mutex::scoped_lock lk(mutex_);
+	counts_[index]++;
+	count_++;
+	sum_ += usec;
+	if (usec > max_)
+		max_ = usec;
+}
+
+unsigned long long LatencyHistogram::Count() const
+{
+	boost::mutex::scoped_lock lk(mutex_);
+	return count_;
+}
+
+unsigned long long LatencyHistogram::Sum() const
+{
+	boost::mutex::scoped_lock lk(mutex_);
+	return sum_;
+}
+
+long LatencyHistogram::Percentile(double p) const
+{
+	boost::mutex::scoped_lock lk(mutex_);
+
+	if (count_ == 0)
+		return 0;
+
+	unsigned long long rank = (unsigned long long)(p / 100.0 * count_ + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > count_) rank = count_;
+
+	unsigned long long seen = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		seen += counts_[i];
+		if (seen >= rank)
+			return min(BucketUpperBound(i), max_);
+	}
+	return max_;
+}
+
+unsigned long long LatencyHistogram::CountBelow(long usec) const
+{
+	boost::mutex::scoped_lock lk(mutex_);
+
+	unsigned long long seen = 0;
+	for (int i = 0; i < BucketCount && BucketUpperBound(i) <= usec; i++)
+		seen += counts_[i];
+	return seen;
+}
+
+//=============================================================================
+// Metrics
+//=============================================================================
+Metrics::Metrics()
+{
+	fill_n(actions_, (int)(ActionCount * MetricStage_Count), (LatencyHistogram*)NULL);
+	fill_n(events_, (int)(EventCount * MetricStage_Count), (LatencyHistogram*)NULL);
+}
+
+Metrics::~Metrics()
+{
+	for (int i = 0; i < ActionCount * MetricStage_Count; i++)
+		delete actions_[i];
+	for (int i = 0; i < EventCount * MetricStage_Count; i++)
+		delete events_[i];
+}
+
+LatencyHistogram* Metrics::get_(LatencyHistogram **table, int key, MetricStage stage)
+{
+	boost::mutex::scoped_lock lk(mutex_);
+
+	// histograms are created on first use; most (action, stage) pairs never occur
+	LatencyHistogram **slot = &table[key * MetricStage_Count + stage];
+	if (*slot == NULL)
+		*slot = new LatencyHistogram();
+
+	return *slot;
+}
+
+void Metrics::RecordAction(int action, MetricStage stage, long usec)
+{
+	if (action <= None || action >= ActionCount || usec < 0)
+		return;
+	get_(actions_, action, stage)->Record(usec);
+}
+
+void Metrics::RecordEvent(int event, MetricStage stage, long usec)
+{
+	if (event <= EventType_None || event >= EventCount || usec < 0)
+		return;
+	get_(events_, event, stage)->Record(usec);
+}
+
+void Metrics::SetCallQuality(const string& session, const CallQuality& quality)
+{
+	boost::mutex::scoped_lock lk(mutex_);
+	calls_[session] = quality;
+}
+
+void Metrics::RemoveCallQuality(const string& session)
+{
+	boost::mutex::scoped_lock lk(mutex_);
+	calls_.erase(session);
+}
+
+void Metrics::RecordDeviceSwitch(bool capture, long usec)
+{
+	if (usec < 0)
+		return;
+	switches_[capture ? 0 : 1].Record(usec);
+}
+
+// usec as seconds, all six decimals of them
+static string seconds_(long usec)
+{
+	stringstream ss;
+	ss << usec / 1000000 << "." << setw(6) << setfill('0') << usec % 1000000;
+	return ss.str();
+}
+
+// Prometheus wants seconds; buckets are every power of two of the
+// underlying histogram so that the exposition stays small. Their le is
+// the last microsecond of a histogram bucket, 2^n - 1, so that le counts
+// every sample up to it and none above, as Prometheus has it.
+static void format_buckets_(stringstream& out, const string& metric, const string& labels,
+	const LatencyHistogram& h)
+{
+	for (int n = 4; n <= 24; n++)
+	{
+		long le = (1L << n) - 1;
+		out << metric << "_bucket{" << labels << ",le=\"" << seconds_(le) << "\"} "
+			<< h.CountBelow(le) << "\n";
+	}
+	out << metric << "_bucket{" << labels << ",le=\"+Inf\"} " << h.Count() << "\n";
+	out << metric << "_sum{" << labels << "} " << (double)h.Sum() / 1e6 << "\n";
+	out << metric << "_count{" << labels << "} " << h.Count() << "\n";
+}
+
+void Metrics::format_(stringstream& out, LatencyHistogram **table, int count,
+	const string& metric, const string& label, string (*name)(int), bool quantiles)
+{
+	static const double q[] = { 50.0, 90.0, 99.0, 99.9 };
+
+	vector<pair<string, LatencyHistogram*> > series;
+	{
+		boost::mutex::scoped_lock lk(mutex_);
+		for (int k = 0; k < count; k++)
+		{
+			for (int s = 0; s < MetricStage_Count; s++)
+			{
+				LatencyHistogram *h = table[k * MetricStage_Count + s];
+				if (h != NULL)
+					series.push_back(make_pair(label + "=\"" + name(k) + "\",stage=\"" + stage_name_[s] + "\"", h));
+			}
+		}
+	}
+
+	for (size_t i = 0; i < series.size(); i++)
+	{
+		const string& labels = series[i].first;
+		const LatencyHistogram& h = *series[i].second;
+
+		if (quantiles)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				out << metric << "{" << labels << ",quantile=\"" << q[j] / 100.0 << "\"} "
+					<< (double)h.Percentile(q[j]) / 1e6 << "\n";
+			}
+			continue;
+		}
+
+		format_buckets_(out, metric, labels, h);
+	}
+}
+
+string Metrics::ToPrometheus()
+{
+	stringstream out;
+
+	out << "# HELP slvoice_request_latency_seconds Viewer request latency per action and stage\n"
+		<< "# TYPE slvoice_request_latency_seconds histogram\n";
+	format_(out, actions_, ActionCount, "slvoice_request_latency_seconds", "action", action_name_, false);
+
+	out << "# HELP slvoice_request_latency_quantile_seconds Viewer request latency percentiles\n"
+		<< "# TYPE slvoice_request_latency_quantile_seconds gauge\n";
+	format_(out, actions_, ActionCount, "slvoice_request_latency_quantile_seconds", "action", action_name_, true);
+
+	out << "# HELP slvoice_event_latency_seconds EventManager latency per event type and stage\n"
+		<< "# TYPE slvoice_event_latency_seconds histogram\n";
+	format_(out, events_, EventCount, "slvoice_event_latency_seconds", "event", event_name_, false);
+
+	out << "# HELP slvoice_event_latency_quantile_seconds EventManager latency percentiles\n"
+		<< "# TYPE slvoice_event_latency_quantile_seconds gauge\n";
+	format_(out, events_, EventCount, "slvoice_event_latency_quantile_seconds", "event", event_name_, true);
+
+	out << "# HELP slvoice_device_switch_gap_seconds Silence of a sound device switch per direction\n"
+		<< "# TYPE slvoice_device_switch_gap_seconds histogram\n";
+	format_buckets_(out, "slvoice_device_switch_gap_seconds", "direction=\"capture\"", switches_[0]);
+	format_buckets_(out, "slvoice_device_switch_gap_seconds", "direction=\"render\"", switches_[1]);
+
+	map<string, CallQuality> calls;
+	{
+		boost::mutex::scoped_lock lk(mutex_);
+		calls = calls_;
+	}
+
+	// msec are turned into seconds
+	static const struct
+	{
+		const char *name;
+		const char *type;
+		const char *help;
+		unsigned CallQuality::*field;
+		double scale;
+	} series[] =
+	{
+		{ "slvoice_call_rx_packets_total", "counter", "RTP packets received per session", &CallQuality::rx_packets, 1.0 },
+		{ "slvoice_call_rx_lost_total", "counter", "RTP packets that never arrived per session", &CallQuality::rx_lost, 1.0 },
+		{ "slvoice_call_tx_lost_total", "counter", "RTP packets the remote reports lost per session", &CallQuality::tx_lost, 1.0 },
+		{ "slvoice_call_jitter_seconds", "gauge", "Mean interarrival jitter per session", &CallQuality::jitter_ms, 1e-3 },
+		{ "slvoice_call_rtt_seconds", "gauge", "Last RTCP round trip time per session", &CallQuality::rtt_ms, 1e-3 },
+		{ "slvoice_call_jitter_buffer_frames", "gauge", "Frames in the jitter buffer per session", &CallQuality::jb_frames, 1.0 },
+		{ "slvoice_call_jitter_buffer_prefetch_frames", "gauge", "Jitter buffer prefetch per session", &CallQuality::jb_prefetch, 1.0 },
+		{ "slvoice_call_concealed_frames_total", "counter", "Frames concealed for lack of a packet per session", &CallQuality::plc_frames, 1.0 },
+	};
+
+	for (size_t k = 0; k < sizeof(series) / sizeof(series[0]); k++)
+	{
+		out << "# HELP " << series[k].name << " " << series[k].help << "\n"
+			<< "# TYPE " << series[k].name << " " << series[k].type << "\n";
+
+		for (map<string, CallQuality>::const_iterator ite = calls.begin(); ite != calls.end(); ++ite)
+		{
+			out << series[k].name << "{session=\"" << ite->first << "\"} "
+				<< ite->second.*series[k].field * series[k].scale << "\n";
+		}
+	}
+
+	return out.str();
+}
+
+//=============================================================================
+// MetricsServer
+//=============================================================================
+void MetricsServer::operator()()
+{
+	TCPSocketWrapper server;
+
+	try
+	{
+		server.listen("127.0.0.1", port_);
+	}
+	catch (exception& e)
+	{
+		g_logger->Error("METRICS") << "Unable to listen on port " << port_ << ": " << e.what() << endl;
+		return;
+	}
+
+	g_logger->Info("METRICS") << "Metrics endpoint listening on 127.0.0.1:" << port_ << endl;
+
+	for (;;)
+	{
+		try
+		{
+			TCPSocketWrapper sock(server.accept());
+
+			// the request itself is not interesting, only drain what has arrived
+			char buf[1024];
+			sock.read(buf, sizeof(buf));
+
+			string body = g_metrics->ToPrometheus();
+			stringstream ss;
+			ss << "HTTP/1.0 200 OK\r\n"
+			   << "Content-Type: text/plain; version=0.0.4\r\n"
+			   << "Content-Length: " << body.size() << "\r\n"
+			   << "Connection: close\r\n\r\n"
+			   << body;
+
+			string resp = ss.str();
+			sock.write(resp.c_str(), resp.size());
+			sock.close();
+		}
+		catch (exception& e)
+		{
+			g_logger->Warn("METRICS") << "Metrics request failed: " << e.what() << endl;
+		}
+	}
+}
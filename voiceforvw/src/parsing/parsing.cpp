@@ -46,9 +46,22 @@ void
 RequestParser::parse_vector_ (const TiXmlElement *vector, float buf [3])
 {
     fill_n (buf, 3, 0.0f);
+    if (!vector)
+        return;
+
+    // <Position X=".." Y=".." Z=".."/> as well as the viewer's
+    // <Position><X>..</X><Y>..</Y><Z>..</Z></Position>
     vector-> QueryFloatAttribute ("X", buf + 0);
     vector-> QueryFloatAttribute ("Y", buf + 1);
     vector-> QueryFloatAttribute ("Z", buf + 2);
+
+    static const char *axes[3] = { "X", "Y", "Z" };
+    for (int i = 0; i < 3; i++)
+    {
+        const TiXmlElement *axis (vector-> FirstChildElement (axes[i]));
+        if (axis && axis-> GetText ())
+            buf[i] = (float) atof (axis-> GetText ());
+    }
 }
 
 //=============================================================================
@@ -214,6 +227,10 @@ RequestParser::parse_ConnectorCreate_ ()
     //req-> MinimumPort = get_root_text_ ("MinimumPort");
     //req-> MaximumPort = get_root_text_ ("MaximumPort");
 
+	// there is no server when parsing outside of SLVoice (e.g. in the benchmarks)
+	if (glb_server == NULL)
+		return auto_ptr <const Request> (req);
+
 	// Check if VoiceServerURI is defined via config file
 	// This is for SLViewer <1.22 compatility only
 	if (g_config->VoiceServerURI == "")
@@ -329,8 +346,6 @@ RequestParser::parse_SessionSet3DPosition_ ()
 
     const TiXmlElement *speaker, *listener; 
 
-    // TODO: doesnt parse the XML yet
-
 	req-> SessionHandle = get_root_text_ ("SessionHandle");
 
     speaker = get_root_element_ ("SpeakerPosition");
@@ -340,6 +355,9 @@ RequestParser::parse_SessionSet3DPosition_ ()
     listener = get_root_element_ ("ListenerPosition");
     if (!listener)
         throw parse_error ("cannot parse listener position");
+
+    req-> speaker = parse_voice_orientation_ (speaker);
+    req-> listener = parse_voice_orientation_ (listener);
         
     return auto_ptr <const Request> (req);
 }
@@ -801,7 +819,7 @@ string AuxGetCaptureDevicesResponse::ToString()
 			+ "<ReturnCode>" + ReturnCode + "</ReturnCode>"
 			+ "<Results><StatusCode>" + (StatusCode.empty() ? "0" : StatusCode) + "</StatusCode>"
 			+ "<StatusString>" + (StatusString.empty() ? "OK" : StatusString) + "</StatusString>"
-			+ "<CaptureDevices>" + g_eventManager.CaptureDevices + "</CaptureDevices>"
+			+ "<CaptureDevices>" + g_eventManager.Devices.CaptureDevicesXml() + "</CaptureDevices>"
 			+ "<CurrentCaptureDevice><Device>" + g_eventManager.CurrentCaptureDevice + "</Device></CurrentCaptureDevice>"
 			+"</Results>"
 			+ "<InputXml>" + InputXml + "</InputXml></Response>\n\n\n";
@@ -895,7 +913,7 @@ string AuxGetRenderDevicesResponse::ToString()
 			+ "<Results><StatusCode>" + (StatusCode.empty() ? "0" : StatusCode) + "</StatusCode>"
 			+ "<StatusString>" + (StatusString.empty() ? "OK" : StatusString) + "</StatusString>"
 
-			+ "<RenderDevices>" + g_eventManager.RenderDevices + "</RenderDevices>"
+			+ "<RenderDevices>" + g_eventManager.Devices.RenderDevicesXml() + "</RenderDevices>"
 			+ "<CurrentRenderDevice><Device>" + g_eventManager.CurrentRenderDevice + "</Device></CurrentRenderDevice>"
 
 			+ "</Results>"
@@ -1002,6 +1020,26 @@ string ParticipantPropertiesEvent::ToString()
 	return retval;
 }
 
+string SessionMediaQualityEvent::ToString()
+{
+	string retval;
+
+	retval  = "<Event type=\"" + type + "\">"
+			+ "<SessionHandle>" + SessionHandle + "</SessionHandle>"
+			+ "<PacketsReceived>" + PacketsReceived + "</PacketsReceived>"
+			+ "<PacketsLost>" + PacketsLost + "</PacketsLost>"
+			+ "<PacketLoss>" + PacketLoss + "</PacketLoss>"
+			+ "<RemotePacketsLost>" + RemotePacketsLost + "</RemotePacketsLost>"
+			+ "<Jitter>" + Jitter + "</Jitter>"
+			+ "<RoundTripTime>" + RoundTripTime + "</RoundTripTime>"
+			+ "<JitterBufferFrames>" + JitterBufferFrames + "</JitterBufferFrames>"
+			+ "<JitterBufferPrefetch>" + JitterBufferPrefetch + "</JitterBufferPrefetch>"
+			+ "<ConcealedFrames>" + ConcealedFrames + "</ConcealedFrames>"
+			+ "</Event>\n\n\n";
+
+	return retval;
+}
+
 string AuxAudioPropertiesEvent::ToString()
 {
 	string retval;
@@ -1054,6 +1092,10 @@ void Request::SetState (Orientation& state) const
 {
 }
 
+void Request::SetState (Orientation& speaker, Orientation& listener) const
+{
+}
+
 
 //=============================================================================
 void 
@@ -1075,69 +1117,24 @@ ConnectorMuteLocalMicRequest::SetState (Audio& state) const
 	g_logger->Debug("SETSTATE") << "state.mic_mute = " << state.mic_mute << endl;
 }
 
+// the response is served from the cache as it is; a device plugged in
+// since shows up in the next one
+void AuxGetCaptureDevicesRequest::SetState (Audio& state) const
+{
+	g_eventManager.Devices.Refresh();
+}
+
+void AuxGetRenderDevicesRequest::SetState (Audio& state) const
+{
+	g_eventManager.Devices.Refresh();
+}
+
 void AuxSetRenderDeviceRequest::SetState (Audio& state) const
 {
 	if (state.renderDevice != RenderDevice)
 	{
 		state.renderDevice = RenderDevice;
-		
-		int renderDev = 0;
-		int captureDev = 0;
-		bool reset = false;
-
-		pjsua_get_snd_dev(&captureDev, &renderDev);
-		g_logger->Debug("SETSTATE") << "Got audio devices C:" << captureDev << " R" << renderDev << endl;
-
-		if (captureDev == PJMEDIA_AUD_DEFAULT_CAPTURE_DEV)
-		{
-			pjmedia_aud_dev_info info;
-			pjmedia_aud_dev_get_info(PJMEDIA_AUD_DEFAULT_CAPTURE_DEV, &info);
-			pjmedia_aud_dev_lookup(info.driver, info.name, &captureDev);
-		}
-		if (renderDev == PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV)
-		{
-			pjmedia_aud_dev_info info;
-			pjmedia_aud_dev_get_info(PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV, &info);
-			pjmedia_aud_dev_lookup(info.driver, info.name, &renderDev);
-		}
-
-		pjmedia_aud_dev_info info[64];
-		unsigned int count;
-		pjsua_enum_aud_devs(info, &count);
-
-		for (unsigned int i = 0; i < count; i++)
-		{
-			if (info[i].name == RenderDevice)
-			{
-				renderDev = i;
-				reset = true;
-				break;
-			}
-		}
-
-		if (reset)
-		{
-			if (captureDev > 0)
-			{
-				g_logger->Debug("SETSTATE") << "SET SND DEV R:"  << renderDev << "C:" << captureDev << endl;
-				g_logger->Debug("SETSTATE") << "Setting render device to " << RenderDevice << endl;
-				try
-				{
-					pjsua_set_snd_dev(captureDev, renderDev);
-				}
-				catch(exception e)
-				{
-					g_logger->Warn("SETSTATE") << "Error setting audio device " << e.what() << endl;
-				}
-
-			}
-			else
-				g_logger->Warn("SETSTATE") << "Invalid capture device was set: " << captureDev << " while setting render device to " << RenderDevice << endl;
-		}
-		else
-		{
-			g_logger->Warn("SETSTATE") << "Trying to set invalid or nonexistent render device " << RenderDevice << endl;
-		}
+		set_render_device(RenderDevice);
 	}
 }
 
@@ -1146,65 +1143,7 @@ void AuxSetCaptureDeviceRequest::SetState (Audio& state) const
 	if (state.captureDevice != CaptureDevice)
 	{
 		state.captureDevice = CaptureDevice;
-
-		int renderDev = 0;
-		int captureDev = 0;
-		bool reset = false;
-
-		pjsua_get_snd_dev(&captureDev, &renderDev);
-		g_logger->Debug("SETSTATE") << "Got audio devices C:" << captureDev << " R" << renderDev << endl;
-
-		if (captureDev == PJMEDIA_AUD_DEFAULT_CAPTURE_DEV)
-		{
-			pjmedia_aud_dev_info info;
-			pjmedia_aud_dev_get_info(PJMEDIA_AUD_DEFAULT_CAPTURE_DEV, &info);
-			pjmedia_aud_dev_lookup(info.driver, info.name, &captureDev);
-		}
-		if (renderDev == PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV)
-		{
-			pjmedia_aud_dev_info info;
-			pjmedia_aud_dev_get_info(PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV, &info);
-			pjmedia_aud_dev_lookup(info.driver, info.name, &renderDev);
-		}
-
-		pjmedia_aud_dev_info info[64];
-		unsigned int count;
-		pjsua_enum_aud_devs(info, &count);
-
-		for (unsigned int i = 0; i < count; i++)
-		{
-			if (info[i].name == CaptureDevice)
-			{
-				captureDev = i;
-				reset = true;
-				break;
-			}
-		}
-
-		if (reset)
-		{
-			if (renderDev > 0)
-			{
-				g_logger->Debug("SETSTATE") << "SET SND DEV R:"  << renderDev << "C:" << captureDev << endl;
-				g_logger->Debug("SETSTATE") << "Setting capture device to " << CaptureDevice << endl;
-				try
-				{
-					pjsua_set_snd_dev(captureDev, renderDev);
-				}
-				catch(exception e)
-				{
-					g_logger->Warn("SETSTATE") << "Error setting audio device " << e.what() << endl;
-				}
-			}
-			else
-				g_logger->Warn("SETSTATE") << "Invalid render device was set: " << renderDev << " while setting capture device to " << CaptureDevice << endl;
-		}
-		else
-		{
-			g_logger->Warn("SETSTATE") << "Trying to set invalid or nonexistent capture device " << CaptureDevice << endl;
-		}
-
-
+		set_capture_device(CaptureDevice);
 	}
 }
 
@@ -1253,3 +1192,10 @@ void
 SessionSet3DPositionRequest::SetState (Orientation& state) const
 {
 }
+
+void 
+SessionSet3DPositionRequest::SetState (Orientation& speaker_state, Orientation& listener_state) const
+{
+    speaker_state = speaker;
+    listener_state = listener;
+}
@@ -27,6 +27,10 @@ Server::Server (int port) :
         socketsInit (); // for winsock compat
         server_.listen (port_);
         sock_.reset (new TCPSocketWrapper (server_.accept ()));
+
+        // a response is usually followed by events right away,
+        // don't hold them back until the viewer ACKs
+        sock_->nodelay ();
     }
     catch (exception &e)
     {
@@ -54,9 +58,6 @@ Server::~Server ()
 //=============================================================================
 void Server::Start ()
 {
-	char *pos;
-	char *cur;
-
 	if (!(sock_.get()))
         throw SocketLogicException ("server has no connection");
 
@@ -64,7 +65,10 @@ void Server::Start ()
 
     size_t nread (0);
 
-    memset (buf, 0, bufsize_);
+	// a read can end in the middle of a message (and a flood of
+	// Set3DPosition requests usually does), keep the tail for the next one
+	string pending;
+	string::size_type pos;
 
     for (;;)
     {
@@ -79,22 +83,20 @@ void Server::Start ()
         if (nread <= 0) 
             return;
 
-		*(buf + nread) = 0x00;
-
-		pos = NULL;
-		cur = buf;
-
-		while (NULL != (pos = strstr(cur, VFVW_XMLMSG_DELIM))) {
+		MetricTime received;
+		if (g_metrics != NULL)
+			received = metrics_now();
 
-			*pos = 0x00;
+		pending.append(buf, nread);
 
-			g_logger->Debug("SERVER") << "received " << cur << endl;
+		while (string::npos != (pos = pending.find(VFVW_XMLMSG_DELIM))) {
 
-			process_request_queue_(cur);
+			string mesg(pending, 0, pos);
+			pending.erase(0, pos + VFVW_XMLMSG_DELIM_LEN);
 
-			nread -= strlen(cur);
+			g_logger->Debug("SERVER") << "received " << mesg << endl;
 
-			cur = pos + VFVW_XMLMSG_DELIM_LEN;
+			process_request_queue_(mesg.c_str(), received);
 		}
     }
 }
@@ -115,6 +117,8 @@ void Server::Send (const string& m)
 	}
 	try
 	{
+		// called from the event manager and the SIP callback threads
+		boost::mutex::scoped_lock lock(send_mutex_);
 		sock_->write (m.c_str(), m.size()); 
 	}
 	catch(exception e)
@@ -124,7 +128,7 @@ void Server::Send (const string& m)
 }
 
 //=============================================================================
-void Server::process_request_queue_(const char* mesg)
+void Server::process_request_queue_(const char* mesg, const MetricTime& received)
 {
 	Event *ev = NULL;
 
@@ -195,6 +199,18 @@ void Server::process_request_queue_(const char* mesg)
 				= ((SessionSet3DPositionRequest *)request)->SessionHandle;
             break;
 
+        case SessionSetParticipantMuteForMe1:
+			ev = new ParticipantEvent();
+			((SessionEvent*)ev)->session_handle 
+				= ((SessionSetParticipantMuteForMeRequest *)request)->SessionHandle;
+            break;
+
+        case SessionSetParticipantVolumeForMe1:
+			ev = new ParticipantEvent();
+			((SessionEvent*)ev)->session_handle 
+				= ((SessionSetParticipantVolumeForMeRequest *)request)->SessionHandle;
+            break;
+
 		case SessionTerminate1:
 			ev = new SessionTerminateEvent();
 			((SessionEvent*)ev)->session_handle 
@@ -221,6 +237,14 @@ void Server::process_request_queue_(const char* mesg)
 	if (ev != NULL) {
 		ev->message = request;
 		ev->result = response;
+
+		if (g_metrics != NULL) {
+			ev->received_at = received;
+			ev->enqueued_at = metrics_now();
+			g_metrics->RecordAction(request->Type, MetricStage_Parse,
+				metrics_elapsed_usec(ev->received_at, ev->enqueued_at));
+		}
+
 		g_eventManager.blockQueue.enqueue(ev);
 	}
 }
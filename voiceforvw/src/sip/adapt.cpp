@@ -0,0 +1,46 @@
+/* adapt.cpp -- codec adaptation module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <adapt.hpp>
+
+//=============================================================================
+CodecAdapter::CodecAdapter(unsigned levels, float loss_high, float loss_low, unsigned rtt_high_ms,
+						   unsigned down_samples, unsigned up_samples, unsigned long hold_ms)
+	: levels_(levels < 1 ? 1 : levels), loss_high_(loss_high), loss_low_(loss_low), rtt_high_(rtt_high_ms),
+	  down_samples_(down_samples < 1 ? 1 : down_samples), up_samples_(up_samples < 1 ? 1 : up_samples),
+	  hold_ms_(hold_ms), level_(0), bad_(0), good_(0), switched_(false), switched_at_(0)
+{
+}
+
+unsigned CodecAdapter::Update(float loss, unsigned rtt_ms, unsigned long now_ms)
+{
+	bool slow = (rtt_high_ > 0 && rtt_ms >= rtt_high_);
+	bool bad = (loss >= loss_high_) || slow;
+	bool good = (loss <= loss_low_) && !slow;
+
+	// in between counts for neither and breaks both runs
+	bad_ = bad ? bad_ + 1 : 0;
+	good_ = good ? good_ + 1 : 0;
+
+	if (switched_ && now_ms - switched_at_ < hold_ms_)
+		return level_;
+
+	unsigned level = level_;
+	if (bad_ >= down_samples_ && level_ + 1 < levels_)
+		level = level_ + 1;
+	else if (good_ >= up_samples_ && level_ > 0)
+		level = level_ - 1;
+
+	// the hold starts from the switch asked for, whether or not it happens
+	if (level != level_)
+	{
+		bad_ = good_ = 0;
+		switched_ = true;
+		switched_at_ = now_ms;
+	}
+
+	return level;
+}
@@ -0,0 +1,140 @@
+/* capture.cpp -- capture path module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <capture.hpp>
+
+#define CAPTURE_SIGNATURE	PJMEDIA_PORT_SIGNATURE('S', 'L', 'C', 'P')
+
+//=============================================================================
+// per mode 1..3: voice is above both ratio * noise and the minimum level,
+// and is held for the hangover after the last voiced frame
+
+struct VadParams
+{
+	int ratio_x4;		// times 4
+	int min_level;		// mean absolute sample
+	unsigned hangover;	// 20 msec frames
+};
+
+static const VadParams vad_params_[VAD_MODE_MAX] =
+{
+	{  8,  40, 15 },
+	{ 12,  80, 10 },
+	{ 16, 160,  5 },
+};
+
+VoiceDetector::VoiceDetector(int mode)
+	: hangover_(0)
+{
+	mode_ = (mode < 1) ? 1 : (mode > VAD_MODE_MAX ? VAD_MODE_MAX : mode);
+}
+
+bool VoiceDetector::IsVoice(const pj_int16_t *samples, unsigned count, unsigned stride)
+{
+	if (count == 0)
+		return hangover_ > 0;
+
+	unsigned long sum = 0;
+	for (unsigned i = 0; i < count; i++)
+		sum += abs(samples[stride * i]);
+
+	int level = (int)(sum / count);
+	int noise = noise_.Prime(level);
+
+	const VadParams& p = vad_params_[mode_ - 1];
+	bool voice = (level > p.min_level && level * 4 > noise * p.ratio_x4);
+
+	noise_.Update(level, voice);
+
+	if (voice)
+		hangover_ = p.hangover;
+	else if (hangover_ > 0)
+		hangover_--;
+
+	return hangover_ > 0;
+}
+
+//=============================================================================
+void NoiseFloor::Update(int level, bool voice)
+{
+	if (level_ < 0 || level < level_)
+		level_ = level;
+	else if (!voice)
+		level_ += (level - level_ + 15) / 16;
+	else
+		level_ += (level - level_) / 1024;
+}
+
+//=============================================================================
+CapturePort::CapturePort(unsigned clock_rate, unsigned channel_count,
+						 unsigned samples_per_frame, int mode)
+	: channel_count_(channel_count), detector_(mode), has_frame_(false),
+	  frames_(0), voice_frames_(0)
+{
+	const pj_str_t name = pj_str((char*)"capture");
+
+	pjmedia_port_info_init(&port_.info, &name, CAPTURE_SIGNATURE,
+		clock_rate, channel_count, 16, samples_per_frame);
+
+	port_.port_data.user_data = this;
+	port_.put_frame = &put_frame_;
+	port_.get_frame = &get_frame_;
+	port_.on_destroy = NULL;
+
+	frame_ = new pj_int16_t[samples_per_frame];
+}
+
+CapturePort::~CapturePort()
+{
+	delete [] frame_;
+}
+
+pj_status_t CapturePort::put_frame_(pjmedia_port *port, const pjmedia_frame *frame)
+{
+	CapturePort *self = (CapturePort*)port->port_data.user_data;
+	const pj_int16_t *samples = (const pj_int16_t*)frame->buf;
+
+	self->frames_++;
+
+	bool audio = (frame->type == PJMEDIA_FRAME_TYPE_AUDIO && frame->size == port->info.bytes_per_frame);
+
+	// the microphone is mono, a stereo bridge duplicates it
+	unsigned count = audio ? port->info.samples_per_frame / self->channel_count_ : 0;
+	self->has_frame_ = self->detector_.IsVoice(samples, count, self->channel_count_);
+
+	if (!self->has_frame_)
+		return PJ_SUCCESS;
+
+	// a hangover frame without audio goes out as silence
+	if (audio)
+		memcpy(self->frame_, samples, port->info.bytes_per_frame);
+	else
+		memset(self->frame_, 0, port->info.bytes_per_frame);
+
+	self->voice_frames_++;
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t CapturePort::get_frame_(pjmedia_port *port, pjmedia_frame *frame)
+{
+	CapturePort *self = (CapturePort*)port->port_data.user_data;
+
+	if (!self->has_frame_)
+	{
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+		return PJ_SUCCESS;
+	}
+
+	memcpy(frame->buf, self->frame_, port->info.bytes_per_frame);
+	self->has_frame_ = false;
+
+	frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame->size = port->info.bytes_per_frame;
+
+	return PJ_SUCCESS;
+}
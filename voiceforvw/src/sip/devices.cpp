@@ -0,0 +1,247 @@
+/* devices.cpp -- audio device cache module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <devices.hpp>
+
+// msec Aux.Get*Devices waits for the first enumeration before it answers
+// with what there is
+#define DEVICES_READY_WAIT	2000
+
+//=============================================================================
+AudioDeviceCache::AudioDeviceCache() : ready_(false), requested_(false)
+{
+}
+
+boost::mutex& AudioDeviceCache::SubsysMutex()
+{
+	static boost::mutex mutex;
+	return mutex;
+}
+
+//=============================================================================
+// pjmedia lists the devices when its sound subsystem is initialized. While
+// pjsua holds the subsystem this only counts a reference and reads that
+// list; otherwise the drivers are asked again, which is how a device
+// plugged in before the first call shows up.
+
+static bool is_supported_ (const pjmedia_aud_dev_info& info)
+{
+	// the mapper is the default device under another name
+	if (strcmp(info.name, "Wave mapper") == 0)
+		return false;
+
+	for (unsigned k = 0; k < info.ext_fmt_cnt; k++)
+	{
+		pj_uint32_t id = info.ext_fmt[k].id;
+		if (id == PJMEDIA_FORMAT_PCM || id == PJMEDIA_FORMAT_PCMU || id == PJMEDIA_FORMAT_PCMA)
+			return true;
+	}
+
+	return false;
+}
+
+bool AudioDeviceCache::enumerate_(vector<AudioDevice>& devices)
+{
+	boost::mutex::scoped_lock lock(SubsysMutex());
+
+	bool verbose = !ready_;
+
+	pj_caching_pool cp;
+	pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+	pj_status_t status = pjmedia_aud_subsys_init(&cp.factory);
+	if (status != PJ_SUCCESS)
+	{
+		g_logger->Warn("AudioDevices") << "Could not initialize the sound subsystem. {ERROR:" << status << "}" << endl;
+		pj_caching_pool_destroy(&cp);
+		return false;
+	}
+
+	unsigned int devcount = pjmedia_aud_dev_count();
+	pjmedia_aud_dev_info info;
+
+	if (verbose)
+		g_logger->Debug("AudioDevices") << "Audio device count " << devcount << endl;
+
+	for (unsigned int i = 0; i < devcount; i++)
+	{
+		status = pjmedia_aud_dev_get_info((pjmedia_aud_dev_index)i, &info);
+		if (status != PJ_SUCCESS)
+		{
+			g_logger->Warn("AudioDevices") << "Could not retreive audio device information. {ERROR:" << status << "}" << endl;
+			continue;
+		}
+
+		if (verbose)
+		{
+			g_logger->Debug("AudioDevices") << "Properties: CAPS=" << info.caps << " Samplerate=" << info.default_samples_per_sec << " Driver=" << string(info.driver) << endl;
+			g_logger->Debug("AudioDevices") << "Formats=" << info.ext_fmt_cnt << " Inputs=" << info.input_count << " Outputs=" << info.output_count << endl;
+			g_logger->Debug("AudioDevices") << "Routes=" << info.routes << endl;
+			for (unsigned j = 0; j < info.ext_fmt_cnt; j++)
+			{
+				g_logger->Debug("AudioDevices") << "Format(" << j << ")=" << info.ext_fmt[j].id << endl;
+			}
+		}
+
+		AudioDevice d;
+		d.index = (int)i;
+		d.name = info.name;
+		d.driver = info.driver;
+
+		bool supported = is_supported_(info);
+		d.capture = supported && info.input_count > 0;
+		d.render = supported && info.output_count > 0;
+
+		devices.push_back(d);
+	}
+
+	pjmedia_aud_subsys_shutdown();
+	pj_caching_pool_destroy(&cp);
+
+	return true;
+}
+
+//=============================================================================
+// The XML is built here, once per change, so that the responses only copy it
+
+void AudioDeviceCache::store_(const vector<AudioDevice>& devices)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	if (ready_ && devices == devices_)
+		return;
+
+	string captureXml, renderXml;
+
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		const AudioDevice& d = devices[i];
+
+		g_logger->Info("AudioDevices") << "Audio device " << d.index << " name=" << d.name
+			<< (d.capture ? " capture" : "") << (d.render ? " render" : "") << endl;
+
+		if (d.capture)
+			captureXml += "<CaptureDevice><Device>" + d.name + "</Device></CaptureDevice>";
+		if (d.render)
+			renderXml += "<RenderDevice><Device>" + d.name + "</Device></RenderDevice>";
+	}
+
+	if (ready_)
+		g_logger->Info("AudioDevices") << "Audio devices changed, " << devices.size() << " now" << endl;
+
+	// the first of two devices with one name wins, as in a scan of the list
+	index_.clear();
+	for (size_t i = 0; i < devices.size(); i++)
+		index_.insert(make_pair(devices[i].name, devices[i].index));
+
+	devices_ = devices;
+	captureXml_ = captureXml;
+	renderXml_ = renderXml;
+	ready_ = true;
+
+	cond_.notify_all();
+}
+
+//=============================================================================
+void AudioDeviceCache::operator()()
+{
+	pj_thread_t *thread;
+	pj_bzero(desc_, sizeof(desc_));
+	pj_thread_register("audio_devices", desc_, &thread);
+
+	// without a sound device nothing is probed until the viewer asks
+	if (g_config->SoundDevice != "device")
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		while (!requested_)
+			cond_.wait(lock);
+		requested_ = false;
+	}
+
+	for (;;)
+	{
+		vector<AudioDevice> devices;
+		if (enumerate_(devices))
+			store_(devices);
+
+		boost::mutex::scoped_lock lock(mutex_);
+
+		// nobody waits for a list that cannot be had
+		if (!ready_)
+		{
+			ready_ = true;
+			cond_.notify_all();
+		}
+
+		boost::system_time until = boost::get_system_time()
+			+ boost::posix_time::milliseconds(g_config->DeviceRefreshInterval);
+
+		// nor polled for after
+		bool polling = g_config->DeviceRefreshInterval > 0 && g_config->SoundDevice == "device";
+
+		while (!requested_)
+		{
+			if (!polling)
+				cond_.wait(lock);
+			else if (!cond_.timed_wait(lock, until))
+				break;
+		}
+
+		requested_ = false;
+	}
+}
+
+void AudioDeviceCache::Refresh()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	requested_ = true;
+	cond_.notify_all();
+}
+
+//=============================================================================
+void AudioDeviceCache::wait_ready_(boost::mutex::scoped_lock& lock)
+{
+	boost::system_time until = boost::get_system_time()
+		+ boost::posix_time::milliseconds(DEVICES_READY_WAIT);
+
+	while (!ready_)
+	{
+		if (!cond_.timed_wait(lock, until))
+			return;
+	}
+}
+
+vector<AudioDevice> AudioDeviceCache::Devices()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	wait_ready_(lock);
+	return devices_;
+}
+
+string AudioDeviceCache::CaptureDevicesXml()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	wait_ready_(lock);
+	return captureXml_;
+}
+
+string AudioDeviceCache::RenderDevicesXml()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	wait_ready_(lock);
+	return renderXml_;
+}
+
+int AudioDeviceCache::Find(const string& name)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	wait_ready_(lock);
+
+	map<string, int>::const_iterator ite = index_.find(name);
+	return (ite == index_.end()) ? -1 : ite->second;
+}
@@ -0,0 +1,426 @@
+/* dsp.cpp -- capture processing module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <dsp.hpp>
+#include <mixer.hpp>
+
+// picked at build time as the mixer's kernels are
+#if defined(__AVX2__)
+#define VFVW_DSP_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VFVW_DSP_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VFVW_DSP_NEON
+#include <arm_neon.h>
+#endif
+
+#define DSP_SIGNATURE		PJMEDIA_PORT_SIGNATURE('S', 'L', 'D', 'P')
+
+//=============================================================================
+unsigned dsp_level_scalar(const pj_int16_t *in, unsigned count)
+{
+	if (count == 0)
+		return 0;
+
+	pj_uint32_t sum = 0;
+	for (unsigned i = 0; i < count; i++)
+		sum += (in[i] == -32768) ? 32767 : abs(in[i]);
+
+	return sum / count;
+}
+
+static void dsp_gain_tail_(pj_int16_t *samples, unsigned count, pj_int16_t gain)
+{
+	for (unsigned i = 0; i < count; i++)
+	{
+		pj_int32_t v = ((pj_int32_t)samples[i] * gain) >> MIXER_GAIN_SHIFT;
+		samples[i] = (pj_int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+	}
+}
+
+void dsp_gain_scalar(pj_int16_t *samples, unsigned count, pj_int16_t gain)
+{
+	dsp_gain_tail_(samples, count, gain);
+}
+
+#if defined(VFVW_DSP_AVX2)
+
+unsigned dsp_level(const pj_int16_t *in, unsigned count)
+{
+	if (count == 0)
+		return 0;
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i sum = zero;
+
+	unsigned i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		// max(x, 0 - x) with the subtraction saturated is the scalar abs
+		__m256i s = _mm256_loadu_si256((const __m256i*)(in + i));
+		__m256i a = _mm256_max_epi16(s, _mm256_subs_epi16(zero, s));
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, ones));
+	}
+
+	pj_int32_t lanes[8];
+	_mm256_storeu_si256((__m256i*)lanes, sum);
+
+	pj_uint32_t total = 0;
+	for (int k = 0; k < 8; k++)
+		total += lanes[k];
+	for (; i < count; i++)
+		total += (in[i] == -32768) ? 32767 : abs(in[i]);
+
+	return total / count;
+}
+
+void dsp_gain(pj_int16_t *samples, unsigned count, pj_int16_t gain)
+{
+	const __m256i g = _mm256_set1_epi32(gain);
+
+	unsigned i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + i)));
+		__m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + i + 8)));
+		a = _mm256_srai_epi32(_mm256_mullo_epi32(a, g), MIXER_GAIN_SHIFT);
+		b = _mm256_srai_epi32(_mm256_mullo_epi32(b, g), MIXER_GAIN_SHIFT);
+
+		// packs works within each 128 bit lane: a0-3 b0-3 a4-7 b4-7
+		__m256i s = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(samples + i), s);
+	}
+
+	dsp_gain_tail_(samples + i, count - i, gain);
+}
+
+const char* dsp_kernels() { return "avx2"; }
+
+#elif defined(VFVW_DSP_SSE2)
+
+unsigned dsp_level(const pj_int16_t *in, unsigned count)
+{
+	if (count == 0)
+		return 0;
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i sum = zero;
+
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		// max(x, 0 - x) with the subtraction saturated is the scalar abs
+		__m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i a = _mm_max_epi16(s, _mm_subs_epi16(zero, s));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(a, ones));
+	}
+
+	pj_int32_t lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, sum);
+
+	pj_uint32_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (; i < count; i++)
+		total += (in[i] == -32768) ? 32767 : abs(in[i]);
+
+	return total / count;
+}
+
+void dsp_gain(pj_int16_t *samples, unsigned count, pj_int16_t gain)
+{
+	const __m128i g = _mm_set1_epi16(gain);
+
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		// the full 32 bit products from their low and high halves
+		__m128i s = _mm_loadu_si128((const __m128i*)(samples + i));
+		__m128i pl = _mm_mullo_epi16(s, g);
+		__m128i ph = _mm_mulhi_epi16(s, g);
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(pl, ph), MIXER_GAIN_SHIFT);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(pl, ph), MIXER_GAIN_SHIFT);
+
+		_mm_storeu_si128((__m128i*)(samples + i), _mm_packs_epi32(lo, hi));
+	}
+
+	dsp_gain_tail_(samples + i, count - i, gain);
+}
+
+const char* dsp_kernels() { return "sse2"; }
+
+#elif defined(VFVW_DSP_NEON)
+
+unsigned dsp_level(const pj_int16_t *in, unsigned count)
+{
+	if (count == 0)
+		return 0;
+
+	int32x4_t sum = vdupq_n_s32(0);
+
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		// the saturating abs takes -32768 to 32767
+		int16x8_t a = vqabsq_s16(vld1q_s16(in + i));
+		sum = vpadalq_s16(sum, a);
+	}
+
+	pj_uint32_t total = vgetq_lane_s32(sum, 0) + vgetq_lane_s32(sum, 1)
+		+ vgetq_lane_s32(sum, 2) + vgetq_lane_s32(sum, 3);
+	for (; i < count; i++)
+		total += (in[i] == -32768) ? 32767 : abs(in[i]);
+
+	return total / count;
+}
+
+void dsp_gain(pj_int16_t *samples, unsigned count, pj_int16_t gain)
+{
+	const int16x4_t g = vdup_n_s16(gain);
+
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		int16x8_t s = vld1q_s16(samples + i);
+		int32x4_t lo = vshrq_n_s32(vmull_s16(vget_low_s16(s), g), MIXER_GAIN_SHIFT);
+		int32x4_t hi = vshrq_n_s32(vmull_s16(vget_high_s16(s), g), MIXER_GAIN_SHIFT);
+
+		vst1q_s16(samples + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+
+	dsp_gain_tail_(samples + i, count - i, gain);
+}
+
+const char* dsp_kernels() { return "neon"; }
+
+#else
+
+unsigned dsp_level(const pj_int16_t *in, unsigned count)
+{
+	return dsp_level_scalar(in, count);
+}
+
+void dsp_gain(pj_int16_t *samples, unsigned count, pj_int16_t gain)
+{
+	dsp_gain_scalar(samples, count, gain);
+}
+
+const char* dsp_kernels() { return "scalar"; }
+
+#endif
+
+//=============================================================================
+// y[n] = x[n] - x[n-1] + r * y[n-1], with r = 1 - 2 pi fc / fs; the output
+// is kept with 8 more bits so that low cutoffs do not just round away
+
+#define HPF_FRAC	8
+
+HighPassFilter::HighPassFilter(unsigned clock_rate, unsigned cutoff_hz)
+	: x1_(0), y1_(0)
+{
+	double r = 1.0 - 2.0 * 3.14159265358979 * cutoff_hz / (clock_rate ? clock_rate : 8000);
+	r_ = (pj_int32_t)((r < 0.0 ? 0.0 : r) * 32768.0 + 0.5);
+}
+
+void HighPassFilter::Process(pj_int16_t *samples, unsigned count)
+{
+	pj_int32_t x1 = x1_;
+	pj_int32_t y1 = y1_;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		pj_int32_t x = samples[i];
+		pj_int32_t y = (x - x1) * (1 << HPF_FRAC) + (pj_int32_t)(((pj_int64_t)r_ * y1) >> 15);
+
+		pj_int32_t v = y >> HPF_FRAC;
+		samples[i] = (pj_int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+
+		x1 = x;
+		y1 = y;
+	}
+
+	x1_ = x1;
+	y1_ = y1;
+}
+
+//=============================================================================
+// Within 6 dB of the background a frame is turned down 12 dB, from 12 dB
+// above it is left alone, and in between the gain goes linearly. The gain
+// opens at once, so that word onsets are not cut, and closes over a few
+// frames.
+
+#define NS_FLOOR_GAIN	(MIXER_GAIN_UNITY / 4)
+
+NoiseSuppressor::NoiseSuppressor()
+	: gain_(MIXER_GAIN_UNITY)
+{
+}
+
+void NoiseSuppressor::Process(pj_int16_t *samples, unsigned count)
+{
+	if (count == 0)
+		return;
+
+	int level = (int)dsp_level(samples, count);
+
+	// clearly voice is 4 times the background or more
+	noise_.Update(level, level >= 4 * noise_.Prime(level));
+
+	int noise = noise_.Level() > 1 ? noise_.Level() : 1;
+
+	pj_int32_t target;
+	if (level <= 2 * noise)
+		target = NS_FLOOR_GAIN;
+	else if (level >= 4 * noise)
+		target = MIXER_GAIN_UNITY;
+	else
+		target = NS_FLOOR_GAIN + (MIXER_GAIN_UNITY - NS_FLOOR_GAIN) * (level - 2 * noise) / (2 * noise);
+
+	if (target > gain_)
+		gain_ = (pj_int16_t)target;
+	else
+		gain_ = (pj_int16_t)(gain_ - (gain_ - target + 3) / 4);
+
+	if (gain_ != MIXER_GAIN_UNITY)
+		dsp_gain(samples, count, gain_);
+}
+
+//=============================================================================
+// levels are mean absolute samples: speech at the target is about -20 dBFS
+
+#define AGC_TARGET		2500
+#define AGC_MIN_LEVEL	300				// quieter is not taken for speech
+#define AGC_MIN_GAIN	(MIXER_GAIN_UNITY / 4)
+#define AGC_MAX_GAIN	32767			// just under 8
+
+GainControl::GainControl()
+	: gain_(MIXER_GAIN_UNITY)
+{
+}
+
+void GainControl::Process(pj_int16_t *samples, unsigned count)
+{
+	if (count == 0)
+		return;
+
+	unsigned level = dsp_level(samples, count);
+
+	if (level >= AGC_MIN_LEVEL)
+	{
+		pj_int32_t wanted = (pj_int32_t)((AGC_TARGET * MIXER_GAIN_UNITY) / level);
+		if (wanted < AGC_MIN_GAIN)
+			wanted = AGC_MIN_GAIN;
+		if (wanted > AGC_MAX_GAIN)
+			wanted = AGC_MAX_GAIN;
+
+		// down by 6 dB a frame at most, up by 1/64 of the way
+		if (wanted < gain_)
+			gain_ = (wanted > gain_ / 2) ? wanted : gain_ / 2;
+		else
+			gain_ += (wanted - gain_ + 63) / 64;
+	}
+
+	if (gain_ != MIXER_GAIN_UNITY)
+		dsp_gain(samples, count, (pj_int16_t)gain_);
+}
+
+//=============================================================================
+#define HPF_CUTOFF	100		// Hz, under the lowest voices
+
+CapturePipeline::CapturePipeline(unsigned clock_rate, bool high_pass, bool noise, bool agc)
+	: high_pass_(high_pass), noise_(noise), agc_(agc), filter_(clock_rate, HPF_CUTOFF)
+{
+}
+
+void CapturePipeline::Process(pj_int16_t *samples, unsigned count)
+{
+	if (high_pass_)
+		filter_.Process(samples, count);
+	if (noise_)
+		suppressor_.Process(samples, count);
+	if (agc_)
+		control_.Process(samples, count);
+}
+
+//=============================================================================
+DspPort::DspPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame,
+				 bool high_pass, bool noise, bool agc)
+	: channel_count_(channel_count), pipeline_(clock_rate, high_pass, noise, agc),
+	  has_frame_(false)
+{
+	const pj_str_t name = pj_str((char*)"capture_dsp");
+
+	pjmedia_port_info_init(&port_.info, &name, DSP_SIGNATURE,
+		clock_rate, channel_count, 16, samples_per_frame);
+
+	port_.port_data.user_data = this;
+	port_.put_frame = &put_frame_;
+	port_.get_frame = &get_frame_;
+	port_.on_destroy = NULL;
+
+	mono_ = new pj_int16_t[samples_per_frame / channel_count];
+	frame_ = new pj_int16_t[samples_per_frame];
+}
+
+DspPort::~DspPort()
+{
+	delete [] mono_;
+	delete [] frame_;
+}
+
+pj_status_t DspPort::put_frame_(pjmedia_port *port, const pjmedia_frame *frame)
+{
+	DspPort *self = (DspPort*)port->port_data.user_data;
+
+	self->has_frame_ = (frame->type == PJMEDIA_FRAME_TYPE_AUDIO && frame->size == port->info.bytes_per_frame);
+	if (!self->has_frame_)
+		return PJ_SUCCESS;
+
+	const pj_int16_t *samples = (const pj_int16_t*)frame->buf;
+	unsigned channels = self->channel_count_;
+	unsigned count = port->info.samples_per_frame / channels;
+
+	if (channels == 1)
+	{
+		memcpy(self->frame_, samples, port->info.bytes_per_frame);
+		self->pipeline_.Process(self->frame_, count);
+		return PJ_SUCCESS;
+	}
+
+	// the microphone is mono, a stereo bridge duplicates it
+	for (unsigned i = 0; i < count; i++)
+		self->mono_[i] = samples[channels * i];
+
+	self->pipeline_.Process(self->mono_, count);
+
+	for (unsigned i = 0; i < count; i++)
+		for (unsigned c = 0; c < channels; c++)
+			self->frame_[channels * i + c] = self->mono_[i];
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t DspPort::get_frame_(pjmedia_port *port, pjmedia_frame *frame)
+{
+	DspPort *self = (DspPort*)port->port_data.user_data;
+
+	if (!self->has_frame_)
+	{
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+		return PJ_SUCCESS;
+	}
+
+	memcpy(frame->buf, self->frame_, port->info.bytes_per_frame);
+	self->has_frame_ = false;
+
+	frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame->size = port->info.bytes_per_frame;
+
+	return PJ_SUCCESS;
+}
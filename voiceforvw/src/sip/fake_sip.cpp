@@ -0,0 +1,295 @@
+/* fake_sip.cpp -- fake sip backend module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <sip.hpp>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+//=============================================================================
+// Delivers the replies of all fake backends from one thread, in the order
+// they are due, the way the pjsua worker thread delivers its callbacks.
+
+class FakeSIPTimer
+{
+	public:
+		FakeSIPTimer() : started_(false) {}
+
+		void Schedule(Event *ev, int delay_ms)
+		{
+			if (delay_ms <= 0)
+			{
+				g_eventManager.blockQueue.enqueue(ev);
+				return;
+			}
+
+			boost::system_time due = boost::get_system_time()
+				+ boost::posix_time::milliseconds(delay_ms);
+
+			boost::mutex::scoped_lock lock(mutex_);
+
+			if (!started_)
+			{
+				boost::thread(boost::ref(*this));
+				started_ = true;
+			}
+
+			pending_.insert(make_pair(due, ev));
+			cond_.notify_one();
+		}
+
+		void operator()()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			for (;;)
+			{
+				if (pending_.empty())
+				{
+					cond_.wait(lock);
+					continue;
+				}
+
+				Pending::iterator first = pending_.begin();
+				if (boost::get_system_time() < first->first)
+				{
+					// woken up early by a new request, it may be due sooner
+					cond_.timed_wait(lock, first->first);
+					continue;
+				}
+
+				Event *ev = first->second;
+				pending_.erase(first);
+				g_eventManager.blockQueue.enqueue(ev);
+			}
+		}
+
+	private:
+		typedef multimap<boost::system_time, Event*> Pending;
+
+		boost::mutex mutex_;
+		boost::condition_variable cond_;
+		Pending pending_;
+		bool started_;
+};
+
+// pjsua numbers accounts and calls per process, so does the fake
+static boost::mutex g_fakeIdMutex;
+static int g_fakeAccId = 0;
+static int g_fakeCallId = 0;
+
+// created with the first backend and never deleted, its thread runs
+// until the process exits
+static FakeSIPTimer *g_fakeTimer = NULL;
+
+static int next_id_(int& counter)
+{
+	boost::mutex::scoped_lock lock(g_fakeIdMutex);
+	return counter++;
+}
+
+//=============================================================================
+static void reply_reg_(int acc_id, int delay_ms)
+{
+	AccountEvent *ev = new RegSucceedEvent();
+	ev->acc_id = acc_id;
+	g_fakeTimer->Schedule(ev, delay_ms);
+}
+
+static void reply_call_(SessionEvent *ev, int call_id, int delay_ms)
+{
+	ev->call_id = call_id;
+	g_fakeTimer->Schedule(ev, delay_ms);
+}
+
+//=============================================================================
+FakeSIPConference::FakeSIPConference(const SIPServerInfo& s) :
+        server_ (s)
+{
+	g_logger->Debug("SIP") << "Entering FakeSIPConference(const SIPServerInfo&)" << endl;
+
+	boost::mutex::scoped_lock lock(g_fakeIdMutex);
+	if (g_fakeTimer == NULL)
+		g_fakeTimer = new FakeSIPTimer();
+}
+
+//=============================================================================
+FakeSIPConference::~FakeSIPConference()
+{
+    g_logger->Debug("SIP") << "Entering ~FakeSIPConference()" << endl;
+}
+
+//=============================================================================
+void FakeSIPConference::Register(const SIPUserInfo& user, int* accid) {
+
+	g_logger->Debug("SIP") << "Entering fake Register(const SIPUserInfo&) uri=" << user.sipuri << endl;
+
+	*accid = next_id_(g_fakeAccId);
+	reply_reg_(*accid, g_config->FakeRegisterDelay);
+}
+
+//=============================================================================
+void FakeSIPConference::UnRegister(const int accid) {
+
+	g_logger->Debug("SIP") << "Entering fake UnRegister(const int)" << endl;
+
+	// the unREG (Expires=0) is answered with a 200 as well
+	reply_reg_(accid, g_config->FakeRegisterDelay);
+}
+
+//=============================================================================
+void FakeSIPConference::Join(const string& joinuri, int acc_id, int* callid) {
+
+	g_logger->Debug("SIP") << "Entering fake Join() URI=" << joinuri << endl;
+
+	*callid = -1;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if (tx_levels_.size() >= (size_t)g_config->MaxCalls)
+			throw runtime_error("too many calls in progress");
+
+		*callid = next_id_(g_fakeCallId);
+		tx_levels_[*callid] = 1.0f;
+	}
+
+	int ring = g_config->FakeRingDelay;
+	int answer = ring + g_config->FakeAnswerDelay;
+
+	reply_call_(new DialEarlyEvent(), *callid, ring);
+	reply_call_(new DialConnectingEvent(), *callid, answer);
+	reply_call_(new DialSucceedEvent(), *callid, answer);
+}
+
+//=============================================================================
+void FakeSIPConference::Answer(const int call_id, const unsigned int status_code) {
+
+	g_logger->Info("SIP") << "Entering fake Answer call_id=" << call_id << endl;
+
+	// provisional answers don't change the call state
+	if (status_code < 200)
+		return;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		tx_levels_[call_id] = 1.0f;
+	}
+
+	reply_call_(new DialSucceedEvent(), call_id, g_config->FakeRingDelay);
+}
+
+//=============================================================================
+void FakeSIPConference::Leave(const int call_id) {
+
+	g_logger->Info("SIP") << "Entering fake Leave call_id=" << call_id << endl;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		tx_levels_.erase(call_id);
+		muted_.erase(call_id);
+	}
+
+	reply_call_(new DialDisconnectedEvent(), call_id, g_config->FakeRingDelay);
+}
+
+//=============================================================================
+void FakeSIPConference::AdjustTranVolume(int call_id, float level)
+{
+	g_logger->Debug("SIP") << "Fake AdjustTranVolume call_id=" << call_id << ", Level=" << level << endl;
+
+	boost::mutex::scoped_lock lock(mutex_);
+
+	map<int, float>::iterator ite = tx_levels_.find(call_id);
+	if (ite != tx_levels_.end())
+		ite->second = level;
+}
+
+//=============================================================================
+void FakeSIPConference::SetMicMute(int call_id, bool muted)
+{
+	g_logger->Debug("SIP") << "Fake SetMicMute call_id=" << call_id << ", " << muted << endl;
+
+	boost::mutex::scoped_lock lock(mutex_);
+
+	if (muted)
+		muted_.insert(call_id);
+	else
+		muted_.erase(call_id);
+}
+
+//=============================================================================
+void FakeSIPConference::AdjustRecvVolume(int call_id, float level)
+{
+	g_logger->Debug("SIP") << "Fake AdjustRecvVolume call_id=" << call_id << ", Level=" << level << endl;
+}
+
+//=============================================================================
+void FakeSIPConference::AdjustSpatialGains(int call_id, const SpatialGains& gains)
+{
+	g_logger->Debug("SIP") << "Fake AdjustSpatialGains call_id=" << call_id
+		<< ", L=" << gains.left << ", R=" << gains.right << endl;
+}
+
+//=============================================================================
+void FakeSIPConference::SetAudible(int call_id, bool audible)
+{
+	g_logger->Debug("SIP") << "Fake SetAudible call_id=" << call_id << ", " << audible << endl;
+}
+
+//=============================================================================
+void FakeSIPConference::AdjustParticipantVolume(int call_id, float volume)
+{
+	g_logger->Debug("SIP") << "Fake AdjustParticipantVolume call_id=" << call_id << ", Volume=" << volume << endl;
+}
+
+//=============================================================================
+void FakeSIPConference::SetParticipantMute(int call_id, bool muted)
+{
+	g_logger->Debug("SIP") << "Fake SetParticipantMute call_id=" << call_id << ", " << muted << endl;
+}
+
+//=============================================================================
+bool FakeSIPConference::GetMeter(int call_id, MeterReading* reading)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	map<int, float>::iterator ite = tx_levels_.find(call_id);
+	if (ite == tx_levels_.end())
+		return false;
+
+	// a steady talker, silent while the mic is muted or turned down
+	bool talking = ite->second > 0.0f && muted_.find(call_id) == muted_.end();
+	reading->level = talking ? 64 : 0;
+	reading->peak = talking ? 80 : 0;
+	reading->speaking = talking;
+
+	return true;
+}
+
+//=============================================================================
+bool FakeSIPConference::GetQuality(int call_id, CallQuality* quality)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	if (tx_levels_.find(call_id) == tx_levels_.end())
+		return false;
+
+	// a clean LAN: nothing lost, a little jitter
+	*quality = CallQuality();
+	quality->jitter_ms = 2;
+	quality->rtt_ms = 1;
+	quality->jb_frames = 2;
+	quality->jb_prefetch = 1;
+
+	return true;
+}
+
+//=============================================================================
+// the fake link never degrades, so there is nothing to switch to
+
+void FakeSIPConference::AdaptCodec(int, const CallQuality&)
+{
+}
@@ -0,0 +1,723 @@
+/* mediamux.cpp -- shared media transport module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <mediamux.hpp>
+
+#ifdef WIN32
+typedef int socklen_t;
+#define MUX_INVALID_SOCKET	INVALID_SOCKET
+#define mux_close_(s)		closesocket(s)
+#define mux_error_()		WSAGetLastError()
+#else
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#define MUX_INVALID_SOCKET	(-1)
+#define mux_close_(s)		close(s)
+#define mux_error_()		errno
+#endif
+
+// recvmmsg and sendmmsg, Linux 2.6.33 and 3.0
+#if defined(__linux__)
+#define MEDIAMUX_MMSG
+#endif
+
+// room for a burst of every call's packets while the thread is away
+#define MEDIAMUX_RCVBUF		(256 * 1024)
+
+//=============================================================================
+static mux_socket_t open_socket_(const sockaddr_in& addr)
+{
+	mux_socket_t sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock == MUX_INVALID_SOCKET)
+		return sock;
+
+	int rcvbuf = MEDIAMUX_RCVBUF;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf));
+
+#ifdef WIN32
+	u_long nonblocking = 1;
+	ioctlsocket(sock, FIONBIO, &nonblocking);
+#else
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	if (bind(sock, (const sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		mux_close_(sock);
+		return MUX_INVALID_SOCKET;
+	}
+
+	return sock;
+}
+
+static pj_uint16_t bound_port_(mux_socket_t sock)
+{
+	sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	if (getsockname(sock, (sockaddr*)&addr, &len) != 0)
+		return 0;
+
+	return ntohs(addr.sin_port);
+}
+
+//=============================================================================
+MediaMux::MediaMux(unsigned batch)
+	: rtp_sock_(MUX_INVALID_SOCKET), rtcp_sock_(MUX_INVALID_SOCKET), rtp_port_(0), rtcp_port_(0),
+	  running_(false), receiver_(NULL), sender_(NULL), dropped_(0)
+{
+	batch_ = (batch < 1) ? 1 : (batch > MEDIAMUX_BATCH_MAX ? MEDIAMUX_BATCH_MAX : batch);
+}
+
+MediaMux::~MediaMux()
+{
+	Close();
+
+	for (size_t i = 0; i < free_.size(); i++)
+		delete free_[i];
+}
+
+pj_status_t MediaMux::Open(const sockaddr_in& addr)
+{
+	rtp_sock_ = open_socket_(addr);
+	if (rtp_sock_ == MUX_INVALID_SOCKET)
+		return PJ_RETURN_OS_ERROR(mux_error_());
+
+	rtp_port_ = bound_port_(rtp_sock_);
+
+	// RTCP on the next port, as SDP without a=rtcp says
+	sockaddr_in rtcp_addr = addr;
+	rtcp_addr.sin_port = htons((u_short)(rtp_port_ + 1));
+
+	rtcp_sock_ = open_socket_(rtcp_addr);
+	if (rtcp_sock_ == MUX_INVALID_SOCKET)
+	{
+		pj_status_t status = PJ_RETURN_OS_ERROR(mux_error_());
+		mux_close_(rtp_sock_);
+		rtp_sock_ = MUX_INVALID_SOCKET;
+		return status;
+	}
+
+	rtcp_port_ = rtp_port_ + 1;
+
+	for (unsigned i = 0; i < batch_; i++)
+		rx_buffers_.push_back(new char[MEDIAMUX_PACKET_MAX]);
+
+	running_ = true;
+	receiver_ = new boost::thread(&MediaMux::receive_, this);
+	sender_ = new boost::thread(&MediaMux::send_, this);
+
+	return PJ_SUCCESS;
+}
+
+void MediaMux::Close()
+{
+	if (!running_)
+		return;
+
+	{
+		boost::mutex::scoped_lock lock(queue_mutex_);
+		running_ = false;
+	}
+	queue_cond_.notify_all();
+
+	receiver_->join();
+	sender_->join();
+	delete receiver_;
+	delete sender_;
+	receiver_ = sender_ = NULL;
+
+	mux_close_(rtp_sock_);
+	mux_close_(rtcp_sock_);
+	rtp_sock_ = rtcp_sock_ = MUX_INVALID_SOCKET;
+
+	for (size_t i = 0; i < rx_buffers_.size(); i++)
+		delete [] rx_buffers_[i];
+	rx_buffers_.clear();
+
+	// whatever the sender did not get to
+	free_.insert(free_.end(), queue_.begin(), queue_.end());
+	queue_.clear();
+}
+
+//=============================================================================
+pj_uint64_t MediaMux::key_(const sockaddr_in& addr)
+{
+	return ((pj_uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+}
+
+pj_status_t MediaMux::Attach(MuxChannel *channel, const sockaddr_in& rtp_remote, const sockaddr_in& rtcp_remote)
+{
+	// a channel attached again takes its new addresses
+	Detach(channel);
+
+	boost::mutex::scoped_lock lock(mutex_);
+
+	if (rtp_channels_.find(key_(rtp_remote)) != rtp_channels_.end()
+		|| rtcp_channels_.find(key_(rtcp_remote)) != rtcp_channels_.end())
+		return PJ_EEXISTS;
+
+	channel->rtp_remote_ = rtp_remote;
+	channel->rtcp_remote_ = rtcp_remote;
+	channel->has_ssrc_ = false;
+	channel->probation_end_ = boost::posix_time::microsec_clock::universal_time()
+		+ boost::posix_time::milliseconds(MEDIAMUX_PROBATION_MSEC);
+
+	rtp_channels_[key_(rtp_remote)] = channel;
+	rtcp_channels_[key_(rtcp_remote)] = channel;
+	return PJ_SUCCESS;
+}
+
+static void erase_channel_(map<pj_uint64_t, MuxChannel*>& channels, MuxChannel *channel)
+{
+	for (map<pj_uint64_t, MuxChannel*>::iterator ite = channels.begin(); ite != channels.end(); )
+	{
+		if (ite->second == channel)
+			channels.erase(ite++);
+		else
+			++ite;
+	}
+}
+
+void MediaMux::Detach(MuxChannel *channel)
+{
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		erase_channel_(rtp_channels_, channel);
+		erase_channel_(rtcp_channels_, channel);
+
+		if (channel->has_ssrc_)
+		{
+			SsrcMap::iterator ite = ssrc_channels_.find(channel->ssrc_);
+			if (ite != ssrc_channels_.end() && ite->second == channel)
+				ssrc_channels_.erase(ite);
+			channel->has_ssrc_ = false;
+		}
+	}
+
+	// wait for the batch being handed out, which may still have the
+	// channel's packets; from the receive thread itself that is this one
+	if (receiver_ != NULL && boost::this_thread::get_id() != receiver_->get_id())
+	{
+		boost::mutex::scoped_lock lock(dispatch_mutex_);
+	}
+}
+
+MediaMuxStats MediaMux::Stats()
+{
+	MediaMuxStats stats;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stats = stats_;
+	}
+	{
+		boost::mutex::scoped_lock lock(queue_mutex_);
+		stats.dropped += dropped_;
+	}
+	return stats;
+}
+
+//=============================================================================
+void MediaMux::receive_()
+{
+	pj_thread_desc desc;
+	pj_thread_t *thread;
+	pj_thread_register("mediamux_rx", desc, &thread);
+
+	mux_socket_t highest = (rtp_sock_ > rtcp_sock_) ? rtp_sock_ : rtcp_sock_;
+
+	while (running_)
+	{
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(rtp_sock_, &readable);
+		FD_SET(rtcp_sock_, &readable);
+
+		// wakes up now and then to see if it is closed
+		timeval timeout = { 0, 100000 };
+
+		if (select((int)highest + 1, &readable, NULL, NULL, &timeout) <= 0)
+			continue;
+
+		// a full batch means there may be more waiting
+		if (FD_ISSET(rtp_sock_, &readable))
+			while (receive_batch_(rtp_sock_, false) == batch_) ;
+
+		if (FD_ISSET(rtcp_sock_, &readable))
+			while (receive_batch_(rtcp_sock_, true) == batch_) ;
+	}
+}
+
+unsigned MediaMux::receive_batch_(mux_socket_t sock, bool rtcp)
+{
+	sockaddr_in from[MEDIAMUX_BATCH_MAX];
+	pj_ssize_t size[MEDIAMUX_BATCH_MAX];
+	unsigned count = 0;
+	unsigned long calls = 0;
+
+#ifdef MEDIAMUX_MMSG
+	mmsghdr msgs[MEDIAMUX_BATCH_MAX];
+	iovec iov[MEDIAMUX_BATCH_MAX];
+
+	memset(msgs, 0, sizeof(msgs[0]) * batch_);
+	for (unsigned i = 0; i < batch_; i++)
+	{
+		iov[i].iov_base = rx_buffers_[i];
+		iov[i].iov_len = MEDIAMUX_PACKET_MAX;
+		msgs[i].msg_hdr.msg_name = &from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int n = recvmmsg(sock, msgs, batch_, MSG_DONTWAIT, NULL);
+	calls++;
+
+	for (int i = 0; i < n; i++)
+		size[i] = msgs[i].msg_len;
+	count = (n > 0) ? n : 0;
+#else
+	for (; count < batch_; count++)
+	{
+		socklen_t len = sizeof(from[count]);
+		int n = recvfrom(sock, rx_buffers_[count], MEDIAMUX_PACKET_MAX, 0, (sockaddr*)&from[count], &len);
+		calls++;
+
+		if (n < 0)
+			break;
+		size[count] = n;
+	}
+#endif
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stats_.rx_calls += calls;
+		stats_.rx_packets += count;
+	}
+
+	boost::mutex::scoped_lock lock(dispatch_mutex_);
+
+	for (unsigned i = 0; i < count; i++)
+		dispatch_(rtcp, from[i], rx_buffers_[i], size[i]);
+
+	return count;
+}
+
+void MediaMux::dispatch_(bool rtcp, const sockaddr_in& from, char *pkt, pj_ssize_t size)
+{
+	MuxChannel *channel = NULL;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		AddressMap& channels = rtcp ? rtcp_channels_ : rtp_channels_;
+		AddressMap::iterator ite = channels.find(key_(from));
+		if (ite != channels.end())
+			channel = ite->second;
+
+		// the sender's SSRC: RTP has it at 8, RTCP reports at 4
+		unsigned offset = rtcp ? 4 : 8;
+		if (size >= (pj_ssize_t)(offset + 4))
+		{
+			pj_uint32_t ssrc;
+			memcpy(&ssrc, pkt + offset, 4);
+
+			if (channel == NULL)
+			{
+				// the remote's address changed, as pjmedia's UDP transport
+				// does the call follows it. Anyone may send a known SSRC,
+				// so past the probation only a NAT's new port is taken:
+				// the call's media is not sent to another host on its say.
+				SsrcMap::iterator s = ssrc_channels_.find(ssrc);
+				if (s != ssrc_channels_.end())
+				{
+					channel = s->second;
+					sockaddr_in& remote = rtcp ? channel->rtcp_remote_ : channel->rtp_remote_;
+
+					if (from.sin_addr.s_addr != remote.sin_addr.s_addr
+						&& boost::posix_time::microsec_clock::universal_time() >= channel->probation_end_)
+					{
+						stats_.refused++;
+						return;
+					}
+
+					channels.erase(key_(remote));
+					remote = from;
+					channels[key_(from)] = channel;
+				}
+			}
+			else if (!rtcp && (!channel->has_ssrc_ || channel->ssrc_ != ssrc))
+			{
+				if (channel->has_ssrc_)
+					ssrc_channels_.erase(channel->ssrc_);
+
+				channel->has_ssrc_ = true;
+				channel->ssrc_ = ssrc;
+				ssrc_channels_[ssrc] = channel;
+			}
+		}
+
+		if (channel == NULL)
+		{
+			stats_.unknown++;
+			return;
+		}
+	}
+
+	if (rtcp)
+		channel->OnRtcp(pkt, size);
+	else
+		channel->OnRtp(pkt, size);
+}
+
+//=============================================================================
+pj_status_t MediaMux::Send(MuxChannel *channel, bool rtcp, const void *pkt, pj_size_t size)
+{
+	sockaddr_in to;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		to = rtcp ? channel->rtcp_remote_ : channel->rtp_remote_;
+	}
+
+	return SendTo(to, rtcp, pkt, size);
+}
+
+pj_status_t MediaMux::SendTo(const sockaddr_in& to, bool rtcp, const void *pkt, pj_size_t size)
+{
+	if (size > MEDIAMUX_PACKET_MAX)
+		return PJ_EINVAL;
+
+	boost::mutex::scoped_lock lock(queue_mutex_);
+
+	if (!running_)
+		return PJ_EINVALIDOP;
+
+	if (queue_.size() >= MEDIAMUX_QUEUE_MAX)
+	{
+		dropped_++;
+		return PJ_ETOOMANY;
+	}
+
+	Packet *p;
+	if (free_.empty())
+		p = new Packet;
+	else
+	{
+		p = free_.back();
+		free_.pop_back();
+	}
+
+	p->rtcp = rtcp;
+	p->to = to;
+	p->size = size;
+	memcpy(p->data, pkt, size);
+
+	queue_.push_back(p);
+
+	// the first wakes the sender, a full batch cuts its wait short
+	if (queue_.size() == 1 || queue_.size() == batch_)
+		queue_cond_.notify_one();
+
+	return PJ_SUCCESS;
+}
+
+void MediaMux::send_()
+{
+	pj_thread_desc desc;
+	pj_thread_t *thread;
+	pj_thread_register("mediamux_tx", desc, &thread);
+
+	vector<Packet*> packets;
+
+	for (;;)
+	{
+		{
+			boost::mutex::scoped_lock lock(queue_mutex_);
+
+			while (running_ && queue_.empty())
+				queue_cond_.wait(lock);
+
+			if (!running_)
+				return;
+
+			// the rest of the bridge's tick joins in, up to a batch
+			boost::system_time deadline = boost::get_system_time()
+				+ boost::posix_time::microseconds(MEDIAMUX_COALESCE_USEC);
+
+			while (running_ && queue_.size() < batch_)
+			{
+				if (!queue_cond_.timed_wait(lock, deadline))
+					break;
+			}
+
+			packets.swap(queue_);
+		}
+
+		send_batch_(packets);
+
+		boost::mutex::scoped_lock lock(queue_mutex_);
+		free_.insert(free_.end(), packets.begin(), packets.end());
+		packets.clear();
+	}
+}
+
+void MediaMux::send_batch_(vector<Packet*>& packets)
+{
+	unsigned long calls = 0;
+	unsigned long sent = 0;
+	unsigned long dropped = 0;
+
+	size_t i = 0;
+	while (i < packets.size())
+	{
+		// one system call takes the packets of one socket
+		bool rtcp = packets[i]->rtcp;
+		mux_socket_t sock = rtcp ? rtcp_sock_ : rtp_sock_;
+
+		unsigned count = 0;
+		while (i + count < packets.size() && count < batch_ && packets[i + count]->rtcp == rtcp)
+			count++;
+
+#ifdef MEDIAMUX_MMSG
+		mmsghdr msgs[MEDIAMUX_BATCH_MAX];
+		iovec iov[MEDIAMUX_BATCH_MAX];
+
+		memset(msgs, 0, sizeof(msgs[0]) * count);
+		for (unsigned k = 0; k < count; k++)
+		{
+			Packet *p = packets[i + k];
+			iov[k].iov_base = p->data;
+			iov[k].iov_len = p->size;
+			msgs[k].msg_hdr.msg_name = &p->to;
+			msgs[k].msg_hdr.msg_namelen = sizeof(p->to);
+			msgs[k].msg_hdr.msg_iov = &iov[k];
+			msgs[k].msg_hdr.msg_iovlen = 1;
+		}
+
+		unsigned done = 0;
+		while (done < count)
+		{
+			int n = sendmmsg(sock, msgs + done, count - done, 0);
+			calls++;
+
+			// the socket buffer is full, like a lost packet to RTP
+			if (n <= 0)
+			{
+				dropped += count - done;
+				break;
+			}
+			done += n;
+		}
+		sent += done;
+#else
+		for (unsigned k = 0; k < count; k++)
+		{
+			Packet *p = packets[i + k];
+			int n = sendto(sock, p->data, (int)p->size, 0, (const sockaddr*)&p->to, sizeof(p->to));
+			calls++;
+
+			if (n < 0)
+				dropped++;
+			else
+				sent++;
+		}
+#endif
+
+		i += count;
+	}
+
+	boost::mutex::scoped_lock lock(mutex_);
+	stats_.tx_calls += calls;
+	stats_.tx_packets += sent;
+	stats_.dropped += dropped;
+}
+
+//=============================================================================
+pjmedia_transport_op MuxTransport::op_ =
+{
+	&MuxTransport::get_info_,
+	&MuxTransport::attach_,
+	&MuxTransport::detach_,
+	&MuxTransport::send_rtp_,
+	&MuxTransport::send_rtcp_,
+	&MuxTransport::send_rtcp2_,
+	&MuxTransport::media_create_,
+	&MuxTransport::encode_sdp_,
+	&MuxTransport::media_start_,
+	&MuxTransport::media_stop_,
+	&MuxTransport::simulate_lost_,
+	&MuxTransport::destroy_
+};
+
+// IPv4 only, like the mux
+static bool to_sockaddr_(const pj_sockaddr_t *addr, sockaddr_in *out)
+{
+	const pj_sockaddr *a = (const pj_sockaddr*)addr;
+
+	if (a == NULL || a->addr.sa_family != pj_AF_INET())
+		return false;
+
+	memset(out, 0, sizeof(*out));
+	out->sin_family = AF_INET;
+	out->sin_port = a->ipv4.sin_port;
+	out->sin_addr.s_addr = a->ipv4.sin_addr.s_addr;
+
+	return true;
+}
+
+MuxTransport::MuxTransport(MediaMux *mux, const pj_sockaddr& public_addr, int index)
+	: mux_(mux), public_addr_(public_addr), user_data_(NULL), rtp_cb_(NULL), rtcp_cb_(NULL)
+{
+	memset(&tp_, 0, sizeof(tp_));
+
+	stringstream name;
+	name << "mux" << index;
+	strncpy(tp_.name, name.str().c_str(), sizeof(tp_.name) - 1);
+
+	tp_.type = PJMEDIA_TRANSPORT_TYPE_USER;
+	tp_.op = &op_;
+	tp_.user_data = this;
+}
+
+void MuxTransport::GetSockInfo(pjmedia_sock_info *info)
+{
+	memset(info, 0, sizeof(*info));
+
+	// every call has the same ports, told apart by the remote
+	info->rtp_sock = mux_->RtpSocket();
+	info->rtp_addr_name = public_addr_;
+	info->rtp_addr_name.ipv4.sin_port = pj_htons(mux_->RtpPort());
+
+	info->rtcp_sock = mux_->RtcpSocket();
+	info->rtcp_addr_name = public_addr_;
+	info->rtcp_addr_name.ipv4.sin_port = pj_htons(mux_->RtcpPort());
+}
+
+void MuxTransport::OnRtp(void *pkt, pj_ssize_t size)
+{
+	if (rtp_cb_ != NULL)
+		(*rtp_cb_)(user_data_, pkt, size);
+}
+
+void MuxTransport::OnRtcp(void *pkt, pj_ssize_t size)
+{
+	if (rtcp_cb_ != NULL)
+		(*rtcp_cb_)(user_data_, pkt, size);
+}
+
+pj_status_t MuxTransport::get_info_(pjmedia_transport *tp, pjmedia_transport_info *info)
+{
+	MuxTransport *self = (MuxTransport*)tp->user_data;
+
+	self->GetSockInfo(&info->sock_info);
+	return PJ_SUCCESS;
+}
+
+pj_status_t MuxTransport::attach_(pjmedia_transport *tp, void *user_data,
+								  const pj_sockaddr_t *rem_addr, const pj_sockaddr_t *rem_rtcp, unsigned addr_len,
+								  void (*rtp_cb)(void*, void*, pj_ssize_t),
+								  void (*rtcp_cb)(void*, void*, pj_ssize_t))
+{
+	MuxTransport *self = (MuxTransport*)tp->user_data;
+	sockaddr_in rtp, rtcp;
+
+	if (!to_sockaddr_(rem_addr, &rtp))
+		return PJ_EINVAL;
+
+	if (!to_sockaddr_(rem_rtcp, &rtcp) || rtcp.sin_port == 0)
+	{
+		rtcp = rtp;
+		rtcp.sin_port = htons((u_short)(ntohs(rtp.sin_port) + 1));
+	}
+
+	self->user_data_ = user_data;
+	self->rtp_cb_ = rtp_cb;
+	self->rtcp_cb_ = rtcp_cb;
+
+	pj_status_t status = self->mux_->Attach(self, rtp, rtcp);
+	if (status != PJ_SUCCESS)
+	{
+		self->rtp_cb_ = NULL;
+		self->rtcp_cb_ = NULL;
+	}
+
+	return status;
+}
+
+void MuxTransport::detach_(pjmedia_transport *tp, void *user_data)
+{
+	MuxTransport *self = (MuxTransport*)tp->user_data;
+
+	self->mux_->Detach(self);
+
+	self->rtp_cb_ = NULL;
+	self->rtcp_cb_ = NULL;
+	self->user_data_ = NULL;
+}
+
+pj_status_t MuxTransport::send_rtp_(pjmedia_transport *tp, const void *pkt, pj_size_t size)
+{
+	MuxTransport *self = (MuxTransport*)tp->user_data;
+	return self->mux_->Send(self, false, pkt, size);
+}
+
+pj_status_t MuxTransport::send_rtcp_(pjmedia_transport *tp, const void *pkt, pj_size_t size)
+{
+	MuxTransport *self = (MuxTransport*)tp->user_data;
+	return self->mux_->Send(self, true, pkt, size);
+}
+
+pj_status_t MuxTransport::send_rtcp2_(pjmedia_transport *tp, const pj_sockaddr_t *addr, unsigned addr_len,
+									  const void *pkt, pj_size_t size)
+{
+	MuxTransport *self = (MuxTransport*)tp->user_data;
+	sockaddr_in to;
+
+	if (addr == NULL)
+		return self->mux_->Send(self, true, pkt, size);
+
+	if (!to_sockaddr_(addr, &to))
+		return PJ_EINVAL;
+
+	return self->mux_->SendTo(to, true, pkt, size);
+}
+
+// nothing to add to SDP or to set up per call: the sockets are already there
+pj_status_t MuxTransport::media_create_(pjmedia_transport*, pj_pool_t*, unsigned, const pjmedia_sdp_session*, unsigned)
+{
+	return PJ_SUCCESS;
+}
+
+pj_status_t MuxTransport::encode_sdp_(pjmedia_transport*, pj_pool_t*, pjmedia_sdp_session*, const pjmedia_sdp_session*, unsigned)
+{
+	return PJ_SUCCESS;
+}
+
+pj_status_t MuxTransport::media_start_(pjmedia_transport*, pj_pool_t*, const pjmedia_sdp_session*, const pjmedia_sdp_session*, unsigned)
+{
+	return PJ_SUCCESS;
+}
+
+pj_status_t MuxTransport::media_stop_(pjmedia_transport*)
+{
+	return PJ_SUCCESS;
+}
+
+pj_status_t MuxTransport::simulate_lost_(pjmedia_transport*, pjmedia_dir, unsigned)
+{
+	return PJ_ENOTSUP;
+}
+
+// the transports go with the mux, after pjsua is done with them
+pj_status_t MuxTransport::destroy_(pjmedia_transport*)
+{
+	return PJ_SUCCESS;
+}
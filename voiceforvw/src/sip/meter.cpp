@@ -0,0 +1,108 @@
+/* meter.cpp -- signal meter module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <meter.hpp>
+
+#include <cmath>
+
+#define METER_SIGNATURE		PJMEDIA_PORT_SIGNATURE('S', 'L', 'M', 'T')
+
+// 200 msec of quiet before speaking stops, so it doesn't flicker
+// between words
+#define METER_HANGOVER		10
+
+#define METER_SPEAKING		0x10000
+
+//=============================================================================
+MeterReading read_meter(const MeterSnapshot& snapshot)
+{
+	pj_uint32_t word = snapshot;
+
+	MeterReading r;
+	r.level = word & 0xff;
+	r.peak = (word >> 8) & 0xff;
+	r.speaking = (word & METER_SPEAKING) != 0;
+
+	return r;
+}
+
+// the conference bridge's scale: the inverted u-law code of the level
+static unsigned level_(unsigned linear)
+{
+	return pjmedia_linear2ulaw(linear > 32767 ? 32767 : linear) ^ 0xff;
+}
+
+//=============================================================================
+MeterPort::MeterPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame,
+					 unsigned on_level, unsigned off_level, MeterSnapshot *snapshot)
+	: channel_count_(channel_count), on_level_(on_level), off_level_(off_level),
+	  speaking_(false), quiet_frames_(0), snapshot_(snapshot)
+{
+	const pj_str_t name = pj_str((char*)"meter");
+
+	pjmedia_port_info_init(&port_.info, &name, METER_SIGNATURE,
+		clock_rate, channel_count, 16, samples_per_frame);
+
+	port_.port_data.user_data = this;
+	port_.put_frame = &put_frame_;
+	port_.get_frame = &get_frame_;
+	port_.on_destroy = NULL;
+
+	*snapshot_ = 0;
+}
+
+pj_status_t MeterPort::put_frame_(pjmedia_port *port, const pjmedia_frame *frame)
+{
+	MeterPort *self = (MeterPort*)port->port_data.user_data;
+
+	unsigned level = 0;
+	unsigned peak = 0;
+
+	if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO && frame->size > 0)
+	{
+		// the microphone is mono, a stereo bridge duplicates it
+		const pj_int16_t *samples = (const pj_int16_t*)frame->buf;
+		unsigned channels = self->channel_count_;
+		unsigned count = frame->size / sizeof(pj_int16_t) / channels;
+
+		double sum = 0.0;
+		unsigned max = 0;
+		for (unsigned i = 0; i < count; i++)
+		{
+			int s = samples[channels * i];
+			sum += (double)s * s;
+
+			unsigned a = (unsigned)abs(s);
+			if (a > max)
+				max = a;
+		}
+
+		level = level_((unsigned)sqrt(sum / count));
+		peak = level_(max);
+	}
+
+	if (level >= self->on_level_)
+	{
+		self->speaking_ = true;
+		self->quiet_frames_ = 0;
+	}
+	else if (level >= self->off_level_)
+		self->quiet_frames_ = 0;
+	else if (self->speaking_ && ++self->quiet_frames_ >= METER_HANGOVER)
+		self->speaking_ = false;
+
+	*self->snapshot_ = level | (peak << 8) | (self->speaking_ ? METER_SPEAKING : 0);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t MeterPort::get_frame_(pjmedia_port *port, pjmedia_frame *frame)
+{
+	// the meter only listens
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	frame->size = 0;
+	return PJ_SUCCESS;
+}
@@ -0,0 +1,278 @@
+/* mixer.cpp -- audio mixer module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <mixer.hpp>
+
+// the widest instruction set the compiler targets, picked at build time
+// like spatial_pan: -mavx2 (or /arch:AVX2) gets the AVX2 kernels
+#if defined(__AVX2__)
+#define VFVW_MIXER_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VFVW_MIXER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VFVW_MIXER_NEON
+#include <arm_neon.h>
+#endif
+
+#define MIXER_SIGNATURE		PJMEDIA_PORT_SIGNATURE('S', 'L', 'M', 'X')
+
+//=============================================================================
+pj_int16_t mix_gain(float gain)
+{
+	float q = gain * MIXER_GAIN_UNITY + 0.5f;
+
+	if (q <= 0.0f)
+		return 0;
+	if (q >= 32767.0f)
+		return 32767;
+
+	return (pj_int16_t)q;
+}
+
+//=============================================================================
+void mix_accumulate_scalar(pj_int32_t *acc, const pj_int16_t *in, unsigned count, pj_int16_t gain)
+{
+	if (gain == MIXER_GAIN_UNITY)
+	{
+		for (unsigned i = 0; i < count; i++)
+			acc[i] += in[i];
+		return;
+	}
+
+	for (unsigned i = 0; i < count; i++)
+		acc[i] += ((pj_int32_t)in[i] * gain) >> MIXER_GAIN_SHIFT;
+}
+
+void mix_saturate_scalar(const pj_int32_t *acc, pj_int16_t *out, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++)
+	{
+		pj_int32_t v = acc[i];
+		out[i] = (pj_int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+	}
+}
+
+#if defined(VFVW_MIXER_AVX2)
+
+void mix_accumulate(pj_int32_t *acc, const pj_int16_t *in, unsigned count, pj_int16_t gain)
+{
+	__m256i g = _mm256_set1_epi32(gain);
+
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+		if (gain != MIXER_GAIN_UNITY)
+			s = _mm256_srai_epi32(_mm256_mullo_epi32(s, g), MIXER_GAIN_SHIFT);
+
+		__m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+		_mm256_storeu_si256((__m256i*)(acc + i), _mm256_add_epi32(a, s));
+	}
+
+	mix_accumulate_scalar(acc + i, in + i, count - i, gain);
+}
+
+void mix_saturate(const pj_int32_t *acc, pj_int16_t *out, unsigned count)
+{
+	unsigned i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(acc + i + 8));
+
+		// packs works within each 128 bit lane: a0-3 b0-3 a4-7 b4-7
+		__m256i s = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(out + i), s);
+	}
+
+	mix_saturate_scalar(acc + i, out + i, count - i);
+}
+
+const char* mix_kernels() { return "avx2"; }
+
+#elif defined(VFVW_MIXER_SSE2)
+
+void mix_accumulate(pj_int32_t *acc, const pj_int16_t *in, unsigned count, pj_int16_t gain)
+{
+	__m128i g = _mm_set1_epi16(gain);
+
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i lo, hi;
+
+		if (gain == MIXER_GAIN_UNITY)
+		{
+			// sign extended to 32 bit
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		}
+		else
+		{
+			// the full 32 bit products from their low and high halves
+			__m128i pl = _mm_mullo_epi16(s, g);
+			__m128i ph = _mm_mulhi_epi16(s, g);
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(pl, ph), MIXER_GAIN_SHIFT);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(pl, ph), MIXER_GAIN_SHIFT);
+		}
+
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(acc + i));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(acc + i + 4));
+		_mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi32(a0, lo));
+		_mm_storeu_si128((__m128i*)(acc + i + 4), _mm_add_epi32(a1, hi));
+	}
+
+	mix_accumulate_scalar(acc + i, in + i, count - i, gain);
+}
+
+void mix_saturate(const pj_int32_t *acc, pj_int16_t *out, unsigned count)
+{
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(acc + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(acc + i + 4));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(a, b));
+	}
+
+	mix_saturate_scalar(acc + i, out + i, count - i);
+}
+
+const char* mix_kernels() { return "sse2"; }
+
+#elif defined(VFVW_MIXER_NEON)
+
+void mix_accumulate(pj_int32_t *acc, const pj_int16_t *in, unsigned count, pj_int16_t gain)
+{
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		int16x8_t s = vld1q_s16(in + i);
+		int32x4_t lo, hi;
+
+		if (gain == MIXER_GAIN_UNITY)
+		{
+			lo = vmovl_s16(vget_low_s16(s));
+			hi = vmovl_s16(vget_high_s16(s));
+		}
+		else
+		{
+			lo = vshrq_n_s32(vmull_n_s16(vget_low_s16(s), gain), MIXER_GAIN_SHIFT);
+			hi = vshrq_n_s32(vmull_n_s16(vget_high_s16(s), gain), MIXER_GAIN_SHIFT);
+		}
+
+		vst1q_s32(acc + i, vaddq_s32(vld1q_s32(acc + i), lo));
+		vst1q_s32(acc + i + 4, vaddq_s32(vld1q_s32(acc + i + 4), hi));
+	}
+
+	mix_accumulate_scalar(acc + i, in + i, count - i, gain);
+}
+
+void mix_saturate(const pj_int32_t *acc, pj_int16_t *out, unsigned count)
+{
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		int16x8_t s = vcombine_s16(vqmovn_s32(vld1q_s32(acc + i)), vqmovn_s32(vld1q_s32(acc + i + 4)));
+		vst1q_s16(out + i, s);
+	}
+
+	mix_saturate_scalar(acc + i, out + i, count - i);
+}
+
+const char* mix_kernels() { return "neon"; }
+
+#else
+
+void mix_accumulate(pj_int32_t *acc, const pj_int16_t *in, unsigned count, pj_int16_t gain)
+{
+	mix_accumulate_scalar(acc, in, count, gain);
+}
+
+void mix_saturate(const pj_int32_t *acc, pj_int16_t *out, unsigned count)
+{
+	mix_saturate_scalar(acc, out, count);
+}
+
+const char* mix_kernels() { return "scalar"; }
+
+#endif
+
+//=============================================================================
+MixerPort::MixerPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame)
+{
+	const pj_str_t name = pj_str((char*)"mixer");
+
+	pjmedia_port_info_init(&port_.info, &name, MIXER_SIGNATURE,
+		clock_rate, channel_count, 16, samples_per_frame);
+
+	port_.port_data.user_data = this;
+	port_.put_frame = &put_frame_;
+	port_.get_frame = &get_frame_;
+	port_.on_destroy = NULL;
+
+	acc_ = new pj_int32_t[samples_per_frame];
+}
+
+MixerPort::~MixerPort()
+{
+	delete [] acc_;
+}
+
+void MixerPort::AddInput(SpatialPort *input)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	if (find(inputs_.begin(), inputs_.end(), input) == inputs_.end())
+		inputs_.push_back(input);
+}
+
+void MixerPort::RemoveInput(SpatialPort *input)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	inputs_.erase(remove(inputs_.begin(), inputs_.end(), input), inputs_.end());
+}
+
+pj_status_t MixerPort::put_frame_(pjmedia_port *port, const pjmedia_frame *frame)
+{
+	// nothing is connected to the mixer, the bridge may still send silence
+	return PJ_SUCCESS;
+}
+
+pj_status_t MixerPort::get_frame_(pjmedia_port *port, pjmedia_frame *frame)
+{
+	MixerPort *self = (MixerPort*)port->port_data.user_data;
+	unsigned count = port->info.samples_per_frame;
+
+	memset(self->acc_, 0, count * sizeof(pj_int32_t));
+
+	bool mixed = false;
+	{
+		boost::mutex::scoped_lock lock(self->mutex_);
+
+		for (size_t i = 0; i < self->inputs_.size(); i++)
+			mixed |= self->inputs_[i]->Mix(self->acc_);
+	}
+
+	// nobody is talking, the bridge doesn't need to mix anything either
+	if (!mixed)
+	{
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+		return PJ_SUCCESS;
+	}
+
+	mix_saturate(self->acc_, (pj_int16_t*)frame->buf, count);
+
+	frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame->size = port->info.bytes_per_frame;
+
+	return PJ_SUCCESS;
+}
@@ -6,13 +6,717 @@
 #include <main.h>
 #include <sip.hpp>
 
+// PJSUA_LOCK, for reoffer_codec_
+#include <pjsua-lib/pjsua_internal.h>
+
 static char*  g_current_call = NULL;
 static int regcount = 0;
 
-static int glb_tempConType = 0;
-static int glb_realConType = 0;
-static int glb_callingState = 0;
-static int gbl_CallInProgress = 0;
+// call id -> port taking the call out of the bridge, into the mixer or,
+// with SpatialAudio and no mixer, on to the sound device
+struct SpatialSlot
+{
+	SpatialPort *port;
+	pj_pool_t *pool;
+	pjsua_conf_port_id slot;
+	pjsua_conf_port_id call_slot;
+	bool audible;
+};
+
+static map<int, SpatialSlot> glb_spatialPorts;
+static boost::mutex glb_spatialMutex;
+
+// calls muted for this listener, connected neither to their SpatialPort
+// nor, without one, to the sound device. Guarded by glb_spatialMutex,
+// under which the calls are connected.
+static set<int> glb_unheardCalls;
+
+// call id -> its volume for this listener, which the call's SpatialPort
+// reads every frame. Without a SpatialPort the bridge applies it, in the
+// call's rx level with the speaker's level from AdjustRecvVolume.
+static SourceVolume glb_participantVolumes[PJSUA_MAX_CALLS];
+static float glb_speakerLevels[PJSUA_MAX_CALLS];
+
+// call id -> the level from AdjustTranVolume, given again to the call's
+// new slot after a media update
+static float glb_micLevels[PJSUA_MAX_CALLS];
+
+// set up with the SIP stack when SIMDMixer is on
+static MixerPort *glb_mixer = NULL;
+static pj_pool_t *glb_mixerPool = NULL;
+static pjsua_conf_port_id glb_mixerSlot = PJSUA_INVALID_ID;
+
+// set up with the SIP stack when a capture stage is on. The calls, their
+// gates and their meters take the microphone from glb_micSlot: the DSP
+// port's slot then, the sound device's otherwise.
+static DspPort *glb_dsp = NULL;
+static pj_pool_t *glb_dspPool = NULL;
+static pjsua_conf_port_id glb_dspSlot = PJSUA_INVALID_ID;
+static pjsua_conf_port_id glb_micSlot = 0;
+
+// the conference bridge's format, from the media profile
+static unsigned glb_channelCount = 1;
+static unsigned glb_clockRate = PJSUA_DEFAULT_CLOCK_RATE;
+static unsigned glb_framePtime = PJSUA_DEFAULT_AUDIO_FRAME_PTIME;
+
+// call id -> meter of the microphone as the call hears it
+struct MeterSlot
+{
+	MeterPort *port;
+	pj_pool_t *pool;
+	pjsua_conf_port_id slot;
+};
+
+static map<int, MeterSlot> glb_meterPorts;
+static boost::mutex glb_meterMutex;
+
+// set up with the SIP stack when MediaMux is on, one transport per call slot
+static MediaMux *glb_mediaMux = NULL;
+static vector<MuxTransport*> glb_muxTransports;
+
+// written by the meters, read by GetMeter without a lock
+static MeterSnapshot glb_meterSnapshots[PJSUA_MAX_CALLS];
+
+// call id -> VAD gate between the microphone and the call, with VADMode
+struct CaptureGate
+{
+	CapturePort *port;
+	pj_pool_t *pool;
+	pjsua_conf_port_id slot;
+};
+
+static map<int, CaptureGate> glb_capturePorts;
+static boost::mutex glb_captureMutex;
+
+// calls whose microphone is disconnected; taken on its own, never while
+// waiting for another of these mutexes
+static set<int> glb_mutedCalls;
+static boost::mutex glb_muteMutex;
+
+// call id -> the media session GetQuality may read. pjsua calls
+// on_stream_destroyed, which takes the call out, before it frees the
+// session, on hang up and on every re-INVITE alike; GetQuality holds the
+// mutex while it reads, so the session cannot go away under it.
+static map<int, pjmedia_session*> glb_qualitySessions;
+static boost::mutex glb_qualityMutex;
+
+// calls moving between AdaptiveCodecs, with their last sample. Taken on
+// its own; the reporter is its only caller besides on_call_state.
+struct AdaptSlot
+{
+	AdaptSlot(const CodecAdapter& a) : adapter(a), sampled(false) {}
+
+	CodecAdapter adapter;
+	CallQuality last;
+	bool sampled;
+};
+
+static map<int, AdaptSlot> glb_adaptCalls;
+static boost::mutex glb_adaptMutex;
+
+// held while the codec priorities are not those of configure_codecs_, so
+// that no other call made from here makes an offer from them; pjsua's own
+// answers are kept off them by its lock
+static boost::mutex glb_codecMutex;
+
+static bool is_muted_ (int call_id)
+{
+	boost::mutex::scoped_lock lock(glb_muteMutex);
+	return glb_mutedCalls.find(call_id) != glb_mutedCalls.end();
+}
+
+static unsigned samples_per_frame_ ()
+{
+	return glb_channelCount * glb_clockRate * glb_framePtime / 1000;
+}
+
+// with glb_spatialMutex held
+static bool is_heard_ (int call_id)
+{
+	return glb_unheardCalls.find(call_id) == glb_unheardCalls.end();
+}
+
+static float rx_level_ (int call_id)
+{
+	float level = glb_speakerLevels[call_id];
+	if (g_config->SpatialAudio || glb_mixer != NULL)
+		return level;
+
+	return level * glb_participantVolumes[call_id] / MIXER_GAIN_UNITY;
+}
+
+//=============================================================================
+// pjsua gives a call a new slot, without links, whenever its media is
+// updated: the add_*_port_ below are called again for every re-INVITE or
+// unhold, and link a port the call already has to its new slot.
+
+static void add_spatial_port_ (pjsua_call_id call_id, pjsua_conf_port_id call_slot)
+{
+	boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+	map<int, SpatialSlot>::iterator ite = glb_spatialPorts.find(call_id);
+	if (ite != glb_spatialPorts.end())
+	{
+		ite->second.call_slot = call_slot;
+		if (ite->second.audible && is_heard_(call_id))
+			pjsua_conf_connect(call_slot, ite->second.slot);
+		return;
+	}
+
+	SpatialSlot s;
+	s.port = new SpatialPort(glb_clockRate, glb_channelCount, samples_per_frame_(),
+		g_config->SpatialCulling ? g_config->SpatialQuietLevel : 0, &glb_participantVolumes[call_id]);
+	s.call_slot = call_slot;
+	s.audible = true;
+	s.pool = pjsua_pool_create("spatial", 512, 512);
+
+	if (pjsua_conf_add_port(s.pool, s.port->port(), &s.slot) != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Could not add spatial port, call " << call_id << " is not spatialized" << endl;
+		pj_pool_release(s.pool);
+		delete s.port;
+		if (is_heard_(call_id))
+			pjsua_conf_connect(call_slot, 0);
+		return;
+	}
+
+	if (is_heard_(call_id))
+		pjsua_conf_connect(call_slot, s.slot);
+
+	if (glb_mixer != NULL)
+		glb_mixer->AddInput(s.port);
+	else
+		pjsua_conf_connect(s.slot, 0);
+
+	glb_spatialPorts[call_id] = s;
+}
+
+// while the call is on hold its old slot may go to another call
+static void detach_spatial_port_ (pjsua_call_id call_id)
+{
+	boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+	map<int, SpatialSlot>::iterator ite = glb_spatialPorts.find(call_id);
+	if (ite != glb_spatialPorts.end())
+		ite->second.call_slot = PJSUA_INVALID_ID;
+}
+
+static void remove_spatial_port_ (pjsua_call_id call_id)
+{
+	boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+	map<int, SpatialSlot>::iterator ite = glb_spatialPorts.find(call_id);
+	if (ite == glb_spatialPorts.end())
+		return;
+
+	if (glb_mixer != NULL)
+		glb_mixer->RemoveInput(ite->second.port);
+
+	pjsua_conf_remove_port(ite->second.slot);
+	pj_pool_release(ite->second.pool);
+	delete ite->second.port;
+
+	glb_spatialPorts.erase(ite);
+}
+
+//=============================================================================
+static void add_meter_port_ (pjsua_call_id call_id, pjsua_conf_port_id call_slot)
+{
+	boost::mutex::scoped_lock lock(glb_meterMutex);
+
+	// the meter is linked to the microphone, not to the call's slot
+	if (glb_meterPorts.find(call_id) != glb_meterPorts.end())
+		return;
+
+	MeterSlot m;
+	m.port = new MeterPort(glb_clockRate, glb_channelCount, samples_per_frame_(),
+		g_config->SpeakingOnLevel, g_config->SpeakingOffLevel, &glb_meterSnapshots[call_id]);
+	m.pool = pjsua_pool_create("meter", 512, 512);
+
+	if (pjsua_conf_add_port(m.pool, m.port->port(), &m.slot) != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Could not add meter, call " << call_id << " shows no energy" << endl;
+		pj_pool_release(m.pool);
+		delete m.port;
+		return;
+	}
+
+	// the meter hears what the call does, at its volume and not while
+	// it is muted
+	pjsua_conf_port_info info;
+	if (pjsua_conf_get_port_info(call_slot, &info) == PJ_SUCCESS)
+		pjsua_conf_adjust_tx_level(m.slot, info.tx_level_adj);
+
+	if (!is_muted_(call_id))
+		pjsua_conf_connect(glb_micSlot, m.slot);
+
+	glb_meterPorts[call_id] = m;
+}
+
+static void remove_meter_port_ (pjsua_call_id call_id)
+{
+	boost::mutex::scoped_lock lock(glb_meterMutex);
+
+	map<int, MeterSlot>::iterator ite = glb_meterPorts.find(call_id);
+	if (ite == glb_meterPorts.end())
+		return;
+
+	pjsua_conf_remove_port(ite->second.slot);
+	pj_pool_release(ite->second.pool);
+	delete ite->second.port;
+
+	glb_meterPorts.erase(ite);
+	glb_meterSnapshots[call_id] = 0;
+}
+
+//=============================================================================
+static void add_capture_port_ (pjsua_call_id call_id, pjsua_conf_port_id call_slot)
+{
+	boost::mutex::scoped_lock lock(glb_captureMutex);
+
+	bool muted = is_muted_(call_id);
+
+	map<int, CaptureGate>::iterator ite = glb_capturePorts.find(call_id);
+	if (ite != glb_capturePorts.end())
+	{
+		if (!muted)
+			pjsua_conf_connect(ite->second.slot, call_slot);
+		return;
+	}
+
+	if (g_config->VADMode == VAD_MODE_OFF)
+	{
+		if (!muted)
+			pjsua_conf_connect(glb_micSlot, call_slot);
+		return;
+	}
+
+	CaptureGate c;
+	c.port = new CapturePort(glb_clockRate, glb_channelCount, samples_per_frame_(),
+		g_config->VADMode);
+	c.pool = pjsua_pool_create("capture", 512, 512);
+
+	if (pjsua_conf_add_port(c.pool, c.port->port(), &c.slot) != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Could not add VAD gate, call " << call_id << " sends silence too" << endl;
+		pj_pool_release(c.pool);
+		delete c.port;
+		if (!muted)
+			pjsua_conf_connect(glb_micSlot, call_slot);
+		return;
+	}
+
+	pjsua_conf_connect(glb_micSlot, c.slot);
+	if (!muted)
+		pjsua_conf_connect(c.slot, call_slot);
+
+	glb_capturePorts[call_id] = c;
+}
+
+static void free_capture_port_ (int call_id, const CaptureGate& c)
+{
+	unsigned long frames = c.port->Frames();
+	if (frames > 0)
+		g_logger->Info("SIP") << "Call " << call_id << " sent " << c.port->VoiceFrames() * 100 / frames
+			<< "% of " << frames << " frames" << endl;
+
+	pjsua_conf_remove_port(c.slot);
+	pj_pool_release(c.pool);
+	delete c.port;
+}
+
+static void remove_capture_port_ (pjsua_call_id call_id)
+{
+	boost::mutex::scoped_lock lock(glb_captureMutex);
+
+	map<int, CaptureGate>::iterator ite = glb_capturePorts.find(call_id);
+	if (ite == glb_capturePorts.end())
+		return;
+
+	free_capture_port_(call_id, ite->second);
+	glb_capturePorts.erase(ite);
+}
+
+//=============================================================================
+// The mixer is the only source of the sound device's slot. If it cannot be
+// added the calls are mixed by the bridge, as without SIMDMixer.
+
+static void start_mixer_ ()
+{
+	glb_mixer = new MixerPort(glb_clockRate, glb_channelCount, samples_per_frame_());
+	glb_mixerPool = pjsua_pool_create("mixer", 512, 512);
+
+	if (pjsua_conf_add_port(glb_mixerPool, glb_mixer->port(), &glb_mixerSlot) != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Could not add the mixer, the conference bridge mixes the calls" << endl;
+		pj_pool_release(glb_mixerPool);
+		delete glb_mixer;
+		glb_mixer = NULL;
+		return;
+	}
+
+	pjsua_conf_connect(glb_mixerSlot, 0);
+
+	g_logger->Info("SIP") << "Mixing calls with the " << mix_kernels() << " mixer" << endl;
+}
+
+//=============================================================================
+// The DSP port hears the sound device's slot before any call does. If it
+// cannot be added the calls take the microphone as it is.
+
+static void start_dsp_ ()
+{
+	glb_dsp = new DspPort(glb_clockRate, glb_channelCount, samples_per_frame_(),
+		g_config->CaptureHighPass, g_config->CaptureNoiseSuppression, g_config->CaptureAGC);
+	glb_dspPool = pjsua_pool_create("dsp", 512, 512);
+
+	if (pjsua_conf_add_port(glb_dspPool, glb_dsp->port(), &glb_dspSlot) != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Could not add the capture DSP, the microphone is sent unprocessed" << endl;
+		pj_pool_release(glb_dspPool);
+		delete glb_dsp;
+		glb_dsp = NULL;
+		return;
+	}
+
+	pjsua_conf_connect(0, glb_dspSlot);
+	glb_micSlot = glb_dspSlot;
+
+	g_logger->Info("SIP") << "Capture DSP:" << (g_config->CaptureHighPass ? " high-pass" : "")
+		<< (g_config->CaptureNoiseSuppression ? " noise-suppression" : "")
+		<< (g_config->CaptureAGC ? " agc" : "") << ", " << dsp_kernels() << " kernels" << endl;
+}
+
+static void stop_dsp_ ()
+{
+	if (glb_dsp == NULL)
+		return;
+
+	pjsua_conf_remove_port(glb_dspSlot);
+	pj_pool_release(glb_dspPool);
+	delete glb_dsp;
+	glb_dsp = NULL;
+	glb_dspSlot = PJSUA_INVALID_ID;
+	glb_micSlot = 0;
+}
+
+//=============================================================================
+// Codec priorities are set once, after pjsua_init: the codecs in Codecs
+// get 255, 254, ... in their order, above any default priority, and with
+// DisableOtherCodecs all the others are turned off. Every call offers
+// them in that order.
+
+static void configure_codecs_ ()
+{
+	pj_status_t status;
+
+	if (g_config->DisableOtherCodecs && !g_config->Codecs.empty())
+	{
+		pjsua_codec_info id[64];
+		unsigned int count = PJ_ARRAY_SIZE(id);
+
+		status = pjsua_enum_codecs(id, &count);
+		if (status != PJ_SUCCESS)
+		{
+			g_logger->Warn("SIP") << "Error enumerating codecs, the other codecs stay enabled" << endl;
+			count = 0;
+		}
+		else
+			g_logger->Info("SIP") << "Disabling the " << count << " codecs not selected" << endl;
+
+		for (unsigned int i = 0; i < count; i++)
+			pjsua_codec_set_priority(&(id[i].codec_id), 0);
+	}
+
+	pj_uint8_t priority = 255;
+
+	for (size_t i = 0; i < g_config->Codecs.size() && priority > 0; i++)
+	{
+		const pj_str_t codec_name = pj_str(const_cast <char*>(g_config->Codecs[i].c_str()));
+
+		status = pjsua_codec_set_priority(&codec_name, priority);
+		if (status != PJ_SUCCESS)
+		{
+			g_logger->Warn("SIP") << "Selected codec " << g_config->Codecs[i] << " could not be enabled" << endl;
+			continue;
+		}
+
+		g_logger->Info("SIP") << "Codec " << g_config->Codecs[i] << " was set to priority " << (int)priority << endl;
+		priority--;
+	}
+
+	// the adaptive codecs a call may be moved to must be enabled as well,
+	// under the ones calls start with
+	for (size_t i = 0; i < g_config->AdaptiveCodecs.size() && priority > 0; i++)
+	{
+		const string& name = g_config->AdaptiveCodecs[i];
+		if (find(g_config->Codecs.begin(), g_config->Codecs.end(), name) != g_config->Codecs.end())
+			continue;
+
+		const pj_str_t codec_name = pj_str(const_cast <char*>(name.c_str()));
+
+		status = pjsua_codec_set_priority(&codec_name, priority);
+		if (status != PJ_SUCCESS)
+		{
+			g_logger->Warn("SIP") << "Adaptive codec " << name << " could not be enabled" << endl;
+			continue;
+		}
+
+		priority--;
+	}
+}
+
+//=============================================================================
+// Offers a call only the adaptive codec it is moving to, in a re-INVITE:
+// every codec pjsua has is turned off for it, as DisableOtherCodecs does,
+// so that the remote cannot answer with another. pjsua builds the offer
+// from the codec priorities before it returns, so they are put back right
+// after. The priorities are pjsua's, not the call's: its lock is held all
+// along, so that an INVITE or re-INVITE answered on its thread meanwhile
+// does not see only this codec. pjsua takes it for the call in turn; if
+// that times out, the re-INVITE fails and is tried again after the hold.
+
+static pj_status_t reoffer_codec_ (pjsua_call_id call_id, const string& codec)
+{
+	boost::mutex::scoped_lock lock(glb_codecMutex);
+
+	PJSUA_LOCK();
+
+	pjsua_codec_info id[64];
+	unsigned int count = PJ_ARRAY_SIZE(id);
+
+	pj_status_t status = pjsua_enum_codecs(id, &count);
+	if (status != PJ_SUCCESS)
+	{
+		PJSUA_UNLOCK();
+		return status;
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+		pjsua_codec_set_priority(&(id[i].codec_id), 0);
+
+	const pj_str_t codec_name = pj_str(const_cast <char*>(codec.c_str()));
+	status = pjsua_codec_set_priority(&codec_name, 255);
+
+	if (status == PJ_SUCCESS)
+		status = pjsua_call_reinvite(call_id, PJ_TRUE, NULL);
+
+	// every codec, the target included, goes back to the priority it had
+	for (unsigned int i = 0; i < count; i++)
+		pjsua_codec_set_priority(&(id[i].codec_id), id[i].priority);
+
+	PJSUA_UNLOCK();
+	return status;
+}
+
+//=============================================================================
+// With MediaMux every call slot gets a MuxTransport over one shared pair of
+// sockets instead of pjsua's own UDP transports. It has to be attached
+// before pjsua_start; if it cannot be, pjsua makes its own as usual.
+
+static void stop_media_mux_ ();
+
+static bool start_media_mux_ (unsigned max_calls)
+{
+	pj_sockaddr public_addr;
+	if (pj_gethostip(pj_AF_INET(), &public_addr) != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "No IPv4 address for MediaMux, each call gets its own ports" << endl;
+		return false;
+	}
+
+	sockaddr_in bind_addr;
+	memset(&bind_addr, 0, sizeof(bind_addr));
+	bind_addr.sin_family = AF_INET;
+	bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	bind_addr.sin_port = htons((u_short)g_config->MediaMuxPort);
+
+	glb_mediaMux = new MediaMux(g_config->MediaMuxBatch > 0 ? g_config->MediaMuxBatch : 1);
+
+	pj_status_t status = glb_mediaMux->Open(bind_addr);
+	if (status != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Could not open MediaMux on port " << g_config->MediaMuxPort
+			<< ", each call gets its own ports" << endl;
+		delete glb_mediaMux;
+		glb_mediaMux = NULL;
+		return false;
+	}
+
+	vector<pjsua_media_transport> tp(max_calls);
+
+	for (unsigned i = 0; i < max_calls; i++)
+	{
+		MuxTransport *transport = new MuxTransport(glb_mediaMux, public_addr, i);
+		glb_muxTransports.push_back(transport);
+
+		transport->GetSockInfo(&tp[i].skinfo);
+		tp[i].transport = transport->transport();
+	}
+
+	status = pjsua_media_transports_attach(&tp[0], max_calls, PJ_FALSE);
+	if (status != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Could not attach the MediaMux transports, each call gets its own ports" << endl;
+		stop_media_mux_();
+		return false;
+	}
+
+	g_logger->Info("SIP") << "MediaMux carrying " << max_calls << " calls on ports "
+		<< glb_mediaMux->RtpPort() << "/" << glb_mediaMux->RtcpPort() << endl;
+	return true;
+}
+
+// after pjsua_destroy, which leaves the transports to us
+static void stop_media_mux_ ()
+{
+	if (glb_mediaMux == NULL)
+		return;
+
+	glb_mediaMux->Close();
+
+	MediaMuxStats stats = glb_mediaMux->Stats();
+	g_logger->Info("SIP") << "MediaMux received " << stats.rx_packets << " packets in " << stats.rx_calls
+		<< " calls, sent " << stats.tx_packets << " in " << stats.tx_calls << ", "
+		<< stats.unknown << " unknown, " << stats.refused << " refused, " << stats.dropped << " dropped" << endl;
+
+	for (size_t i = 0; i < glb_muxTransports.size(); i++)
+		delete glb_muxTransports[i];
+	glb_muxTransports.clear();
+
+	delete glb_mediaMux;
+	glb_mediaMux = NULL;
+}
+
+//=============================================================================
+// SIP takes the first free port of SIPPortRange from SIPPort, or any port
+// if they are all taken or SIPPort is 0, so that a second SLVoice on the
+// host does not exit on a port the first already has.
+
+static pj_status_t create_sip_transport_ (pjsip_transport_type_e type, pjsua_transport_id *tid)
+{
+	pjsua_transport_config tcfg;
+	pjsua_transport_config_default (&tcfg);
+
+#if defined(PJSIP_HAS_TLS_TRANSPORT) && PJSIP_HAS_TLS_TRANSPORT != 0
+	// without the CAs anyone on the way could pose as the server, and
+	// would get the registrations' credentials
+	if (type == PJSIP_TRANSPORT_TLS && g_config->SIPTLSCAFile != "")
+	{
+		tcfg.tls_setting.ca_list_file = pj_str (const_cast<char*>(g_config->SIPTLSCAFile.c_str()));
+		tcfg.tls_setting.verify_server = PJ_TRUE;
+	}
+	else if (type == PJSIP_TRANSPORT_TLS && !g_config->SIPTLSNoVerify)
+	{
+		g_logger->Error("SIP") << "SIPTransport tls needs SIPTLSCAFile to verify the server, or SIPTLSNoVerify true" << endl;
+		return PJ_EINVAL;
+	}
+	else if (type == PJSIP_TRANSPORT_TLS)
+		g_logger->Warn("SIP") << "SIPTLSNoVerify: the server's TLS certificate is not verified" << endl;
+#endif
+
+	const char *name = pjsip_transport_get_type_name (type);
+	pj_status_t status = PJ_EUNKNOWN;
+
+	if (g_config->SIPPort != 0)
+	{
+		for (int i = 0; i < g_config->SIPPortRange && status != PJ_SUCCESS; i++)
+		{
+			tcfg.port = g_config->SIPPort + i;
+			status = pjsua_transport_create (type, &tcfg, tid);
+		}
+
+		if (status != PJ_SUCCESS)
+			g_logger->Warn("SIP") << "SIP " << name << " ports " << g_config->SIPPort << "-"
+				<< g_config->SIPPort + g_config->SIPPortRange - 1 << " are taken, using any" << endl;
+	}
+
+	if (status != PJ_SUCCESS)
+	{
+		tcfg.port = 0;
+		status = pjsua_transport_create (type, &tcfg, tid);
+		if (status != PJ_SUCCESS)
+			return status;
+	}
+
+	pjsua_transport_info info;
+	if (pjsua_transport_get_info (*tid, &info) == PJ_SUCCESS)
+		g_logger->Info("SIP") << "SIP on " << name << " port " << info.local_name.port << endl;
+
+	return PJ_SUCCESS;
+}
+
+//=============================================================================
+// With SIPTransport tcp or tls the accounts are bound to that transport and
+// the registrar, proxy and call URIs get its transport parameter. pjsip
+// keeps one connection per server and every REGISTER, refresh and INVITE
+// goes over it, so only the first pays for the TCP and TLS handshakes.
+// SIPKeepAlive keeps it, and a NAT binding with UDP, open while idle.
+
+static pjsip_transport_type_e glb_sipTransportType = PJSIP_TRANSPORT_UDP;
+static pjsua_transport_id glb_sipTransport = PJSUA_INVALID_ID;
+static string glb_sipTransportParam;
+
+// before any URI is given to pjsua
+static void select_sip_transport_ ()
+{
+	glb_sipTransportType = PJSIP_TRANSPORT_UDP;
+	glb_sipTransportParam = "";
+
+	if (g_config->SIPTransport == "tcp")
+		glb_sipTransportType = PJSIP_TRANSPORT_TCP;
+#if defined(PJSIP_HAS_TLS_TRANSPORT) && PJSIP_HAS_TLS_TRANSPORT != 0
+	else if (g_config->SIPTransport == "tls")
+		glb_sipTransportType = PJSIP_TRANSPORT_TLS;
+#endif
+	else if (g_config->SIPTransport != "udp")
+		g_logger->Warn("SIP") << "SIPTransport " << g_config->SIPTransport << " is not available, using udp" << endl;
+
+	if (glb_sipTransportType != PJSIP_TRANSPORT_UDP)
+		glb_sipTransportParam = (glb_sipTransportType == PJSIP_TRANSPORT_TCP) ? "tcp" : "tls";
+}
+
+static pj_status_t create_sip_transports_ ()
+{
+	// UDP always, for calls coming in that way
+	pj_status_t status = create_sip_transport_ (PJSIP_TRANSPORT_UDP, &glb_sipTransport);
+	if (status != PJ_SUCCESS || glb_sipTransportType == PJSIP_TRANSPORT_UDP)
+		return status;
+
+	status = create_sip_transport_ (glb_sipTransportType, &glb_sipTransport);
+	if (status != PJ_SUCCESS)
+		return status;
+
+	// 0 turns them off, as for pjsip
+	pjsip_cfg()->tcp.keep_alive_interval = g_config->SIPKeepAlive;
+	pjsip_cfg()->tls.keep_alive_interval = g_config->SIPKeepAlive;
+
+	return PJ_SUCCESS;
+}
+
+// uri with ;transport= of SIPTransport, unless it has one already
+static string with_transport_ (const string& uri)
+{
+	if (glb_sipTransportParam.empty() || uri.empty() || uri.find("transport=") != string::npos)
+		return uri;
+
+	// before any headers or the closing bracket of a name-addr
+	size_t end = uri.find_first_of("?>");
+	if (end == string::npos)
+		end = uri.length();
+
+	return uri.substr(0, end) + ";transport=" + glb_sipTransportParam + uri.substr(end);
+}
+
+// per-call RTP from RTPPort up, pjsua skips the pairs already taken
+static pj_status_t create_rtp_transports_ ()
+{
+	pjsua_transport_config tcfg;
+	pjsua_transport_config_default (&tcfg);
+	tcfg.port = g_config->RTPPort;
+
+	return pjsua_media_transports_create (&tcfg);
+}
 
 //=============================================================================
 /* Custom log function */
@@ -33,50 +737,23 @@ static void my_pj_log_ (int level, const char *data, int len)
 static void on_incoming_call (pjsua_acc_id acc_id, pjsua_call_id call_id,
                               pjsip_rx_data *rdata) {
 
-	pj_status_t status;
-	//pj_status_t status2;
 	pjsua_call_info ci;
-	int status3 = 0;
-
-    status = pjsua_call_get_info(call_id, &ci);
-	//status2 = pjsua_call_is_active(call_id);
-	status3 = pjsua_call_get_count();
 
+    pjsua_call_get_info(call_id, &ci);
 
 	g_logger->Info("SIP") << "Incoming call from " << ci.remote_info.ptr << endl;
 	g_logger->Terse("SIP") << "=======  SIP  ======== Incoming call from " << ci.remote_info.ptr << endl;
 
-	//Call State - Early - Turn on Flag
-	//Call State - Disconnected - Turn off Flag
-	gbl_CallInProgress = 0;
-	if (glb_callingState == 1)
+	// this call is already counted; whether another private call is up
+	// is for the session manager to decide, which knows the sessions
+	if (pjsua_call_get_count() > (unsigned)g_config->MaxCalls)
 	{
-        pj_str_t reason;
-		reason = pj_str("Another call is in progress");
-		gbl_CallInProgress = 1;
-		pjsua_call_answer((pjsua_call_id)call_id, PJSIP_SC_BUSY_HERE, &reason, NULL);
-		g_logger->Terse("SIP") << "=======  SIP  ======== Another call is in progress " << ci.remote_info.ptr << endl;
+		pj_str_t reason = pj_str((char*)"Too many calls in progress");
+		pjsua_call_answer(call_id, PJSIP_SC_BUSY_HERE, &reason, NULL);
+		g_logger->Terse("SIP") << "=======  SIP  ======== Too many calls in progress " << ci.remote_info.ptr << endl;
 		return;
 	}
 
-	/*
-	if (status3 > 2)  {  //Ringing
-		pj_str_t reason;
-		reason = pj_str("Another call is in progress");
-		pjsua_call_answer((pjsua_call_id)call_id, PJSIP_SC_BUSY_HERE, &reason, NULL);
-		g_logger->Terse("SIP") << "=======  SIP  ======== Another call is in progress - incoming " << ci.remote_info.ptr << endl;
-		return;
-    }*/
-
-	if (glb_realConType == 0)  { //On Call  0 -> Private Chat
-		pj_str_t reason;
-		reason = pj_str("Another call is in session");
-		pjsua_call_answer((pjsua_call_id)call_id, PJSIP_SC_BUSY_HERE, &reason, NULL);
-		g_logger->Terse("SIP") << "=======  SIP  ======== Another call is in session " << ci.remote_info.ptr << endl;				
-		return;
-    }
-
-
 	SessionEvent *ev = new DialIncomingEvent();
 
 	ev->uri = ci.remote_info.ptr;
@@ -84,8 +761,6 @@ static void on_incoming_call (pjsua_acc_id acc_id, pjsua_call_id call_id,
 	ev->call_id = (int)call_id;
 
 	g_eventManager.blockQueue.enqueue(ev);
-
-    glb_tempConType = 0;   //incoming only for private calls
 }
 
 //=============================================================================
@@ -119,30 +794,39 @@ static void on_call_state (pjsua_call_id call_id, pjsip_event *e) {
         DialEarlyEvent ev;
         info->machine.process_event(ev);
 		*/
-		glb_callingState = 1;
 		ev = new DialEarlyEvent();
     }
     break;
     case PJSIP_INV_STATE_CONNECTING: {
         // After response with To tag
-		//glb_callingState = 0;
 		ev = new DialConnectingEvent();
     }
     break;
     case PJSIP_INV_STATE_CONFIRMED: {
         // After response with To tag
 		ev = new DialSucceedEvent();
-		//actual change of status	
-		//glb_callingState = 0;
-		glb_realConType = glb_tempConType;			 
-
     }
     break;
     case PJSIP_INV_STATE_DISCONNECTED: {
         // After response with To tag
-		if (gbl_CallInProgress == 0)		
-            glb_callingState = 0;
-        gbl_CallInProgress = 0;
+		remove_spatial_port_(call_id);
+		remove_meter_port_(call_id);
+		remove_capture_port_(call_id);
+		{
+			boost::mutex::scoped_lock lock(glb_muteMutex);
+			glb_mutedCalls.erase(call_id);
+		}
+		{
+			boost::mutex::scoped_lock lock(glb_adaptMutex);
+			glb_adaptCalls.erase(call_id);
+		}
+		{
+			boost::mutex::scoped_lock lock(glb_spatialMutex);
+			glb_unheardCalls.erase(call_id);
+		}
+		glb_participantVolumes[call_id] = MIXER_GAIN_UNITY;
+		glb_speakerLevels[call_id] = 1.0f;
+		glb_micLevels[call_id] = 1.0f;
 		ev = new DialDisconnectedEvent();
     }
     break;
@@ -167,9 +851,46 @@ static void on_call_media_state(pjsua_call_id call_id) {
 	g_logger->Info("SIP") << "Media state= " << ci.media_status << " Callid = " << call_id << endl;
 
     if (ci.media_status == PJSUA_CALL_MEDIA_ACTIVE) {
-        status = pjsua_conf_connect(ci.conf_slot, 0);
-        status = pjsua_conf_connect(0, ci.conf_slot);
+		// a new slot starts at 1.0 both ways, the levels are given again
+		pjsua_conf_adjust_tx_level(ci.conf_slot, glb_micLevels[call_id]);
+		pjsua_conf_adjust_rx_level(ci.conf_slot, rx_level_(call_id));
+
+		if (g_config->SpatialAudio || glb_mixer != NULL)
+			add_spatial_port_(call_id, ci.conf_slot);
+		else
+		{
+			boost::mutex::scoped_lock lock(glb_spatialMutex);
+			if (is_heard_(call_id))
+				status = pjsua_conf_connect(ci.conf_slot, 0);
+		}
+		add_capture_port_(call_id, ci.conf_slot);
+		add_meter_port_(call_id, ci.conf_slot);
     }
+	else
+		detach_spatial_port_(call_id);
+}
+
+//=============================================================================
+/* Callbacks called by the library around the life of a call's media session */
+static void on_stream_created(pjsua_call_id call_id, pjmedia_session *sess,
+							  unsigned stream_idx, pjmedia_port **p_port) {
+
+	// GetQuality reads the first stream only
+	if (stream_idx != 0)
+		return;
+
+	boost::mutex::scoped_lock lock(glb_qualityMutex);
+	glb_qualitySessions[call_id] = sess;
+}
+
+static void on_stream_destroyed(pjsua_call_id call_id, pjmedia_session *sess,
+								unsigned stream_idx) {
+
+	boost::mutex::scoped_lock lock(glb_qualityMutex);
+
+	map<int, pjmedia_session*>::iterator ite = glb_qualitySessions.find(call_id);
+	if (ite != glb_qualitySessions.end() && ite->second == sess)
+		glb_qualitySessions.erase(ite);
 }
 
 //=============================================================================
@@ -250,7 +971,7 @@ void SIPConference::Register(const SIPUserInfo& user, int* accid) {
     string temp_useruri(user.sipuri);
     string temp_username(user.name);
     string temp_userpasswd(user.password);
-    string temp_serverreguri(server_.reguri);
+    string temp_serverreguri(with_transport_(server_.reguri));
 
 	g_logger->Info("SIP") << "temp_useruri      = " << temp_useruri << endl;
 	g_logger->Info("SIP") << "temp_username     = " << temp_username << endl;
@@ -270,6 +991,10 @@ void SIPConference::Register(const SIPUserInfo& user, int* accid) {
     cfg.cred_info[0].username = pj_str (const_cast <char*> (temp_username.c_str()));
     cfg.cred_info[0].data = pj_str (const_cast <char*> (temp_userpasswd.c_str()));
 
+	// REGISTER, its refreshes and the calls share the SIPTransport connection
+	cfg.transport_id = glb_sipTransport;
+	cfg.ka_interval = g_config->SIPKeepAlive;
+
     status = pjsua_acc_add(&cfg, PJ_TRUE, (pjsua_acc_id*)accid);
 
     if (status != PJ_SUCCESS)
@@ -298,7 +1023,7 @@ void SIPConference::UnRegister(const int accid) {
 }
 
 //=============================================================================
-void SIPConference::Join(const string& joinuri, int acc_id, int* callid, const string ConType) {
+void SIPConference::Join(const string& joinuri, int acc_id, int* callid) {
 
 	pj_status_t status;
 
@@ -306,58 +1031,32 @@ void SIPConference::Join(const string& joinuri, int acc_id, int* callid, const s
 
     g_logger->Terse("SIP") << "=======  SIP  ======== Join" << endl;
 
-	pj_str_t uri = pj_str(const_cast <char*> (joinuri.c_str()));
-
-	// Set prefered codec - Zaki [2008-07-16]
-    string codec;
-	if (g_config->DisableOtherCodecs && g_config->Codec != "")		
-	{
-		unsigned int count;
-		pjsua_codec_info id[256];
-
-		status = pjsua_enum_codecs(id, &count);
-		if (status != PJ_SUCCESS)
-			error_exit("Error enumerating codecs", status);
-
-		g_logger->Info("SIP") << "Disabling " << count-1 << " unselected codecs" << endl;
-
-		for (unsigned int i = 0; i < count; i++)
-		{
-			pjsua_codec_set_priority(&(id[i].codec_id), 0);
-		}
-	}
+	string target (with_transport_(joinuri));
+	pj_str_t uri = pj_str(const_cast <char*> (target.c_str()));
 
-	g_logger->Info("SIP") << "Codec selected " << g_config->Codec << endl;
+	*callid = PJSUA_INVALID_ID;
 
-	// Set the priority of the selected codec to be highest (255)
-	const pj_str_t codec_name = pj_str(const_cast <char*>(g_config->Codec.c_str()));
-	status = pjsua_codec_set_priority(&codec_name, 255);
-	if (status != PJ_SUCCESS)
+	if (pjsua_call_get_count() >= (unsigned)g_config->MaxCalls)
 	{
-		g_logger->Warn("SIP") << "Selected codec " << g_config->Codec << " could not be set as default" << endl;
+		g_logger->Warn("SIP") << "Not joining, " << g_config->MaxCalls << " calls in progress" << endl;
+		throw runtime_error("too many calls in progress");
 	}
-	else
+
+	// the codecs were ordered by configure_codecs_ at startup, unless
+	// another call is being moved to an adaptive one just now
 	{
-		g_logger->Info("SIP") << "Codec " << g_config->Codec << " was set as default" << endl;
+		boost::mutex::scoped_lock lock(glb_codecMutex);
+		status = pjsua_call_make_call(
+			acc_id, &uri, 0, NULL, NULL, (pjsua_call_id*)callid);
 	}
 
-	status = pjsua_call_make_call(
-		acc_id, &uri, 0, NULL, NULL, (pjsua_call_id*)callid);
-
+	// the other calls go on
 	if (status != PJ_SUCCESS)
-		error_exit ("Error making call", status);
-	else
-	{   //If connection is successful changed the global connectionType
-        //Type of Connection	
-        if (ConType == "1")    //1 for Conference Call
-              glb_tempConType =  1;
-        else                   // 0 for Private Chat
-              glb_tempConType = 0;	
-
-        //Disconnected - calls are now available
-        // glb_callingState = 0;
+	{
+		g_logger->Warn("SIP") << "Error making call, " << status << endl;
+		*callid = PJSUA_INVALID_ID;
+		throw runtime_error("error making call");
 	}
-
 }
 
 //=============================================================================
@@ -369,10 +1068,14 @@ void SIPConference::Answer(const int call_id, const unsigned int status_code) {
 	
 	g_logger->Terse("SIP") << "=======  SIP  ======== Answer" << endl;
 
-    status = pjsua_call_answer((pjsua_call_id)call_id, status_code, NULL, NULL);
+	{
+		boost::mutex::scoped_lock lock(glb_codecMutex);
+		status = pjsua_call_answer((pjsua_call_id)call_id, status_code, NULL, NULL);
+	}
 
+	// the caller may have given up already
     if (status != PJ_SUCCESS)
-        error_exit ("Error answering", status);
+        g_logger->Warn("SIP") << "Error answering call_id=" << call_id << ", " << status << endl;
 }
 
 //=============================================================================
@@ -382,73 +1085,491 @@ void SIPConference::Leave(const int call_id) {
 	
 	g_logger->Info("SIP") << "Entering Leave call_id=" << call_id << endl;
 
-	g_logger->Terse("SIP") << "=======  SIP  ======== Leave" << endl;
+	g_logger->Terse("SIP") << "=======  SIP  ======== Leave" << endl;
+
+//    pjsua_call_hangup_all();
+	if (call_id == PJSUA_INVALID_ID)
+		return;
+
+	status = pjsua_call_hangup((pjsua_call_id)call_id, 0, NULL, NULL);
+
+	// the other side may have hung up already
+    if (status != PJ_SUCCESS)
+        g_logger->Warn("SIP") << "Error hanging up call_id=" << call_id << ", " << status << endl;
+}
+
+//=============================================================================
+void SIPConference::AdjustTranVolume(int call_id, float level) 
+{
+	g_logger->Debug("SIP") << "Entering AdjustTranVolume()" << endl;
+
+	g_logger->Debug("SIP") << "AdjustTranVolume call_id" << call_id << ",Level=" << level << endl;
+
+	g_logger->Terse("SIP") << "=======  SIP  ======== AdjustTranVolume call_id=" << call_id << ", Level=" << level << endl;
+
+	if (call_id < 0 || call_id >= PJSUA_MAX_CALLS)
+		return;
+
+	// kept for the slot the call gets when its media comes up
+	glb_micLevels[call_id] = level;
+
+	{
+		boost::mutex::scoped_lock lock(glb_meterMutex);
+
+		map<int, MeterSlot>::iterator ite = glb_meterPorts.find(call_id);
+		if (ite != glb_meterPorts.end())
+			pjsua_conf_adjust_tx_level(ite->second.slot, level);
+	}
+
+	// ringing, on hold or in a re-INVITE, the call has no slot for now
+	pj_status_t status;
+	pjsua_call_info ci;
+	if (pjsua_call_get_info((pjsua_call_id)call_id, &ci) != PJ_SUCCESS
+		|| ci.conf_slot == PJSUA_INVALID_ID)
+		return;
+
+#ifdef DEBUG
+    unsigned tx_level = 0;
+    unsigned rx_level = 0;
+    status = pjsua_conf_get_signal_level(ci.conf_slot, &tx_level, &rx_level);
+    if (status == PJ_SUCCESS)
+		g_logger->Info("SIP") << "Current tx_level" << tx_level << ", rx_level=" << rx_level << endl;
+#endif
+
+	// the other calls go on
+    status = pjsua_conf_adjust_tx_level(ci.conf_slot, level);
+    if (status != PJ_SUCCESS)
+        g_logger->Warn("SIP") << "Error adjusting tx level of call_id=" << call_id << ", " << status << endl;
+}
+
+//=============================================================================
+void SIPConference::AdjustRecvVolume(int call_id, float level) 
+{
+	g_logger->Debug("SIP") << "Entering AdjustRecvVolume()" << endl;
+
+	g_logger->Info("SIP") << "AdjustRecvVolume call_id=" << call_id << ", level=" << level << endl;
+
+	g_logger->Terse("SIP") << "=======  SIP  ======== AdjustRecvVolume call_id=" << call_id << ", Level=" << level << endl;
+
+	if (call_id < 0 || call_id >= PJSUA_MAX_CALLS)
+		return;
+
+	// kept for the slot the call gets when its media comes up
+	glb_speakerLevels[call_id] = level;
+
+	// ringing, on hold or in a re-INVITE, the call has no slot for now
+	pj_status_t status;
+	pjsua_call_info ci;
+	if (pjsua_call_get_info((pjsua_call_id)call_id, &ci) != PJ_SUCCESS
+		|| ci.conf_slot == PJSUA_INVALID_ID)
+		return;
+
+#ifdef DEBUG
+    unsigned tx_level = 0;
+    unsigned rx_level = 0;
+    status = pjsua_conf_get_signal_level(ci.conf_slot, &tx_level, &rx_level);
+    if (status == PJ_SUCCESS)
+		g_logger->Info("SIP") << "Current tx_level" << tx_level << ", rx_level=" << rx_level << endl;
+#endif
+
+	// the other calls go on
+    status = pjsua_conf_adjust_rx_level(ci.conf_slot, rx_level_(call_id));
+    if (status != PJ_SUCCESS)
+        g_logger->Warn("SIP") << "Error adjusting rx level of call_id=" << call_id << ", " << status << endl;
+}
+
+//=============================================================================
+void SIPConference::AdjustSpatialGains(int call_id, const SpatialGains& gains) 
+{
+	boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+	map<int, SpatialSlot>::iterator ite = glb_spatialPorts.find(call_id);
+	if (ite != glb_spatialPorts.end())
+		ite->second.port->SetGains(gains);
+}
+
+//=============================================================================
+// Links a call to what it is heard through as it is now: its slot to its
+// spatial port, or to the sound device without one. pjsua is called with
+// glb_spatialMutex released, as on_call_media_state takes it under pjsua's
+// lock; the state is read again afterwards, and a change made meanwhile,
+// a new slot or another culling or mute, is applied in turn.
+
+static void link_heard_ (int call_id)
+{
+	pjsua_conf_port_id source = PJSUA_INVALID_ID, sink = PJSUA_INVALID_ID;
+	bool linked = false, first = true;
+
+	for (;;)
+	{
+		pjsua_call_info ci;
+		if (pjsua_call_get_info((pjsua_call_id)call_id, &ci) != PJ_SUCCESS)
+			return;
+
+		pjsua_conf_port_id new_source = ci.conf_slot, new_sink = 0;
+		bool link;
+		{
+			boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+			map<int, SpatialSlot>::iterator ite = glb_spatialPorts.find(call_id);
+			if (ite != glb_spatialPorts.end())
+			{
+				// one on hold is linked when it comes back
+				if (ite->second.call_slot == PJSUA_INVALID_ID)
+					return;
+				new_source = ite->second.call_slot;
+				new_sink = ite->second.slot;
+				link = ite->second.audible && is_heard_(call_id);
+			}
+			else if (g_config->SpatialAudio || glb_mixer != NULL || ci.media_status != PJSUA_CALL_MEDIA_ACTIVE)
+				return;
+			else
+				link = is_heard_(call_id);
+		}
+
+		if (!first && new_source == source && new_sink == sink && link == linked)
+			return;
+
+		first = false;
+		source = new_source;
+		sink = new_sink;
+		linked = link;
+
+		if (link)
+			pjsua_conf_connect(source, sink);
+		else
+			pjsua_conf_disconnect(source, sink);
+	}
+}
+
+//=============================================================================
+void SIPConference::SetAudible(int call_id, bool audible) 
+{
+	{
+		boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+		map<int, SpatialSlot>::iterator ite = glb_spatialPorts.find(call_id);
+		if (ite == glb_spatialPorts.end() || ite->second.audible == audible)
+			return;
+
+		ite->second.audible = audible;
+	}
+
+	g_logger->Info("SIP") << "Call " << call_id << (audible ? " audible again" : " culled") << endl;
+
+	// a muted call stays disconnected
+	link_heard_(call_id);
+}
+
+//=============================================================================
+void SIPConference::AdjustParticipantVolume(int call_id, float volume) 
+{
+	if (call_id < 0 || call_id >= PJSUA_MAX_CALLS)
+		return;
+
+	g_logger->Info("SIP") << "AdjustParticipantVolume call_id=" << call_id << ", volume=" << volume << endl;
+
+	// the SpatialPort takes it from its next frame
+	glb_participantVolumes[call_id] = mix_gain(volume);
+
+	if (g_config->SpatialAudio || glb_mixer != NULL)
+		return;
+
+	pjsua_call_info ci;
+	if (pjsua_call_get_info((pjsua_call_id)call_id, &ci) == PJ_SUCCESS
+		&& ci.conf_slot != PJSUA_INVALID_ID)
+		pjsua_conf_adjust_rx_level(ci.conf_slot, rx_level_(call_id));
+}
+
+//=============================================================================
+void SIPConference::SetParticipantMute(int call_id, bool muted) 
+{
+	{
+		boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+		if (is_heard_(call_id) != muted)
+			return;
+
+		if (muted)
+			glb_unheardCalls.insert(call_id);
+		else
+			glb_unheardCalls.erase(call_id);
+	}
+
+	g_logger->Info("SIP") << "SetParticipantMute call_id=" << call_id << ", " << muted << endl;
+
+	// the bridge neither decodes nor mixes a call nobody listens to. A
+	// culled call stays disconnected; without media yet, the call is
+	// connected according to the mute when it comes up.
+	link_heard_(call_id);
+}
+
+//=============================================================================
+bool SIPConference::GetMeter(int call_id, MeterReading* reading) 
+{
+	if (call_id < 0 || call_id >= PJSUA_MAX_CALLS)
+		return false;
+
+	*reading = read_meter(glb_meterSnapshots[call_id]);
+	return true;
+}
+
+//=============================================================================
+// Stream 0 is the call's audio. The RTCP statistics are what pjmedia keeps
+// anyway, so this costs two copies and no packets.
+
+bool SIPConference::GetQuality(int call_id, CallQuality* quality)
+{
+	boost::mutex::scoped_lock lock(glb_qualityMutex);
+
+	map<int, pjmedia_session*>::iterator ite = glb_qualitySessions.find(call_id);
+	if (ite == glb_qualitySessions.end())
+		return false;
+
+	pjmedia_session *session = ite->second;
+
+	pjmedia_rtcp_stat stat;
+	if (pjmedia_session_get_stream_stat(session, 0, &stat) != PJ_SUCCESS)
+		return false;
+
+	*quality = CallQuality();
+	quality->rx_packets = stat.rx.pkt;
+	quality->rx_lost = stat.rx.loss;
+	quality->tx_packets = stat.tx.pkt;
+	quality->tx_lost = stat.tx.loss;
+	quality->jitter_ms = stat.rx.jitter.mean / 1000;
+	quality->rtt_ms = stat.rtt.last / 1000;
+
+	pjmedia_jb_state jb;
+	if (pjmedia_session_get_stream_stat_jbuf(session, 0, &jb) == PJ_SUCCESS)
+	{
+		quality->jb_frames = jb.size;
+		quality->jb_prefetch = jb.prefetch;
+		quality->plc_frames = jb.lost;
+	}
+
+	return true;
+}
+
+//=============================================================================
+// Percent lost between two samples, the worse of the two directions; -1
+// when the counts went back, as they do when a re-INVITE restarts the
+// stream.
+
+static float interval_loss_ (const CallQuality& last, const CallQuality& q)
+{
+	if (q.rx_packets < last.rx_packets || q.rx_lost < last.rx_lost
+	 || q.tx_packets < last.tx_packets || q.tx_lost < last.tx_lost)
+		return -1.0f;
+
+	unsigned received = q.rx_packets - last.rx_packets;
+	unsigned rx_lost = q.rx_lost - last.rx_lost;
+	float rx_loss = (received + rx_lost > 0) ? 100.0f * rx_lost / (received + rx_lost) : 0.0f;
+
+	// the remote counts what it lost of what we sent
+	unsigned sent = q.tx_packets - last.tx_packets;
+	unsigned tx_lost = q.tx_lost - last.tx_lost;
+	float tx_loss = (sent > 0) ? 100.0f * min(tx_lost, sent) / sent : 0.0f;
+
+	return max(rx_loss, tx_loss);
+}
+
+//=============================================================================
+// The AdaptiveCodecs entry a call's audio was negotiated on, by the codec's
+// name and by its clock rate where the entry gives one; -1 for none.
+
+static int negotiated_level_ (int call_id)
+{
+	pjmedia_session_info info;
+	{
+		boost::mutex::scoped_lock lock(glb_qualityMutex);
+
+		map<int, pjmedia_session*>::iterator ite = glb_qualitySessions.find(call_id);
+		if (ite == glb_qualitySessions.end()
+			|| pjmedia_session_get_info(ite->second, &info) != PJ_SUCCESS
+			|| info.stream_cnt == 0)
+			return -1;
+	}
+
+	const pjmedia_codec_info& fmt = info.stream_info[0].fmt;
+	const vector<string>& codecs = g_config->AdaptiveCodecs;
+
+	for (size_t i = 0; i < codecs.size(); i++)
+	{
+		string name = codecs[i], rate;
+		size_t slash = name.find('/');
+		if (slash != string::npos)
+		{
+			rate = name.substr(slash + 1, name.find('/', slash + 1) - slash - 1);
+			name.erase(slash);
+		}
+
+		const pj_str_t codec_name = pj_str(const_cast <char*>(name.c_str()));
+		if (pj_stricmp(&codec_name, &fmt.encoding_name) != 0)
+			continue;
+		if (!rate.empty() && (unsigned)atoi(rate.c_str()) != fmt.clock_rate)
+			continue;
+
+		return (int)i;
+	}
+
+	return -1;
+}
+
+void SIPConference::AdaptCodec(int call_id, const CallQuality& q)
+{
+	const vector<string>& codecs = g_config->AdaptiveCodecs;
+	if (codecs.size() < 2)
+		return;
+
+	// the adapter moves with the codec the call is on, not the one it was
+	// offered: a re-INVITE may fail or be answered with the old one
+	int current = negotiated_level_(call_id);
+
+	unsigned from, to;
+	{
+		boost::mutex::scoped_lock lock(glb_adaptMutex);
+
+		map<int, AdaptSlot>::iterator ite = glb_adaptCalls.find(call_id);
+		if (ite == glb_adaptCalls.end())
+		{
+			CodecAdapter adapter(codecs.size(), g_config->AdaptLossHigh, g_config->AdaptLossLow,
+				g_config->AdaptRttHigh, g_config->AdaptDownSamples, g_config->AdaptUpSamples,
+				g_config->AdaptHoldTime);
+			ite = glb_adaptCalls.insert(make_pair(call_id, AdaptSlot(adapter))).first;
+		}
+
+		AdaptSlot& a = ite->second;
+		if (current >= 0)
+			a.adapter.SetLevel((unsigned)current);
+
+		// the first sample only gives the counts to start from
+		float loss = a.sampled ? interval_loss_(a.last, q) : -1.0f;
+		a.last = q;
+		a.sampled = true;
+
+		if (loss < 0.0f)
+			return;
+
+		pj_time_val now;
+		pj_gettickcount(&now);
+
+		from = a.adapter.Level();
+		to = a.adapter.Update(loss, q.rtt_ms, PJ_TIME_VAL_MSEC(now));
+
+		if (to == from)
+			return;
 
-//    pjsua_call_hangup_all();
-	status = pjsua_call_hangup((pjsua_call_id)call_id, 0, NULL, NULL);
+		g_logger->Info("SIP") << "Call " << call_id << " at " << loss << "% loss, " << q.rtt_ms
+			<< " msec round trip, moving from " << codecs[from] << " to " << codecs[to] << endl;
+	}
 
-	//glb_callingState = 0;
-    if (status != PJ_SUCCESS)
-        error_exit ("Error hanging up", status);
+	pj_status_t status = reoffer_codec_((pjsua_call_id)call_id, codecs[to]);
+
+	// the call stays on what it has, and is tried again after the hold
+	if (status != PJ_SUCCESS)
+		g_logger->Warn("SIP") << "Error re-inviting call_id=" << call_id << " to " << codecs[to] << ", " << status << endl;
 }
 
 //=============================================================================
-void SIPConference::AdjustTranVolume(int call_id, float level) 
+// Links the microphone, through the call's VAD gate if it has one, to the
+// call and to its meter as the mute is now. With no source left, the
+// bridge hands the stream empty frames: it encodes and sends nothing.
+// Connecting again takes effect on the next frame of the bridge's clock.
+// As link_heard_, pjsua is called with glb_captureMutex and glb_meterMutex
+// released, and what changed meanwhile is applied in turn.
+
+static void link_captured_ (int call_id)
 {
-	g_logger->Debug("SIP") << "Entering AdjustTranVolume()" << endl;
+	pjsua_conf_port_id source = PJSUA_INVALID_ID, call_slot = PJSUA_INVALID_ID, meter = PJSUA_INVALID_ID;
+	bool linked = false, first = true;
 
-	pj_status_t status;
-    pjsua_call_info ci;
-    pjsua_call_get_info((pjsua_call_id)call_id, &ci);
+	for (;;)
+	{
+		// without media yet, the ports are connected according to the
+		// mute when it comes up
+		pjsua_call_info ci;
+		if (pjsua_call_get_info((pjsua_call_id)call_id, &ci) != PJ_SUCCESS
+			|| ci.conf_slot == PJSUA_INVALID_ID)
+			return;
 
-	g_logger->Debug("SIP") << "AdjustTranVolume call_id" << call_id << ",Level=" << level << endl;
+		bool link = !is_muted_(call_id);
 
-	g_logger->Terse("SIP") << "=======  SIP  ======== AdjustTranVolume call_id=" << call_id << ", Level=" << level << endl;
+		pjsua_conf_port_id new_source, new_meter = PJSUA_INVALID_ID;
+		{
+			boost::mutex::scoped_lock lock(glb_captureMutex);
 
-#ifdef DEBUG
-    unsigned tx_level = 0;
-    unsigned rx_level = 0;
-    status = pjsua_conf_get_signal_level(ci.conf_slot, &tx_level, &rx_level);
-    if (status != PJ_SUCCESS)
-        error_exit ("Error get signal level", status);
+			map<int, CaptureGate>::iterator ite = glb_capturePorts.find(call_id);
+			new_source = (ite == glb_capturePorts.end()) ? glb_micSlot : ite->second.slot;
+		}
+		{
+			boost::mutex::scoped_lock lock(glb_meterMutex);
 
-    g_logger->Info("SIP") << "Current tx_level" << tx_level << ", rx_level=" << rx_level << endl;
-#endif
+			map<int, MeterSlot>::iterator ite = glb_meterPorts.find(call_id);
+			if (ite != glb_meterPorts.end())
+				new_meter = ite->second.slot;
+		}
 
-    status = pjsua_conf_adjust_tx_level(ci.conf_slot, level);
-    if (status != PJ_SUCCESS)
-        error_exit ("Error adjust tx level", status);
+		if (!first && new_source == source && ci.conf_slot == call_slot && new_meter == meter && link == linked)
+			return;
+
+		first = false;
+		source = new_source;
+		call_slot = ci.conf_slot;
+		meter = new_meter;
+		linked = link;
+
+		if (link)
+			pjsua_conf_connect(source, call_slot);
+		else
+			pjsua_conf_disconnect(source, call_slot);
+
+		if (meter == PJSUA_INVALID_ID)
+			continue;
+
+		if (link)
+			pjsua_conf_connect(glb_micSlot, meter);
+		else
+			pjsua_conf_disconnect(glb_micSlot, meter);
+	}
 }
 
 //=============================================================================
-void SIPConference::AdjustRecvVolume(int call_id, float level) 
+void SIPConference::SetMicMute(int call_id, bool muted) 
 {
-	g_logger->Debug("SIP") << "Entering AdjustRecvVolume()" << endl;
+	{
+		boost::mutex::scoped_lock lock(glb_muteMutex);
 
-	pj_status_t status;
-    pjsua_call_info ci;
-    pjsua_call_get_info((pjsua_call_id)call_id, &ci);
+		bool was = glb_mutedCalls.find(call_id) != glb_mutedCalls.end();
+		if (was == muted)
+			return;
 
-	g_logger->Info("SIP") << "AdjustRecvVolume call_id=" << call_id << ", level=" << level << endl;
+		if (muted)
+			glb_mutedCalls.insert(call_id);
+		else
+			glb_mutedCalls.erase(call_id);
+	}
 
-	g_logger->Terse("SIP") << "=======  SIP  ======== AdjustRecvVolume call_id=" << call_id << ", Level=" << level << endl;
+	g_logger->Info("SIP") << "SetMicMute call_id=" << call_id << ", " << muted << endl;
 
-#ifdef DEBUG
-    unsigned tx_level = 0;
-    unsigned rx_level = 0;
-    status = pjsua_conf_get_signal_level(ci.conf_slot, &tx_level, &rx_level);
-    if (status != PJ_SUCCESS)
-        error_exit ("Error get signal level", status);
+	link_captured_(call_id);
+}
 
-	g_logger->Info("SIP") << "Current tx_level" << tx_level << ", rx_level=" << rx_level << endl;
-#endif
+//=============================================================================
+pjsua_conf_port_id SIPConference::CaptureSlot(int call_id) 
+{
+	boost::mutex::scoped_lock lock(glb_captureMutex);
 
-    status = pjsua_conf_adjust_rx_level(ci.conf_slot, level);
-    if (status != PJ_SUCCESS)
-        error_exit ("Error adjust rx level", status);
+	map<int, CaptureGate>::iterator ite = glb_capturePorts.find(call_id);
+	return (ite == glb_capturePorts.end()) ? PJSUA_INVALID_ID : ite->second.slot;
 }
 
 //=============================================================================
+static void start_split_sound_ ();
+static void stop_split_sound_ ();
+static void start_headless_sound_ ();
+static void stop_headless_sound_ ();
+
 void SIPConference::start_sip_stack_() 
 {
 	g_logger->Debug("SIP") << "Entering start_sip_stack_()" << endl;
@@ -457,6 +1578,13 @@ void SIPConference::start_sip_stack_()
 
 	pj_status_t status;
 
+	for (int i = 0; i < PJSUA_MAX_CALLS; i++)
+	{
+		glb_participantVolumes[i] = MIXER_GAIN_UNITY;
+		glb_speakerLevels[i] = 1.0f;
+		glb_micLevels[i] = 1.0f;
+	}
+
     status = pjsua_create ();
     if (status != PJ_SUCCESS)
         error_exit ("Error in pjsua_create()", status);
@@ -467,42 +1595,180 @@ void SIPConference::start_sip_stack_()
     pjsua_media_config_default(&mcfg);
     mcfg.ilbc_mode = 30;
 
+	const MediaProfile *profile = find_media_profile(g_config->MediaProfile);
+	if (profile == NULL)
+	{
+		g_logger->Warn("SIP") << "Unknown MediaProfile " << g_config->MediaProfile << ", using balanced" << endl;
+		profile = find_media_profile("balanced");
+	}
+
+	glb_clockRate = mcfg.clock_rate = profile->clock_rate;
+	glb_framePtime = mcfg.audio_frame_ptime = profile->frame_ptime;
+	mcfg.ptime = profile->ptime;
+	mcfg.snd_rec_latency = profile->snd_rec_latency;
+	mcfg.snd_play_latency = profile->snd_play_latency;
+	mcfg.jb_init = profile->jb_init;
+	mcfg.jb_min_pre = profile->jb_min_pre;
+	mcfg.jb_max_pre = profile->jb_max_pre;
+	mcfg.jb_max = profile->jb_max;
+	mcfg.ec_tail_len = profile->ec_tail_len;
+
+	// nothing plays out loud, so nothing echoes
+	if (g_config->SoundDevice != "device")
+		mcfg.ec_tail_len = 0;
+	mcfg.thread_cnt = profile->thread_cnt;
+	mcfg.quality = profile->quality;
+
+	g_logger->Info("SIP") << "Media profile " << profile->name << ": " << profile->clock_rate << " Hz, "
+		<< profile->frame_ptime << " msec frames" << endl;
+
+	// the spatializer needs a stereo bridge, pjsua adapts the mono calls
+	glb_channelCount = g_config->SpatialAudio ? 2 : 1;
+	mcfg.channel_count = glb_channelCount;
+
+	// the capture gate decides about silence, not each codec on its own
+	if (g_config->VADMode != VAD_MODE_OFF)
+		mcfg.no_vad = PJ_TRUE;
+
     pjsua_config cfg;
     pjsua_config_default (&cfg);
 
     cfg.cb.on_incoming_call = &on_incoming_call;
     cfg.cb.on_call_media_state = &on_call_media_state;
     cfg.cb.on_call_state = &on_call_state;
+    cfg.cb.on_stream_created = &on_stream_created;
+    cfg.cb.on_stream_destroyed = &on_stream_destroyed;
     //cfg.cb.on_call_transfer_request =	// for REFER
     cfg.cb.on_reg_state = &on_reg_state;
 
-	if (server_.proxyuri != "") {
+	select_sip_transport_();
+
+	// pjsua_init copies it
+	string proxyuri (with_transport_(server_.proxyuri));
+
+	if (proxyuri != "") {
 		cfg.outbound_proxy_cnt = 1;
-		cfg.outbound_proxy[0] = pj_str(const_cast<char*>(server_.proxyuri.c_str()));
+		cfg.outbound_proxy[0] = pj_str(const_cast<char*>(proxyuri.c_str()));
 	}
 
-    status = pjsua_init (&cfg, NULL, &mcfg);
+	cfg.max_calls = min(g_config->MaxCalls, PJSUA_MAX_CALLS);
+
+	// pjsua_init brings the sound subsystem up under the device cache
+	{
+		boost::mutex::scoped_lock lock(AudioDeviceCache::SubsysMutex());
+		status = pjsua_init (&cfg, NULL, &mcfg);
+	}
     if (status != PJ_SUCCESS)
         error_exit ("Error in pjsua_init()", status);
 
-    pjsua_transport_config tcfg;
-    pjsua_transport_config_default (&tcfg);
+	configure_codecs_();
+
+	if (g_config->SIMDMixer)
+		start_mixer_();
+
+	if (g_config->CaptureHighPass || g_config->CaptureNoiseSuppression || g_config->CaptureAGC)
+		start_dsp_();
 
-    tcfg.port = 5060;
-    status = pjsua_transport_create (PJSIP_TRANSPORT_UDP, &tcfg, NULL);
+    status = create_sip_transports_ ();
     if (status != PJ_SUCCESS)
         error_exit ("Error creating transport", status);
 
+	if (!g_config->MediaMux || !start_media_mux_(cfg.max_calls))
+	{
+		status = create_rtp_transports_ ();
+		if (status != PJ_SUCCESS)
+			error_exit ("Error creating media transports", status);
+	}
+
     status = pjsua_start ();
     if (status != PJ_SUCCESS)
         error_exit ("Error starting pjsua", status);
+
+	if (g_config->SoundDevice != "device")
+		start_headless_sound_();
+	else if (g_config->SplitSoundDevice)
+		start_split_sound_();
+
+	// the cache's index is to match the list pjsua_init read
+	g_eventManager.Devices.Refresh();
 }
 
 //=============================================================================
 void SIPConference::stop_sip_stack_ () 
 {
 	g_logger->Debug("SIP") << "Entering stop_sip_stack_()" << endl;
-    pjsua_destroy ();
+
+	{
+		boost::mutex::scoped_lock lock(glb_spatialMutex);
+
+		for (map<int, SpatialSlot>::iterator ite = glb_spatialPorts.begin();
+			 ite != glb_spatialPorts.end(); ++ite)
+		{
+			pjsua_conf_remove_port(ite->second.slot);
+			pj_pool_release(ite->second.pool);
+			delete ite->second.port;
+		}
+		glb_spatialPorts.clear();
+		glb_unheardCalls.clear();
+	}
+
+	{
+		boost::mutex::scoped_lock lock(glb_captureMutex);
+
+		for (map<int, CaptureGate>::iterator ite = glb_capturePorts.begin();
+			 ite != glb_capturePorts.end(); ++ite)
+			free_capture_port_(ite->first, ite->second);
+		glb_capturePorts.clear();
+	}
+
+	{
+		boost::mutex::scoped_lock lock(glb_meterMutex);
+
+		for (map<int, MeterSlot>::iterator ite = glb_meterPorts.begin();
+			 ite != glb_meterPorts.end(); ++ite)
+		{
+			pjsua_conf_remove_port(ite->second.slot);
+			pj_pool_release(ite->second.pool);
+			delete ite->second.port;
+			glb_meterSnapshots[ite->first] = 0;
+		}
+		glb_meterPorts.clear();
+	}
+
+	{
+		boost::mutex::scoped_lock lock(glb_muteMutex);
+		glb_mutedCalls.clear();
+	}
+
+	{
+		boost::mutex::scoped_lock lock(glb_qualityMutex);
+		glb_qualitySessions.clear();
+	}
+
+	{
+		boost::mutex::scoped_lock lock(glb_adaptMutex);
+		glb_adaptCalls.clear();
+	}
+
+	if (glb_mixer != NULL)
+	{
+		pjsua_conf_remove_port(glb_mixerSlot);
+		pj_pool_release(glb_mixerPool);
+		delete glb_mixer;
+		glb_mixer = NULL;
+	}
+
+	stop_dsp_();
+
+	stop_split_sound_();
+	stop_headless_sound_();
+
+	{
+		boost::mutex::scoped_lock lock(AudioDeviceCache::SubsysMutex());
+		pjsua_destroy ();
+	}
+
+	stop_media_mux_();
 }
 
 //=============================================================================
@@ -527,3 +1793,364 @@ stringstream& operator>> (stringstream& in, SIPUserInfo& usr) {
     return in;
 }
 
+//=============================================================================
+SIPBackend* create_sip_backend(const SIPServerInfo& s)
+{
+	if (g_config->SIPBackend == "fake")
+	{
+		g_logger->Warn("SIP") << "Using the fake SIP backend, no calls will be made" << endl;
+		return new FakeSIPConference(s);
+	}
+
+	return new SIPConference(s);
+}
+
+//=============================================================================
+// With SplitSoundDevice the microphone and the speaker are two sound ports
+// on the bridge's master port instead of pjsua's one, so that switching
+// one of them leaves the other running. pjmedia's echo canceller works on
+// a port that has both, so it is not used then.
+
+struct SoundSlot
+{
+	SoundSlot() : pool(NULL), port(NULL), dev(-1) {}
+
+	pj_pool_t *pool;
+	pjmedia_snd_port *port;
+	int dev;
+};
+
+static pjmedia_port *glb_masterPort = NULL;
+static SoundSlot glb_soundSlots[2];		// capture, render
+static boost::mutex glb_soundMutex;
+
+static void close_sound_slot_ (SoundSlot& s)
+{
+	if (s.port != NULL)
+		pjmedia_snd_port_destroy(s.port);
+	if (s.pool != NULL)
+		pj_pool_release(s.pool);
+
+	s = SoundSlot();
+}
+
+static pj_status_t open_sound_slot_ (bool capture, int dev)
+{
+	SoundSlot& s = glb_soundSlots[capture ? 0 : 1];
+	pj_status_t status;
+
+	s.pool = pjsua_pool_create(capture ? "snd_rec" : "snd_play", 1024, 1024);
+
+	if (capture)
+		status = pjmedia_snd_port_create_rec(s.pool, dev, glb_clockRate, glb_channelCount,
+			samples_per_frame_(), 16, 0, &s.port);
+	else
+		status = pjmedia_snd_port_create_player(s.pool, dev, glb_clockRate, glb_channelCount,
+			samples_per_frame_(), 16, 0, &s.port);
+
+	if (status == PJ_SUCCESS)
+		status = pjmedia_snd_port_connect(s.port, glb_masterPort);
+
+	if (status != PJ_SUCCESS)
+	{
+		close_sound_slot_(s);
+		return status;
+	}
+
+	s.dev = dev;
+	return PJ_SUCCESS;
+}
+
+static void start_split_sound_ ()
+{
+	boost::mutex::scoped_lock lock(glb_soundMutex);
+
+	glb_masterPort = pjsua_set_no_snd_dev();
+
+	pj_status_t status = open_sound_slot_(true, PJMEDIA_AUD_DEFAULT_CAPTURE_DEV);
+	if (status == PJ_SUCCESS)
+		status = open_sound_slot_(false, PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV);
+
+	if (status == PJ_SUCCESS)
+	{
+		g_logger->Info("SIP") << "Microphone and speaker opened as two sound ports" << endl;
+		return;
+	}
+
+	g_logger->Warn("SIP") << "Error opening split sound ports, " << status << ", using one" << endl;
+
+	close_sound_slot_(glb_soundSlots[0]);
+	close_sound_slot_(glb_soundSlots[1]);
+	glb_masterPort = NULL;
+
+	pjsua_set_snd_dev(PJMEDIA_AUD_DEFAULT_CAPTURE_DEV, PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV);
+}
+
+static void stop_split_sound_ ()
+{
+	boost::mutex::scoped_lock lock(glb_soundMutex);
+
+	close_sound_slot_(glb_soundSlots[0]);
+	close_sound_slot_(glb_soundSlots[1]);
+	glb_masterPort = NULL;
+}
+
+// the other direction keeps its port. If the new device does not open,
+// the old one is opened again. False without split ports; *switched is
+// false when the direction is on that device already or did not move.
+static bool switch_split_sound_ (bool capture, int dev, bool *switched)
+{
+	boost::mutex::scoped_lock lock(glb_soundMutex);
+
+	if (glb_masterPort == NULL)
+		return false;
+
+	SoundSlot& s = glb_soundSlots[capture ? 0 : 1];
+	*switched = (s.dev != dev);
+	if (!*switched)
+		return true;
+
+	int old = s.dev;
+	close_sound_slot_(s);
+
+	pj_status_t status = open_sound_slot_(capture, dev);
+	if (status != PJ_SUCCESS)
+	{
+		g_logger->Warn("SETSTATE") << "Error opening sound device " << dev << ", " << status << ", keeping " << old << endl;
+		*switched = false;
+
+		status = open_sound_slot_(capture, old);
+		if (status != PJ_SUCCESS)
+			g_logger->Error("SETSTATE") << "Error reopening sound device " << old << ", " << status
+				<< ", the " << (capture ? "microphone" : "speaker") << " is closed" << endl;
+	}
+
+	return true;
+}
+
+//=============================================================================
+// Headless, SoundDevice null clocks the bridge with pjsua's null sound
+// device and file with a master port over FileSoundPort: the microphone
+// is read from SoundCaptureFile, looped, and the speaker written to
+// SoundRenderFile. No sound device is ever opened.
+
+static pj_pool_t *glb_headlessPool = NULL;
+static pjmedia_master_port *glb_headlessClock = NULL;
+static FileSoundPort *glb_fileSound = NULL;
+static pjmedia_port *glb_captureFile = NULL;
+static pjmedia_port *glb_renderFile = NULL;
+
+static void start_headless_sound_ ()
+{
+	if (g_config->SoundDevice != "file")
+	{
+		if (g_config->SoundDevice != "null")
+			g_logger->Warn("SIP") << "Unknown SoundDevice " << g_config->SoundDevice << ", using null" << endl;
+
+		pjsua_set_null_snd_dev();
+		g_logger->Info("SIP") << "No sound device, the bridge runs on the null one" << endl;
+		return;
+	}
+
+	glb_headlessPool = pjsua_pool_create("headless", 1024, 1024);
+	pj_status_t status;
+
+	if (!g_config->SoundCaptureFile.empty())
+	{
+		status = pjmedia_wav_player_port_create(glb_headlessPool, g_config->SoundCaptureFile.c_str(),
+			glb_framePtime, 0, 0, &glb_captureFile);
+		if (status != PJ_SUCCESS)
+		{
+			g_logger->Warn("SIP") << "Error opening " << g_config->SoundCaptureFile << ", " << status << ", the microphone is silent" << endl;
+			glb_captureFile = NULL;
+		}
+		else if (glb_captureFile->info.clock_rate != glb_clockRate
+			  || glb_captureFile->info.channel_count != glb_channelCount)
+		{
+			// the bridge does not resample its master port
+			g_logger->Warn("SIP") << g_config->SoundCaptureFile << " is not " << glb_clockRate << " Hz "
+				<< glb_channelCount << " channel, the microphone is silent" << endl;
+			pjmedia_port_destroy(glb_captureFile);
+			glb_captureFile = NULL;
+		}
+	}
+
+	if (!g_config->SoundRenderFile.empty())
+	{
+		status = pjmedia_wav_writer_port_create(glb_headlessPool, g_config->SoundRenderFile.c_str(),
+			glb_clockRate, glb_channelCount, samples_per_frame_(), 16, 0, 0, &glb_renderFile);
+		if (status != PJ_SUCCESS)
+		{
+			g_logger->Warn("SIP") << "Error creating " << g_config->SoundRenderFile << ", " << status << endl;
+			glb_renderFile = NULL;
+		}
+	}
+
+	glb_fileSound = new FileSoundPort(glb_clockRate, glb_channelCount, samples_per_frame_(),
+		glb_captureFile, glb_renderFile);
+
+	status = pjmedia_master_port_create(glb_headlessPool, pjsua_set_no_snd_dev(),
+		glb_fileSound->port(), 0, &glb_headlessClock);
+	if (status == PJ_SUCCESS)
+		status = pjmedia_master_port_start(glb_headlessClock);
+
+	if (status != PJ_SUCCESS)
+	{
+		g_logger->Warn("SIP") << "Error starting the file sound clock, " << status << ", using the null sound device" << endl;
+		stop_headless_sound_();
+		pjsua_set_null_snd_dev();
+		return;
+	}
+
+	g_logger->Info("SIP") << "No sound device, microphone from " << g_config->SoundCaptureFile
+		<< ", speaker to " << g_config->SoundRenderFile << endl;
+}
+
+static void stop_headless_sound_ ()
+{
+	if (glb_headlessClock != NULL)
+		pjmedia_master_port_destroy(glb_headlessClock, PJ_FALSE);
+	glb_headlessClock = NULL;
+
+	// the writer completes the WAV header as it is destroyed
+	if (glb_captureFile != NULL)
+		pjmedia_port_destroy(glb_captureFile);
+	if (glb_renderFile != NULL)
+		pjmedia_port_destroy(glb_renderFile);
+	glb_captureFile = glb_renderFile = NULL;
+
+	delete glb_fileSound;
+	glb_fileSound = NULL;
+
+	if (glb_headlessPool != NULL)
+		pj_pool_release(glb_headlessPool);
+	glb_headlessPool = NULL;
+}
+
+//=============================================================================
+// A device name is looked up in the cache's index. pjsua reads the list
+// when it starts and the cache refreshes after that, so the two agree; the
+// name at the index is checked all the same, and the list scanned if it
+// is not the one asked for.
+
+static int find_snd_dev_ (const string& name)
+{
+	int index = g_eventManager.Devices.Find(name);
+
+	pjmedia_aud_dev_info info;
+	if (index >= 0 && pjmedia_aud_dev_get_info(index, &info) == PJ_SUCCESS && name == info.name)
+		return index;
+
+	g_eventManager.Devices.Refresh();
+
+	pjmedia_aud_dev_info infos[64];
+	unsigned int count = PJ_ARRAY_SIZE(infos);
+	if (pjsua_enum_aud_devs(infos, &count) != PJ_SUCCESS)
+		return -1;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (infos[i].name == name)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+/* Switch one direction of the sound device, keeping the other one */
+static void set_snd_dev_(const string& name, bool capture)
+{
+	const char *kind = capture ? "capture" : "render";
+
+	if (g_config->SIPBackend == "fake")
+	{
+		g_logger->Debug("SETSTATE") << "Fake SIP backend, not setting " << kind << " device to " << name << endl;
+		return;
+	}
+
+	if (g_config->SoundDevice != "device")
+	{
+		g_logger->Info("SETSTATE") << "SoundDevice " << g_config->SoundDevice << ", not setting " << kind << " device to " << name << endl;
+		return;
+	}
+
+	int dev = find_snd_dev_(name);
+	if (dev < 0)
+	{
+		g_logger->Warn("SETSTATE") << "Trying to set invalid or nonexistent " << kind << " device " << name << endl;
+		return;
+	}
+
+	g_logger->Debug("SETSTATE") << "Setting " << kind << " device to " << name << endl;
+
+	MetricTime started = metrics_now();
+
+	bool switched = true;
+	if (!switch_split_sound_(capture, dev, &switched))
+	{
+		int renderDev = 0;
+		int captureDev = 0;
+
+		pjsua_get_snd_dev(&captureDev, &renderDev);
+		g_logger->Debug("SETSTATE") << "Got audio devices C:" << captureDev << " R" << renderDev << endl;
+
+		if (captureDev == PJMEDIA_AUD_DEFAULT_CAPTURE_DEV)
+		{
+			pjmedia_aud_dev_info info;
+			pjmedia_aud_dev_get_info(PJMEDIA_AUD_DEFAULT_CAPTURE_DEV, &info);
+			pjmedia_aud_dev_lookup(info.driver, info.name, &captureDev);
+		}
+		if (renderDev == PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV)
+		{
+			pjmedia_aud_dev_info info;
+			pjmedia_aud_dev_get_info(PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV, &info);
+			pjmedia_aud_dev_lookup(info.driver, info.name, &renderDev);
+		}
+
+		// already there: pjsua would close and open it all the same
+		if ((capture ? captureDev : renderDev) == dev)
+			return;
+
+		if (capture)
+			captureDev = dev;
+		else
+			renderDev = dev;
+
+		// the direction we keep must be a real device
+		int other = capture ? renderDev : captureDev;
+		if (other <= 0)
+		{
+			g_logger->Warn("SETSTATE") << "Invalid " << (capture ? "render" : "capture") << " device was set: " << other << " while setting " << kind << " device to " << name << endl;
+			return;
+		}
+
+		g_logger->Debug("SETSTATE") << "SET SND DEV R:"  << renderDev << "C:" << captureDev << endl;
+
+		// both directions stop while pjsua reopens the port
+		pj_status_t status = pjsua_set_snd_dev(captureDev, renderDev);
+		if (status != PJ_SUCCESS)
+		{
+			g_logger->Warn("SETSTATE") << "Error setting audio device " << status << endl;
+			return;
+		}
+	}
+
+	if (!switched)
+		return;
+
+	long gap = metrics_elapsed_usec(started, metrics_now());
+	g_logger->Info("SETSTATE") << "Switched " << kind << " device to " << name << " in " << gap / 1000 << " msec" << endl;
+
+	if (g_metrics != NULL)
+		g_metrics->RecordDeviceSwitch(capture, gap);
+}
+
+void set_capture_device(const string& name)
+{
+	set_snd_dev_(name, true);
+}
+
+void set_render_device(const string& name)
+{
+	set_snd_dev_(name, false);
+}
@@ -0,0 +1,49 @@
+/* sound.cpp -- headless sound module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <sound.hpp>
+
+#define SOUND_SIGNATURE		PJMEDIA_PORT_SIGNATURE('S', 'L', 'S', 'F')
+
+//=============================================================================
+FileSoundPort::FileSoundPort(unsigned clock_rate, unsigned channel_count, unsigned samples_per_frame,
+							 pjmedia_port *source, pjmedia_port *sink)
+	: source_(source), sink_(sink)
+{
+	const pj_str_t name = pj_str((char*)"filesound");
+
+	pjmedia_port_info_init(&port_.info, &name, SOUND_SIGNATURE,
+		clock_rate, channel_count, 16, samples_per_frame);
+
+	port_.port_data.user_data = this;
+	port_.put_frame = &put_frame_;
+	port_.get_frame = &get_frame_;
+	port_.on_destroy = NULL;
+}
+
+// the speaker
+pj_status_t FileSoundPort::put_frame_(pjmedia_port *port, const pjmedia_frame *frame)
+{
+	FileSoundPort *self = (FileSoundPort*)port->port_data.user_data;
+
+	if (self->sink_ == NULL || frame->type != PJMEDIA_FRAME_TYPE_AUDIO)
+		return PJ_SUCCESS;
+
+	return pjmedia_port_put_frame(self->sink_, frame);
+}
+
+// the microphone; a file that runs out or fails reads as silence
+pj_status_t FileSoundPort::get_frame_(pjmedia_port *port, pjmedia_frame *frame)
+{
+	FileSoundPort *self = (FileSoundPort*)port->port_data.user_data;
+
+	if (self->source_ != NULL && pjmedia_port_get_frame(self->source_, frame) == PJ_SUCCESS)
+		return PJ_SUCCESS;
+
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	frame->size = 0;
+	return PJ_SUCCESS;
+}
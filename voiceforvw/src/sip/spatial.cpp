@@ -0,0 +1,288 @@
+/* spatial.cpp -- spatial audio module
+ *
+ *			Copyright 2009, 3di.jp Inc
+ */
+
+#include <main.h>
+#include <spatial.hpp>
+#include <mixer.hpp>
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VFVW_SPATIAL_SSE2
+#include <emmintrin.h>
+#endif
+
+#define SPATIAL_SIGNATURE	PJMEDIA_PORT_SIGNATURE('S', 'L', 'S', 'P')
+
+// frames still mixed after the last loud one, so word endings aren't cut
+#define SPATIAL_QUIET_HANGOVER	10
+
+//=============================================================================
+static float dot_(const float a[3], const float b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+float spatial_distance(const Orientation& source, const Orientation& listener)
+{
+	float v[3];
+	for (int i = 0; i < 3; i++)
+		v[i] = source.position[i] - listener.position[i];
+
+	return sqrt(dot_(v, v));
+}
+
+SpatialGains spatial_gains(const Orientation& source, const Orientation& listener,
+						   float min_distance, float max_distance)
+{
+	float v[3];
+	for (int i = 0; i < 3; i++)
+		v[i] = source.position[i] - listener.position[i];
+
+	float distance = sqrt(dot_(v, v));
+	if (distance >= max_distance)
+		return SpatialGains(0.0f, 0.0f);
+
+	float gain = 1.0f;
+	if (distance > min_distance)
+		gain = min_distance / distance;
+
+	// -1 (right) .. 1 (left), centered when the source is on top of the
+	// listener or the viewer did not send a left axis
+	float pan = 0.0f;
+	float left_len = sqrt(dot_(listener.left, listener.left));
+	if (distance > 1e-3f && left_len > 1e-3f)
+		pan = dot_(v, listener.left) / (distance * left_len);
+
+	float theta = (1.0f - pan) * 0.78539816f;	// 0 .. pi/2
+
+	return SpatialGains(gain * cos(theta), gain * sin(theta));
+}
+
+//=============================================================================
+void spatial_pan_scalar(const pj_int16_t *in, pj_int16_t *out, unsigned count,
+						const SpatialGains& from, const SpatialGains& to)
+{
+	float l = from.left;
+	float r = from.right;
+	float dl = (to.left - from.left) / count;
+	float dr = (to.right - from.right) / count;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		float sl = in[i] * l;
+		float sr = in[i] * r;
+
+		sl = sl > 32767.0f ? 32767.0f : (sl < -32768.0f ? -32768.0f : sl);
+		sr = sr > 32767.0f ? 32767.0f : (sr < -32768.0f ? -32768.0f : sr);
+
+		out[2 * i] = (pj_int16_t)floor(sl + 0.5f);
+		out[2 * i + 1] = (pj_int16_t)floor(sr + 0.5f);
+
+		l += dl;
+		r += dr;
+	}
+}
+
+#ifdef VFVW_SPATIAL_SSE2
+
+void spatial_pan(const pj_int16_t *in, pj_int16_t *out, unsigned count,
+				 const SpatialGains& from, const SpatialGains& to)
+{
+	float dl = (to.left - from.left) / count;
+	float dr = (to.right - from.right) / count;
+
+	// gains of samples i..i+3
+	__m128 l = _mm_setr_ps(from.left, from.left + dl, from.left + 2 * dl, from.left + 3 * dl);
+	__m128 r = _mm_setr_ps(from.right, from.right + dr, from.right + 2 * dr, from.right + 3 * dr);
+	__m128 step_l = _mm_set1_ps(4 * dl);
+	__m128 step_r = _mm_set1_ps(4 * dr);
+
+	unsigned i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// 4 samples, sign extended to 32 bit
+		__m128i s = _mm_loadl_epi64((const __m128i*)(in + i));
+		s = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128 f = _mm_cvtepi32_ps(s);
+
+		__m128i sl = _mm_cvtps_epi32(_mm_mul_ps(f, l));
+		__m128i sr = _mm_cvtps_epi32(_mm_mul_ps(f, r));
+
+		// L0 R0 L1 R1 L2 R2 L3 R3, packs saturates
+		__m128i lr = _mm_packs_epi32(_mm_unpacklo_epi32(sl, sr), _mm_unpackhi_epi32(sl, sr));
+		_mm_storeu_si128((__m128i*)(out + 2 * i), lr);
+
+		l = _mm_add_ps(l, step_l);
+		r = _mm_add_ps(r, step_r);
+	}
+
+	if (i < count)
+	{
+		SpatialGains tail_from(from.left + i * dl, from.right + i * dr);
+		spatial_pan_scalar(in + i, out + 2 * i, count - i, tail_from, to);
+	}
+}
+
+#else
+
+void spatial_pan(const pj_int16_t *in, pj_int16_t *out, unsigned count,
+				 const SpatialGains& from, const SpatialGains& to)
+{
+	spatial_pan_scalar(in, out, count, from, to);
+}
+
+#endif
+
+//=============================================================================
+SpatialPort::SpatialPort(unsigned clock_rate, unsigned channel_count,
+						 unsigned samples_per_frame, unsigned quiet_level,
+						 const SourceVolume *volume)
+	: channel_count_(channel_count), has_frame_(false),
+	  quiet_level_(quiet_level), hangover_(0), volume_(volume)
+{
+	const pj_str_t name = pj_str((char*)"spatial");
+
+	pjmedia_port_info_init(&port_.info, &name, SPATIAL_SIGNATURE,
+		clock_rate, channel_count, 16, samples_per_frame);
+
+	port_.port_data.user_data = this;
+	port_.put_frame = &put_frame_;
+	port_.get_frame = &get_frame_;
+	port_.on_destroy = NULL;
+
+	mono_ = new pj_int16_t[samples_per_frame / channel_count];
+	frame_ = new pj_int16_t[samples_per_frame];
+}
+
+SpatialPort::~SpatialPort()
+{
+	delete [] mono_;
+	delete [] frame_;
+}
+
+void SpatialPort::SetGains(const SpatialGains& gains)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	target_ = gains;
+}
+
+pj_status_t SpatialPort::put_frame_(pjmedia_port *port, const pjmedia_frame *frame)
+{
+	SpatialPort *self = (SpatialPort*)port->port_data.user_data;
+
+	if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO)
+	{
+		self->has_frame_ = false;
+		return PJ_SUCCESS;
+	}
+
+	// calls are mono, a stereo bridge hands them over duplicated to both
+	// channels
+	const pj_int16_t *samples = (const pj_int16_t*)frame->buf;
+	unsigned channels = self->channel_count_;
+	unsigned count = port->info.samples_per_frame / channels;
+
+	unsigned long energy = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		self->mono_[i] = samples[channels * i];
+		energy += abs(samples[channels * i]);
+	}
+
+	if (self->quiet_level_ == 0 || energy >= (unsigned long)self->quiet_level_ * count)
+		self->hangover_ = SPATIAL_QUIET_HANGOVER;
+	else if (self->hangover_ > 0)
+		self->hangover_--;
+
+	self->has_frame_ = (self->hangover_ > 0);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t SpatialPort::get_frame_(pjmedia_port *port, pjmedia_frame *frame)
+{
+	SpatialPort *self = (SpatialPort*)port->port_data.user_data;
+
+	if (!self->render_((pj_int16_t*)frame->buf))
+	{
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+		return PJ_SUCCESS;
+	}
+
+	frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame->size = port->info.bytes_per_frame;
+
+	return PJ_SUCCESS;
+}
+
+bool SpatialPort::Mix(pj_int32_t *acc)
+{
+	if (!has_frame_)
+		return false;
+
+	if (channel_count_ == 2)
+	{
+		render_(frame_);
+		mix_accumulate(acc, frame_, port_.info.samples_per_frame, MIXER_GAIN_UNITY);
+		return true;
+	}
+
+	// a mono bridge has no panning to do, the gain is applied while mixing
+	SpatialGains target = next_gains_();
+
+	mix_accumulate(acc, mono_, port_.info.samples_per_frame, mix_gain(target.left));
+
+	current_ = target;
+	has_frame_ = false;
+
+	return true;
+}
+
+bool SpatialPort::render_(pj_int16_t *out)
+{
+	if (!has_frame_)
+		return false;
+
+	SpatialGains target = next_gains_();
+
+	unsigned count = port_.info.samples_per_frame / channel_count_;
+
+	if (channel_count_ == 2)
+		spatial_pan(mono_, out, count, current_, target);
+	else
+	{
+		pj_int16_t gain = mix_gain(target.left);
+		for (unsigned i = 0; i < count; i++)
+		{
+			pj_int32_t v = ((pj_int32_t)mono_[i] * gain) >> MIXER_GAIN_SHIFT;
+			out[i] = (pj_int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+		}
+	}
+
+	current_ = target;
+	has_frame_ = false;
+
+	return true;
+}
+
+SpatialGains SpatialPort::next_gains_()
+{
+	SpatialGains target;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		target = target_;
+	}
+
+	if (volume_ != NULL)
+	{
+		float volume = (float)*volume_ / MIXER_GAIN_UNITY;
+		target.left *= volume;
+		target.right *= volume;
+	}
+
+	return target;
+}
@@ -40,7 +40,7 @@ result AccountLogoutState::react(const AccountLoginEvent& ev)
 	// access to the voip frontend
 	ServerUtil::getServerInfo(con->voiceserver_url + machine.info->account.name, sipinfo);
 
-    machine.info->sipconf = new SIPConference(sipinfo);
+    machine.info->sipconf = create_sip_backend(sipinfo);
 
     uinfo.name = machine.info->account.name;
     uinfo.password = machine.info->account.password;
@@ -58,7 +58,7 @@ result AccountLogoutState::react(const AccountLoginEvent& ev)
 
     sipinfo.reguri = "sip:" + domain;  
 
-    machine.info->sipconf = new SIPConference(sipinfo);
+    machine.info->sipconf = create_sip_backend(sipinfo);
 
     uinfo.name = machine.info->account.name;
     uinfo.password = machine.info->account.password;
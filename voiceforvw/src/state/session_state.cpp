@@ -4,6 +4,9 @@
  */
 
 #include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <cmath>
 
 #include "main.h"
 #include "state.hpp"
@@ -39,7 +42,7 @@ result SessionIdleState::react(const SessionCreateEvent& ev) {
 		g_logger->Info("SESSION") << "Account ID = " << machine.info->account->id << endl;
 		
 		ConnectorInfo *con = glb_server->getConnector();
-		SIPConference *psc = machine.info->account->sipconf;
+		SIPBackend *psc = machine.info->account->sipconf;
 
         if (psc != NULL) {
 
@@ -55,8 +58,7 @@ result SessionIdleState::react(const SessionCreateEvent& ev) {
 			// connect to conference
             psc->Join(
 				sipinfo.sipuri, machine.info->account->id, 
-                &machine.info->id,
-                machine.info->session.connectedType
+                &machine.info->id
                 );
 #else
             // connect to conference
@@ -68,8 +70,7 @@ result SessionIdleState::react(const SessionCreateEvent& ev) {
             psc->Join(
                 invite+"@"+domain,		// Saved PBX URI from Account.Login
                 machine.info->account->id, 
-                &machine.info->id,
-                machine.info->session.connectedType
+                &machine.info->id
                 );
 #endif
 			con->session.registId(machine.info->id, machine.info->handle);
@@ -147,7 +148,7 @@ result SessionCallingState::react(const SessionTerminateEvent& ev)
 
     g_logger->Terse("STATE") << "=======  SESSION  ======== CallingState Terminate" << endl;
     //Added July 7, 2009
-    SIPConference *psc = machine.info->account->sipconf;	
+    SIPBackend *psc = machine.info->account->sipconf;	
     if (psc != NULL) 
     {
         psc->Leave(machine.info->id);
@@ -234,7 +235,7 @@ result SessionIncomingState::react(const SessionConnectEvent& ev)
 {
 	g_logger->Debug("STATE") << "SessionIncoming react (SessionConnectEvent)" << endl;
 
-	SIPConference *psc = machine.info->account->sipconf;
+	SIPBackend *psc = machine.info->account->sipconf;
 
     if (psc != NULL) {
 		// answer to incoming request
@@ -287,7 +288,7 @@ result SessionEarlyState::react(const SessionTerminateEvent& ev)
 {
     g_logger->Debug("STATE") << "SessionEarly react (SessionTerminateEvent)" << endl;
  
-    SIPConference *psc = machine.info->account->sipconf;
+    SIPBackend *psc = machine.info->account->sipconf;
     if (psc != NULL) 
     {
         // disconnect
@@ -300,7 +301,7 @@ result SessionEarlyState::react(const SessionConnectEvent& ev)
 {
 	g_logger->Debug("STATE") << "SessionEarly react (SessionConnectEvent)" << endl;
 
-	SIPConference *psc = machine.info->account->sipconf;
+	SIPBackend *psc = machine.info->account->sipconf;
 
     if (psc != NULL) {
 		// answer to incoming request
@@ -365,64 +366,279 @@ result SessionConnectingState::react(const DialDisconnectedEvent& ev)
 }
 
 //=============================================================================
-// VolumeCheckingThread
+// ParticipantReporter
+//
+// Tells the viewer the energy and speaking of every confirmed session from
+// one thread. The meters are read without a lock, so they are looked at
+// every VFVW_METER_POLL_INTERVAL msec, but a ParticipantPropertiesEvent
+// only goes out when something the viewer shows has changed, or as a
+// heartbeat after ParticipantHeartbeat msec. Every QualityInterval msec
+// it also samples each call's RTCP statistics, for the metrics endpoint
+// and, with QualityEvents, a SessionMediaQualityEvent. All the events of
+// one tick are sent in a single write.
 //=============================================================================
-void VolumeCheckingThread::operator()()
+class ParticipantReporter
 {
-	unsigned int tx_level;
-	unsigned int rx_level;
+	public:
+		ParticipantReporter() : started_(false) {}
 
-	float mic_volume = 0.0f;
+		void Add(int call_id, const string& handle, SIPBackend *sipconf)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
 
-	pj_thread_desc desc;
-	pj_thread_t *thread;
-	pj_thread_register("volume_polling", desc, &thread);
+			Reported r;
+			r.handle = handle;
+			r.sipconf = sipconf;
+			reported_[call_id] = r;
 
-	while (!stopped)
-	{
-		pj_status_t status;
-		pjsua_call_info ci;
+			if (!started_)
+			{
+				boost::thread(boost::ref(*this));
+				started_ = true;
+			}
+			cond_.notify_one();
+		}
 
-		if (call_id >= 0)
+		// the backend is not used any more once this returns: an AdaptCodec
+		// on the call is waited for, and the call's samples yet to be
+		// adapted are dropped
+		void Remove(int call_id)
 		{
-			status = pjsua_call_get_info((pjsua_call_id)call_id, &ci);
-			if (status == PJ_SUCCESS)
+			boost::mutex::scoped_lock adapting(adapt_mutex_);
+			boost::mutex::scoped_lock lock(mutex_);
+
+			for (size_t i = 0; i < adapt_.size(); )
 			{
-				status = pjsua_conf_get_signal_level(ci.conf_slot, &tx_level, &rx_level);
-				if (status == PJ_SUCCESS)
+				if (adapt_[i].call_id == call_id)
+					adapt_.erase(adapt_.begin() + i);
+				else
+					i++;
+			}
+
+			map<int, Reported>::iterator ite = reported_.find(call_id);
+			if (ite == reported_.end())
+				return;
+
+			if (g_metrics != NULL)
+				g_metrics->RemoveCallQuality(ite->second.handle);
+			reported_.erase(ite);
+		}
+
+		void operator()()
+		{
+			pj_thread_desc desc;
+			pj_thread_t *thread;
+			pj_thread_register("participant_reporter", desc, &thread);
+
+			for (;;)
+			{
+				string batch;
+				vector<Sampled> adapt;
 				{
-					ConnectorInfo *con = glb_server->getConnector();
-					mic_volume = con->audio.mic_volume;
+					boost::mutex::scoped_lock lock(mutex_);
 
-					mic_volume = ((mic_volume+100) / 200) * 100;
+					while (reported_.empty())
+						cond_.wait(lock);
 
-					ParticipantPropertiesEvent partPropEvent;
-					partPropEvent.SessionHandle = handle;
-					partPropEvent.ParticipantURI = glb_server->participantURI;
-					partPropEvent.IsLocallyMuted = "false";
-					partPropEvent.IsModeratorMuted = "false";
-					char buf[255];
-					sprintf(buf, "%d", (int)mic_volume);
-					partPropEvent.Volume = buf;
+					if (glb_server != NULL)
+						batch = tick_();
 
-					// tx_level is a value between 0 and 255
-					// energy is between 0 and 1.0
+					adapt.swap(adapt_);
+				}
 
-					sprintf(buf, "%1.2f", (((float)tx_level) / 256.0));
-					partPropEvent.Energy = buf;
+				if (!batch.empty())
+					glb_server->Send(batch);
 
-					if (tx_level > 20)
-					{
-						partPropEvent.IsSpeaking = "true";
-					}
+				// a switch re-INVITEs, which is not done under the lock. A call
+				// removed since its sample was taken is left alone, Remove
+				// waits for one being adapted.
+				for (size_t i = 0; i < adapt.size(); i++)
+				{
+					boost::mutex::scoped_lock adapting(adapt_mutex_);
 
-					glb_server->Send (partPropEvent.ToString());
+					if (is_reported_(adapt[i].call_id, adapt[i].sipconf))
+						adapt[i].sipconf->AdaptCodec(adapt[i].call_id, adapt[i].quality);
 				}
+
+				pj_thread_sleep(VFVW_METER_POLL_INTERVAL);
 			}
 		}
-		    
-		pj_thread_sleep(200);
-	}
+
+	private:
+		struct Reported
+		{
+			Reported() : sipconf(NULL), sent(false), volume(0), energy(0.0f), speaking(false) {}
+
+			string handle;
+			SIPBackend *sipconf;
+
+			// as last sent
+			bool sent;
+			boost::system_time when;
+			int volume;
+			float energy;
+			bool speaking;
+
+			// as last sampled
+			boost::system_time quality_when;
+			CallQuality quality;
+		};
+
+		// a sample waiting for AdaptCodec
+		struct Sampled
+		{
+			int call_id;
+			SIPBackend *sipconf;
+			CallQuality quality;
+		};
+
+		bool is_reported_(int call_id, SIPBackend *sipconf)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			map<int, Reported>::iterator ite = reported_.find(call_id);
+			return ite != reported_.end() && ite->second.sipconf == sipconf;
+		}
+
+		// the loss is over the interval, the rest as pjmedia has it
+		void sample_quality_(int call_id, Reported& r, string& batch)
+		{
+			CallQuality q;
+			if (!r.sipconf->GetQuality(call_id, &q))
+				return;
+
+			if (g_metrics != NULL)
+				g_metrics->SetCallQuality(r.handle, q);
+
+			if (g_config->AdaptiveCodecs.size() >= 2)
+			{
+				Sampled sampled;
+				sampled.call_id = call_id;
+				sampled.sipconf = r.sipconf;
+				sampled.quality = q;
+				adapt_.push_back(sampled);
+			}
+
+			if (g_config->QualityEvents)
+			{
+				unsigned received = q.rx_packets - r.quality.rx_packets;
+				unsigned lost = q.rx_lost - r.quality.rx_lost;
+				float loss = (received + lost > 0) ? 100.0f * lost / (received + lost) : 0.0f;
+
+				SessionMediaQualityEvent qualityEvent;
+				qualityEvent.SessionHandle = r.handle;
+				qualityEvent.PacketsReceived = boost::lexical_cast<string>(q.rx_packets);
+				qualityEvent.PacketsLost = boost::lexical_cast<string>(q.rx_lost);
+
+				char buf[32];
+				sprintf(buf, "%1.1f", loss);
+				qualityEvent.PacketLoss = buf;
+
+				qualityEvent.RemotePacketsLost = boost::lexical_cast<string>(q.tx_lost);
+				qualityEvent.Jitter = boost::lexical_cast<string>(q.jitter_ms);
+				qualityEvent.RoundTripTime = boost::lexical_cast<string>(q.rtt_ms);
+				qualityEvent.JitterBufferFrames = boost::lexical_cast<string>(q.jb_frames);
+				qualityEvent.JitterBufferPrefetch = boost::lexical_cast<string>(q.jb_prefetch);
+				qualityEvent.ConcealedFrames = boost::lexical_cast<string>(q.plc_frames);
+
+				batch += qualityEvent.ToString();
+			}
+
+			r.quality = q;
+		}
+
+		string tick_()
+		{
+			ConnectorInfo *con = glb_server->getConnector();
+			int volume = (int)(((con->audio.mic_volume + 100) / 200) * 100);
+
+			boost::system_time now = boost::get_system_time();
+			boost::posix_time::milliseconds heartbeat(g_config->ParticipantHeartbeat);
+			boost::posix_time::milliseconds quality(g_config->QualityInterval);
+
+			// nobody to tell and nothing to adapt, nothing to sample
+			bool sampling = g_config->QualityInterval > 0
+				&& (g_config->QualityEvents || g_metrics != NULL || g_config->AdaptiveCodecs.size() >= 2);
+
+			string batch;
+
+			for (map<int, Reported>::iterator ite = reported_.begin(); ite != reported_.end(); ++ite)
+			{
+				Reported& r = ite->second;
+
+				if (sampling && r.sipconf != NULL
+				 && (r.quality_when.is_not_a_date_time() || now - r.quality_when >= quality))
+				{
+					sample_quality_(ite->first, r, batch);
+					r.quality_when = now;
+				}
+
+				MeterReading meter;
+				if (r.sipconf == NULL || !r.sipconf->GetMeter(ite->first, &meter))
+					continue;
+
+				// the level is a value between 0 and 255
+				// energy is between 0 and 1.0
+				float energy = ((float)meter.level) / 256.0f;
+
+				bool changed = !r.sent
+					|| meter.speaking != r.speaking
+					|| volume != r.volume
+					|| fabs(energy - r.energy) >= g_config->ParticipantEnergyDelta
+					|| now - r.when >= heartbeat;
+				if (!changed)
+					continue;
+
+				ParticipantPropertiesEvent partPropEvent;
+				partPropEvent.SessionHandle = r.handle;
+				partPropEvent.ParticipantURI = glb_server->participantURI;
+				partPropEvent.IsLocallyMuted = "false";
+				partPropEvent.IsModeratorMuted = "false";
+				char buf[255];
+				sprintf(buf, "%d", volume);
+				partPropEvent.Volume = buf;
+
+				sprintf(buf, "%1.2f", energy);
+				partPropEvent.Energy = buf;
+
+				if (meter.speaking)
+				{
+					partPropEvent.IsSpeaking = "true";
+				}
+
+				batch += partPropEvent.ToString();
+
+				r.sent = true;
+				r.when = now;
+				r.volume = volume;
+				r.energy = energy;
+				r.speaking = meter.speaking;
+			}
+
+			return batch;
+		}
+
+	private:
+		map<int, Reported> reported_;
+		vector<Sampled> adapt_;
+		boost::mutex mutex_;
+		boost::mutex adapt_mutex_;		// held around AdaptCodec, taken before mutex_
+		boost::condition_variable cond_;
+		bool started_;
+};
+
+// created with the first confirmed session and never deleted, its thread
+// runs until the process exits
+static ParticipantReporter *glb_reporter = NULL;
+static boost::mutex glb_reporterMutex;
+
+static ParticipantReporter* reporter_()
+{
+	boost::mutex::scoped_lock lock(glb_reporterMutex);
+
+	if (glb_reporter == NULL)
+		glb_reporter = new ParticipantReporter();
+	return glb_reporter;
 }
 
 //=============================================================================
@@ -436,11 +652,11 @@ SessionConfirmedState::SessionConfirmedState(my_context ctx) :
 
     // Mute mic on first connect
     ConnectorInfo *con = glb_server->getConnector();
-    SIPConference *psc = machine.info->account->sipconf;
+    SIPBackend *psc = machine.info->account->sipconf;
 
     if (psc != NULL && con->audio.mic_mute) 
     {
-        psc->AdjustTranVolume(machine.info->id, 0.0f);
+        psc->SetMicMute(machine.info->id, true);
     }
 
 	SessionStateChangeEvent sessionStateEvent;
@@ -487,27 +703,23 @@ SessionConfirmedState::SessionConfirmedState(my_context ctx) :
 		glb_server->Send(mediaStreamUpdatedEvent.ToString());
 	}
 
-	// TODO: New thread for volume checking
-	volumeCheckingThread.call_id = machine.info->id;
-	volumeCheckingThread.handle = machine.info->handle;
-	volumeCheckingThread.stopped = false;
-
-	thr = boost::thread(boost::ref(volumeCheckingThread));
+	reporter_()->Add(machine.info->id, machine.info->handle, psc);
 }
 
 SessionConfirmedState::~SessionConfirmedState() 
 {
     g_logger->Debug("STATE") << "SessionConfirmed exited" << endl;
+
+	reporter_()->Remove(machine.info->id);
 }
 
 result SessionConfirmedState::react(const SessionTerminateEvent& ev) 
 {
 	g_logger->Debug("STATE") << "SessionConfirmed react (SessionTerminateEvent)" << endl;
 
-	SIPConference *psc = machine.info->account->sipconf;
+	SIPBackend *psc = machine.info->account->sipconf;
 
-	volumeCheckingThread.stopped = true;
-	thr.join();
+	reporter_()->Remove(machine.info->id);
 
     if (psc != NULL) {
         // disconnect
@@ -532,15 +744,14 @@ result SessionConfirmedState::react(const AudioEvent& ev)
     float spk_volume = 0.0f;
 
 	ConnectorInfo *con = glb_server->getConnector();
-	SIPConference *psc = machine.info->account->sipconf;
+	SIPBackend *psc = machine.info->account->sipconf;
 
-    // adjust mic volume
-    if (!con->audio.mic_mute) {
-        mic_volume = con->audio.mic_volume;
-        // adjust between SL and PJSIP
-        mic_volume = (mic_volume - VFVW_SL_VOLUME_MIN)
-                     * VFVW_PJ_VOLUME_RANGE / VFVW_SL_VOLUME_RANGE;
-    }
+    // adjust mic volume, kept as it is while muted so that unmuting
+    // comes back at the same level
+    mic_volume = con->audio.mic_volume;
+    // adjust between SL and PJSIP
+    mic_volume = (mic_volume - VFVW_SL_VOLUME_MIN)
+                 * VFVW_PJ_VOLUME_RANGE / VFVW_SL_VOLUME_RANGE;
 
     // adjust speaker volume
     if (!con->audio.speaker_mute) {
@@ -552,6 +763,7 @@ result SessionConfirmedState::react(const AudioEvent& ev)
 
     if (psc != NULL) {
         psc->AdjustTranVolume(machine.info->id, mic_volume);
+        psc->SetMicMute(machine.info->id, con->audio.mic_mute);
 		psc->AdjustRecvVolume(machine.info->id, spk_volume);
     }
 
@@ -562,17 +774,67 @@ result SessionConfirmedState::react(const PositionEvent& ev)
 {
 	g_logger->Debug("STATE") << "SessionConfirmed react (PositionEvent)" << endl;
 
-    // TODO
+    ev.message->SetState(machine.info->speaker, machine.info->listener);
+
+	SIPBackend *psc = machine.info->account->sipconf;
+
+    if (psc != NULL && g_config->SpatialAudio) {
+        psc->AdjustSpatialGains(machine.info->id,
+            spatial_gains(machine.info->speaker, machine.info->listener,
+                          g_config->SpatialMinDistance, g_config->SpatialMaxDistance));
+
+        if (g_config->SpatialCulling) {
+            // come back a little inside the radius, so that a source walking
+            // along its edge isn't connected and disconnected all the time
+            float distance = spatial_distance(machine.info->speaker, machine.info->listener);
+            float radius = g_config->SpatialMaxDistance;
+            if (machine.info->culled)
+                radius -= VFVW_SPATIAL_CULL_HYSTERESIS;
+
+            bool culled = (distance >= radius);
+            if (culled != machine.info->culled) {
+                psc->SetAudible(machine.info->id, !culled);
+                machine.info->culled = culled;
+            }
+        }
+    }
 
     return discard_event();
 }
 
+// Each session is one call, so its participant is that call: the viewer
+// names the avatar, this turns the whole session up, down or off.
+result SessionConfirmedState::react(const ParticipantEvent& ev) 
+{
+	g_logger->Debug("STATE") << "SessionConfirmed react (ParticipantEvent)" << endl;
+
+	SIPBackend *psc = machine.info->account->sipconf;
+	if (psc == NULL)
+		return discard_event();
+
+	if (ev.message->Type == SessionSetParticipantMuteForMe1) {
+		const SessionSetParticipantMuteForMeRequest *req
+			= (const SessionSetParticipantMuteForMeRequest*)ev.message;
+		psc->SetParticipantMute(machine.info->id, req->Mute == "true");
+	}
+	else {
+		const SessionSetParticipantVolumeForMeRequest *req
+			= (const SessionSetParticipantVolumeForMeRequest*)ev.message;
+		int volume = atoi(req->Volume.c_str());
+		volume = max(0, min(volume, VFVW_SL_PARTICIPANT_VOLUME_MAX));
+		psc->AdjustParticipantVolume(machine.info->id,
+			(float)volume / VFVW_SL_PARTICIPANT_VOLUME_UNITY);
+	}
+
+	return discard_event();
+}
+
 // v1.22
 result SessionConfirmedState::react(const SessionMediaDisconnectEvent& ev) 
 {
 	g_logger->Debug("STATE") << "SessionConfirmed react (SessionMediaDisconnectEvent)" << endl;
 
-	volumeCheckingThread.stopped = true;
+	reporter_()->Remove(machine.info->id);
 
 	// We are disconnecting from this session
 	SessionStateChangeEvent sessionStateEvent;